@@ -0,0 +1,178 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  malloc, calloc and realloc are replaced by counting versions that
+ *  call the glibc allocator. Syscall wrappers called from the ACAP's
+ *  own objects are wrapped by the linker (--wrap in the Makefile).
+ *  Calls made inside libraries, e.g. larod and VDO, are not seen, and
+ *  clock_gettime is left out as the vDSO serves it without a syscall.
+ *  Counters are per thread, so only the inference thread is measured.
+ *  The contract is zero of both per frame.
+ *------------------------------------------------------------------*/
+
+#ifdef TFLITE_AUDIT
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "STATUS.h"
+#include "AUDIT.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+#define AUDIT_OFF		0
+#define AUDIT_FRAME		1
+#define AUDIT_JOB		2
+#define AUDIT_RESULT	3
+#define AUDIT_WARNINGS	10	//Frames breaking the contract that are logged
+
+extern void* __libc_malloc( size_t size );
+extern void* __libc_calloc( size_t count, size_t size );
+extern void* __libc_realloc( void* ptr, size_t size );
+
+static __thread int auditState = AUDIT_OFF;
+static __thread unsigned long allocations[4];
+static __thread unsigned long syscalls[4];
+
+unsigned long auditFrames = 0;
+unsigned long auditDirty = 0;		//Frames with allocations or syscalls in the hot path
+unsigned long auditAllocations = 0;
+unsigned long auditSyscalls = 0;
+unsigned long auditJobAllocations = 0;
+unsigned long auditResultAllocations = 0;
+
+void*
+malloc( size_t size ) {
+	allocations[auditState]++;
+	return __libc_malloc( size );
+}
+
+void*
+calloc( size_t count, size_t size ) {
+	allocations[auditState]++;
+	return __libc_calloc( count, size );
+}
+
+void*
+realloc( void* ptr, size_t size ) {
+	allocations[auditState]++;
+	return __libc_realloc( ptr, size );
+}
+
+extern ssize_t __real_read( int fd, void* buffer, size_t count );
+extern ssize_t __real_write( int fd, const void* buffer, size_t count );
+extern off_t __real_lseek( int fd, off_t offset, int whence );
+extern int __real_ioctl( int fd, unsigned long request, void* arg );
+extern void* __real_mmap( void* addr, size_t length, int prot, int flags, int fd, off_t offset );
+extern int __real_munmap( void* addr, size_t length );
+extern int __real_open( const char* path, int flags, ... );
+extern int __real_close( int fd );
+
+ssize_t
+__wrap_read( int fd, void* buffer, size_t count ) {
+	syscalls[auditState]++;
+	return __real_read( fd, buffer, count );
+}
+
+ssize_t
+__wrap_write( int fd, const void* buffer, size_t count ) {
+	syscalls[auditState]++;
+	return __real_write( fd, buffer, count );
+}
+
+off_t
+__wrap_lseek( int fd, off_t offset, int whence ) {
+	syscalls[auditState]++;
+	return __real_lseek( fd, offset, whence );
+}
+
+int
+__wrap_ioctl( int fd, unsigned long request, void* arg ) {
+	syscalls[auditState]++;
+	return __real_ioctl( fd, request, arg );
+}
+
+void*
+__wrap_mmap( void* addr, size_t length, int prot, int flags, int fd, off_t offset ) {
+	syscalls[auditState]++;
+	return __real_mmap( addr, length, prot, flags, fd, offset );
+}
+
+int
+__wrap_munmap( void* addr, size_t length ) {
+	syscalls[auditState]++;
+	return __real_munmap( addr, length );
+}
+
+int
+__wrap_open( const char* path, int flags, ... ) {
+	mode_t mode = 0;
+	if( flags & O_CREAT ) {
+		va_list args;
+		va_start( args, flags );
+		mode = va_arg( args, int );
+		va_end( args );
+	}
+	syscalls[auditState]++;
+	return __real_open( path, flags, mode );
+}
+
+int
+__wrap_close( int fd ) {
+	syscalls[auditState]++;
+	return __real_close( fd );
+}
+
+void
+AUDIT_Begin() {
+	allocations[AUDIT_FRAME] = allocations[AUDIT_JOB] = allocations[AUDIT_RESULT] = 0;
+	syscalls[AUDIT_FRAME] = 0;
+	auditState = AUDIT_FRAME;
+}
+
+void
+AUDIT_Job( bool running ) {
+	if( auditState != AUDIT_OFF )
+		auditState = running ? AUDIT_JOB : AUDIT_FRAME;
+}
+
+void
+AUDIT_Result( bool building ) {
+	if( auditState != AUDIT_OFF )
+		auditState = building ? AUDIT_RESULT : AUDIT_FRAME;
+}
+
+void
+AUDIT_End() {
+	if( auditState == AUDIT_OFF )
+		return;
+	auditState = AUDIT_OFF;
+	auditFrames++;
+	auditAllocations += allocations[AUDIT_FRAME];
+	auditJobAllocations += allocations[AUDIT_JOB];
+	auditResultAllocations += allocations[AUDIT_RESULT];
+	auditSyscalls += syscalls[AUDIT_FRAME];
+	if( allocations[AUDIT_FRAME] || syscalls[AUDIT_FRAME] ) {
+		if( auditDirty++ < AUDIT_WARNINGS )
+			LOG_WARN( "%s: Frame %lu made %lu allocations and %lu syscalls\n", __func__, auditFrames, allocations[AUDIT_FRAME], syscalls[AUDIT_FRAME] );
+	}
+}
+
+void
+AUDIT_Status() {
+	STATUS_SetNumber( "audit", "frames", auditFrames );
+	STATUS_SetNumber( "audit", "dirtyFrames", auditDirty );
+	STATUS_SetNumber( "audit", "allocations", auditAllocations );
+	STATUS_SetNumber( "audit", "syscalls", auditSyscalls );
+	STATUS_SetNumber( "audit", "jobAllocations", auditJobAllocations );
+	STATUS_SetNumber( "audit", "resultAllocations", auditResultAllocations );
+}
+
+#endif
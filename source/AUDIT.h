@@ -0,0 +1,41 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  AUDIT counts heap allocations and syscalls made on the inference
+ *  thread while a frame is processed. It is built with "make AUDIT=1" and compiles
+ *  to nothing otherwise. The larod job and the result JSON are counted
+ *  apart from the hot path.
+ *------------------------------------------------------------------*/
+
+#ifndef _AUDIT_H_
+#define _AUDIT_H_
+
+#include <stdbool.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#ifdef TFLITE_AUDIT
+
+void	AUDIT_Begin( void );		//Start of a frame
+void	AUDIT_Job( bool running );	//Brackets the larod job
+void	AUDIT_Result( bool building );	//Brackets the result JSON
+void	AUDIT_End( void );			//End of a frame
+void	AUDIT_Status( void );		//Updates the status group "audit"
+
+#else
+
+#define AUDIT_Begin()			{}
+#define AUDIT_Job( running )	{}
+#define AUDIT_Result( building )	{}
+#define AUDIT_End()				{}
+#define AUDIT_Status()			{}
+
+#endif
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  The scan compares 16 raw 8 bit scores at a time against the
+ *  threshold and only looks at individual scores in blocks where at
+ *  least one passed. int8 scores are offset by 128 (sign bit flipped)
+ *  and float32 scores mapped to keys that sort like the values. Passing scores are kept in a min-heap of size k
+ *  and the threshold is raised to the heap minimum once it is full.
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "CLASSIFY.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CLASSIFY_NEON 1
+#endif
+
+//Negative floats have their bits inverted, positive their sign bit set, so keys sort as the values
+static inline uint32_t
+CLASSIFY_FloatKey( float value ) {
+	uint32_t bits;
+	memcpy( &bits, &value, sizeof(bits) );
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+static inline float
+CLASSIFY_FloatValue( uint32_t key ) {
+	uint32_t bits = key & 0x80000000u ? key & 0x7fffffffu : ~key;
+	float value;
+	memcpy( &value, &bits, sizeof(value) );
+	return value;
+}
+
+uint64_t
+CLASSIFY_Threshold( double confidence, int type, float scale, int zeroPoint ) {
+	if( confidence <= 0 )
+		return 0;
+	if( confidence > 100 )
+		return CLASSIFY_NONE;
+	if( type == CLASSIFY_FLOAT32 )
+		return CLASSIFY_FloatKey( (float)(confidence / 100.0) );
+	if( scale <= 0 )
+		return CLASSIFY_NONE;
+	//scale * (q - zeroPoint) >= confidence / 100  =>  q >= zeroPoint + confidence / 100 / scale
+	double q = ceil( zeroPoint + confidence / 100.0 / scale - 1e-4 );
+	if( type == CLASSIFY_INT8 )
+		q += 128;
+	if( q < 0 )
+		return 0;
+	return q > 255 ? CLASSIFY_NONE : (uint64_t)q;
+}
+
+double
+CLASSIFY_Score( const CLASSIFY_Item* item, int type, float scale, int zeroPoint ) {
+	switch( type ) {
+		case CLASSIFY_FLOAT32:
+			return CLASSIFY_FloatValue( item->score ) * 100.0;
+		case CLASSIFY_INT8:
+			return ((int)item->score - 128 - zeroPoint) * scale * 100.0;
+		default:
+			return ((int)item->score - zeroPoint) * scale * 100.0;
+	}
+}
+
+//Lower score is worse. On equal score the higher id is worse (keeps label file order)
+static inline int
+CLASSIFY_Worse( const CLASSIFY_Item* a, const CLASSIFY_Item* b ) {
+	return a->score < b->score || (a->score == b->score && a->id > b->id);
+}
+
+static void
+CLASSIFY_SiftDown( CLASSIFY_Item* heap, size_t size, size_t i ) {
+	for(;;) {
+		size_t worst = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+		if( l < size && CLASSIFY_Worse( &heap[l], &heap[worst] ) )
+			worst = l;
+		if( r < size && CLASSIFY_Worse( &heap[r], &heap[worst] ) )
+			worst = r;
+		if( worst == i )
+			return;
+		CLASSIFY_Item tmp = heap[i];
+		heap[i] = heap[worst];
+		heap[worst] = tmp;
+		i = worst;
+	}
+}
+
+static void
+CLASSIFY_SiftUp( CLASSIFY_Item* heap, size_t i ) {
+	while( i > 0 ) {
+		size_t parent = (i - 1) / 2;
+		if( !CLASSIFY_Worse( &heap[i], &heap[parent] ) )
+			return;
+		CLASSIFY_Item tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+/*
+ * Adds a candidate to the heap. Returns the new minimum score needed to
+ * enter the heap. Ids arrive in increasing order so, once the heap is full,
+ * a candidate must beat the heap minimum strictly.
+ */
+static uint64_t
+CLASSIFY_Push( CLASSIFY_Item* heap, size_t* size, size_t k, uint32_t id, uint32_t score, uint64_t threshold ) {
+	if( *size < k ) {
+		heap[*size].id = id;
+		heap[*size].score = score;
+		CLASSIFY_SiftUp( heap, *size );
+		(*size)++;
+	} else {
+		heap[0].id = id;
+		heap[0].score = score;
+		CLASSIFY_SiftDown( heap, *size, 0 );
+	}
+	if( *size < k )
+		return threshold;
+	return (uint64_t)heap[0].score + 1;
+}
+
+#ifdef CLASSIFY_NEON
+static inline int
+CLASSIFY_Any( uint8x16_t mask ) {
+#if defined(__aarch64__)
+	return vmaxvq_u8( mask ) != 0;
+#else
+	uint8x8_t folded = vorr_u8( vget_low_u8( mask ), vget_high_u8( mask ) );
+	return vget_lane_u64( vreinterpret_u64_u8( folded ), 0 ) != 0;
+#endif
+}
+#endif
+
+size_t
+CLASSIFY_TopK( const void* scores, int type, size_t count, uint64_t threshold, CLASSIFY_Item* result, size_t k ) {
+	size_t size = 0;
+	size_t i = 0;
+
+	if( !scores || !result || k == 0 )
+		return 0;
+
+	if( type == CLASSIFY_FLOAT32 ) {
+		const float* values = scores;
+		for( ; threshold < CLASSIFY_NONE && i < count; i++ ) {
+			if( values[i] != values[i] )
+				continue;	//NaN
+			uint32_t key = CLASSIFY_FloatKey( values[i] );
+			if( key >= threshold )
+				threshold = CLASSIFY_Push( result, &size, k, (uint32_t)i, key, threshold );
+		}
+	} else {
+		const uint8_t* bytes = scores;
+		uint8_t flip = type == CLASSIFY_INT8 ? 0x80 : 0;
+#ifdef CLASSIFY_NEON
+		uint8x16_t flips = vdupq_n_u8( flip );
+		while( threshold <= 255 && i + 16 <= count ) {
+			uint8x16_t limit = vdupq_n_u8( (uint8_t)threshold );
+			uint8x16_t mask = vcgeq_u8( veorq_u8( vld1q_u8( bytes + i ), flips ), limit );
+			if( CLASSIFY_Any( mask ) ) {
+				size_t end = i + 16;
+				for( ; i < end; i++ )
+					if( (uint8_t)(bytes[i] ^ flip) >= threshold )
+						threshold = CLASSIFY_Push( result, &size, k, (uint32_t)i, bytes[i] ^ flip, threshold );
+			} else {
+				i += 16;
+			}
+		}
+#endif
+		for( ; threshold <= 255 && i < count; i++ )
+			if( (uint8_t)(bytes[i] ^ flip) >= threshold )
+				threshold = CLASSIFY_Push( result, &size, k, (uint32_t)i, bytes[i] ^ flip, threshold );
+	}
+
+	//Heap sort in place: the worst item is moved to the end each round
+	size_t n = size;
+	while( n > 1 ) {
+		CLASSIFY_Item tmp = result[0];
+		result[0] = result[n - 1];
+		result[n - 1] = tmp;
+		n--;
+		CLASSIFY_SiftDown( result, n, 0 );
+	}
+	return size;
+}
@@ -0,0 +1,45 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  CLASSIFY selects the best scoring classes from a classification
+ *  output (uint8, int8 or float32) without converting every score.
+ *  Scores are compared as raw keys in the order of their values and
+ *  only the selected ones are dequantized.
+ *------------------------------------------------------------------*/
+
+#ifndef _CLASSIFY_H_
+#define _CLASSIFY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define CLASSIFY_UINT8		0
+#define CLASSIFY_INT8		1
+#define CLASSIFY_FLOAT32	2
+
+#define CLASSIFY_NONE		0x100000000ULL	//Threshold that no score passes
+
+typedef struct CLASSIFY_Item {
+	uint32_t	id;		//Class id
+	uint32_t	score;	//Raw score as a key. 0-255 for the 8 bit types (int8 offset by 128), ordered float bits for float32
+} CLASSIFY_Item;
+
+//Converts a confidence level 0-100% to the smallest key that passes it.
+//Quantized types have real = scale * (q - zeroPoint), where real 1.0 is 100%
+uint64_t		CLASSIFY_Threshold( double confidence, int type, float scale, int zeroPoint );
+
+//Returns the number of items written to result, at most k, sorted with the highest score first
+size_t			CLASSIFY_TopK( const void* scores, int type, size_t count, uint64_t threshold, CLASSIFY_Item* result, size_t k );
+
+//Score of an item in percent
+double			CLASSIFY_Score( const CLASSIFY_Item* item, int type, float scale, int zeroPoint );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
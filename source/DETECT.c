@@ -0,0 +1,350 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  Candidates are stored as a structure of arrays so the IoU test in
+ *  the NMS can compare one box against four others per instruction.
+ *  NMS sorts the candidates by score, reorders the arrays in sorted
+ *  order and then runs greedy suppression on contiguous memory.
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <syslog.h>
+#include "DETECT.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DETECT_NEON 1
+#endif
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+//Raw SSD box coder scales (TensorFlow object detection API defaults)
+#define DETECT_SCALE_XY		10.0f
+#define DETECT_SCALE_WH		5.0f
+
+DETECT_Context*
+DETECT_Create( size_t capacity ) {
+	LOG_TRACE("%s: %u\n",__func__,(unsigned)capacity);
+
+	if( capacity == 0 )
+		return 0;
+	//Keep every array 16 byte aligned
+	capacity = (capacity + 3) & ~(size_t)3;
+
+	DETECT_Context* context = calloc( 1, sizeof(DETECT_Context) );
+	if( !context )
+		return 0;
+
+	size_t floats = capacity * sizeof(float);
+	size_t words = capacity * sizeof(uint32_t);
+	size_t bytes = 11 * floats + 3 * words + capacity * sizeof(uint64_t);
+	uint8_t* block = 0;
+	if( posix_memalign( (void**)&block, 16, bytes ) != 0 ) {
+		LOG_WARN("%s: Memory allocation error\n",__func__);
+		free( context );
+		return 0;
+	}
+	memset( block, 0, bytes );
+
+	context->capacity = capacity;
+	context->keys = (uint64_t*)block;	block += capacity * sizeof(uint64_t);
+	context->x1 = (float*)block;		block += floats;
+	context->y1 = (float*)block;		block += floats;
+	context->x2 = (float*)block;		block += floats;
+	context->y2 = (float*)block;		block += floats;
+	context->score = (float*)block;		block += floats;
+	context->area = (float*)block;		block += floats;
+	for( int i = 0; i < 5; i++ ) {
+		context->spare[i] = (float*)block;
+		block += floats;
+	}
+	context->classId = (uint32_t*)block;		block += words;
+	context->spareClassId = (uint32_t*)block;	block += words;
+	context->suppressed = (uint32_t*)block;
+	return context;
+}
+
+void
+DETECT_Free( DETECT_Context* context ) {
+	if( !context )
+		return;
+	//keys is the start of the block. It is never swapped
+	free( context->keys );
+	free( context );
+}
+
+static inline float
+DETECT_Value( const DETECT_Tensor* tensor, size_t i ) {
+	switch( tensor->type ) {
+		case DETECT_UINT8:	return tensor->scale * (float)((int)((const uint8_t*)tensor->data)[i] - tensor->zeroPoint);
+		case DETECT_INT8:	return tensor->scale * (float)((int)((const int8_t*)tensor->data)[i] - tensor->zeroPoint);
+		default:			return ((const float*)tensor->data)[i];
+	}
+}
+
+static inline float
+DETECT_Clamp( float v ) {
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+static inline void
+DETECT_Add( DETECT_Context* context, float x1, float y1, float x2, float y2, float score, uint32_t classId ) {
+	size_t n = context->count;
+	if( n >= context->capacity )
+		return;
+	context->x1[n] = DETECT_Clamp( x1 );
+	context->y1[n] = DETECT_Clamp( y1 );
+	context->x2[n] = DETECT_Clamp( x2 );
+	context->y2[n] = DETECT_Clamp( y2 );
+	context->score[n] = score;
+	context->classId[n] = classId;
+	context->count = n + 1;
+}
+
+static float
+DETECT_MinThreshold( float threshold, const float* classThreshold, size_t numClasses ) {
+	if( !classThreshold )
+		return threshold;
+	float min = 1.0f;
+	for( size_t c = 0; c < numClasses; c++ )
+		if( classThreshold[c] < min )
+			min = classThreshold[c];
+	return min;
+}
+
+size_t
+DETECT_DecodeSSD( DETECT_Context* context, const float* boxes, const float* classes, const float* scores, const float* count, size_t maxBoxes, float threshold, const float* classThreshold, size_t numClasses ) {
+	if( !context || !boxes || !classes || !scores )
+		return 0;
+	context->count = 0;
+
+	size_t n = maxBoxes;
+	if( count && *count >= 0 && (size_t)*count < n )
+		n = (size_t)*count;
+
+	for( size_t i = 0; i < n; i++ ) {
+		uint32_t c = classes[i] > 0 ? (uint32_t)classes[i] : 0;
+		float limit = (classThreshold && c < numClasses) ? classThreshold[c] : threshold;
+		if( scores[i] < limit )
+			continue;
+		const float* box = boxes + 4 * i;
+		DETECT_Add( context, box[1], box[0], box[3], box[2], scores[i], c );
+	}
+	return context->count;
+}
+
+size_t
+DETECT_DecodeAnchors( DETECT_Context* context, const DETECT_Tensor* boxes, const DETECT_Tensor* scores, const float* anchors, size_t numAnchors, size_t numClasses, float threshold, const float* classThreshold ) {
+	if( !context || !boxes || !scores || !anchors || numClasses < 2 )
+		return 0;
+	context->count = 0;
+
+	float min = DETECT_MinThreshold( threshold, classThreshold, numClasses );
+	for( size_t i = 0; i < numAnchors; i++ ) {
+		//Best non-background class
+		size_t row = i * numClasses;
+		uint32_t best = 1;
+		float bestScore = DETECT_Value( scores, row + 1 );
+		for( size_t c = 2; c < numClasses; c++ ) {
+			float s = DETECT_Value( scores, row + c );
+			if( s > bestScore ) {
+				bestScore = s;
+				best = (uint32_t)c;
+			}
+		}
+		if( bestScore < min )
+			continue;
+		if( bestScore < (classThreshold ? classThreshold[best] : threshold) )
+			continue;
+
+		const float* anchor = anchors + 4 * i;
+		float cy = DETECT_Value( boxes, 4 * i + 0 ) / DETECT_SCALE_XY * anchor[2] + anchor[0];
+		float cx = DETECT_Value( boxes, 4 * i + 1 ) / DETECT_SCALE_XY * anchor[3] + anchor[1];
+		float h = expf( DETECT_Value( boxes, 4 * i + 2 ) / DETECT_SCALE_WH ) * anchor[2];
+		float w = expf( DETECT_Value( boxes, 4 * i + 3 ) / DETECT_SCALE_WH ) * anchor[3];
+		DETECT_Add( context, cx - w / 2, cy - h / 2, cx + w / 2, cy + h / 2, bestScore, best );
+	}
+	return context->count;
+}
+
+size_t
+DETECT_DecodeYOLO( DETECT_Context* context, const DETECT_Tensor* output, size_t numBoxes, size_t numClasses, float threshold, const float* classThreshold ) {
+	if( !context || !output || numClasses == 0 )
+		return 0;
+	context->count = 0;
+
+	size_t stride = 5 + numClasses;
+	float min = DETECT_MinThreshold( threshold, classThreshold, numClasses );
+	for( size_t i = 0; i < numBoxes; i++ ) {
+		size_t row = i * stride;
+		//Class scores are at most 1 so low objectness rejects the box early
+		float objectness = DETECT_Value( output, row + 4 );
+		if( objectness < min )
+			continue;
+		uint32_t best = 0;
+		float bestScore = DETECT_Value( output, row + 5 );
+		for( size_t c = 1; c < numClasses; c++ ) {
+			float s = DETECT_Value( output, row + 5 + c );
+			if( s > bestScore ) {
+				bestScore = s;
+				best = (uint32_t)c;
+			}
+		}
+		float score = objectness * bestScore;
+		if( score < (classThreshold ? classThreshold[best] : threshold) )
+			continue;
+		float cx = DETECT_Value( output, row + 0 );
+		float cy = DETECT_Value( output, row + 1 );
+		float w = DETECT_Value( output, row + 2 );
+		float h = DETECT_Value( output, row + 3 );
+		DETECT_Add( context, cx - w / 2, cy - h / 2, cx + w / 2, cy + h / 2, score, best );
+	}
+	return context->count;
+}
+
+static int
+DETECT_CompareKeys( const void* a, const void* b ) {
+	uint64_t ka = *(const uint64_t*)a;
+	uint64_t kb = *(const uint64_t*)b;
+	return ka < kb ? 1 : (ka > kb ? -1 : 0);  //Descending
+}
+
+static void
+DETECT_Sort( DETECT_Context* context ) {
+	size_t n = context->count;
+	//Scores are >= 0 so the IEEE bit pattern sorts like the value. Lower index wins ties
+	for( size_t i = 0; i < n; i++ ) {
+		uint32_t bits;
+		memcpy( &bits, &context->score[i], sizeof(bits) );
+		context->keys[i] = ((uint64_t)bits << 32) | (uint32_t)(UINT32_MAX - i);
+	}
+	qsort( context->keys, n, sizeof(uint64_t), DETECT_CompareKeys );
+
+	float* from[5] = { context->x1, context->y1, context->x2, context->y2, context->score };
+	for( size_t i = 0; i < n; i++ ) {
+		size_t src = UINT32_MAX - (uint32_t)context->keys[i];
+		for( int a = 0; a < 5; a++ )
+			context->spare[a][i] = from[a][src];
+		context->spareClassId[i] = context->classId[src];
+	}
+	context->x1 = context->spare[0];
+	context->y1 = context->spare[1];
+	context->x2 = context->spare[2];
+	context->y2 = context->spare[3];
+	context->score = context->spare[4];
+	for( int a = 0; a < 5; a++ )
+		context->spare[a] = from[a];
+	uint32_t* classId = context->classId;
+	context->classId = context->spareClassId;
+	context->spareClassId = classId;
+}
+
+static void
+DETECT_Suppress( DETECT_Context* context, size_t i, float iou, int classAgnostic ) {
+	const float* x1 = context->x1;
+	const float* y1 = context->y1;
+	const float* x2 = context->x2;
+	const float* y2 = context->y2;
+	const float* area = context->area;
+	const uint32_t* classId = context->classId;
+	uint32_t* suppressed = context->suppressed;
+	size_t n = context->count;
+	size_t j = i + 1;
+
+	//IoU > t  <=>  inter * (1 + t) > t * (areaA + areaB). No division needed
+#ifdef DETECT_NEON
+	float32x4_t bx1 = vdupq_n_f32( x1[i] );
+	float32x4_t by1 = vdupq_n_f32( y1[i] );
+	float32x4_t bx2 = vdupq_n_f32( x2[i] );
+	float32x4_t by2 = vdupq_n_f32( y2[i] );
+	float32x4_t barea = vdupq_n_f32( area[i] );
+	float32x4_t t = vdupq_n_f32( iou );
+	float32x4_t onePlusT = vdupq_n_f32( 1.0f + iou );
+	float32x4_t zero = vdupq_n_f32( 0.0f );
+	uint32x4_t bclass = vdupq_n_u32( classId[i] );
+	for( ; j + 4 <= n; j += 4 ) {
+		float32x4_t w = vmaxq_f32( vsubq_f32( vminq_f32( bx2, vld1q_f32( x2 + j ) ), vmaxq_f32( bx1, vld1q_f32( x1 + j ) ) ), zero );
+		float32x4_t h = vmaxq_f32( vsubq_f32( vminq_f32( by2, vld1q_f32( y2 + j ) ), vmaxq_f32( by1, vld1q_f32( y1 + j ) ) ), zero );
+		float32x4_t inter = vmulq_f32( w, h );
+		uint32x4_t overlap = vcgtq_f32( vmulq_f32( inter, onePlusT ), vmulq_f32( vaddq_f32( barea, vld1q_f32( area + j ) ), t ) );
+		if( !classAgnostic )
+			overlap = vandq_u32( overlap, vceqq_u32( bclass, vld1q_u32( classId + j ) ) );
+		vst1q_u32( suppressed + j, vorrq_u32( vld1q_u32( suppressed + j ), overlap ) );
+	}
+#endif
+	for( ; j < n; j++ ) {
+		float w = fminf( x2[i], x2[j] ) - fmaxf( x1[i], x1[j] );
+		float h = fminf( y2[i], y2[j] ) - fmaxf( y1[i], y1[j] );
+		float inter = (w > 0 ? w : 0) * (h > 0 ? h : 0);
+		if( inter * (1.0f + iou) > iou * (area[i] + area[j]) && (classAgnostic || classId[i] == classId[j]) )
+			suppressed[j] = UINT32_MAX;
+	}
+}
+
+size_t
+DETECT_NMS( DETECT_Context* context, float iou, size_t maxDetections, int classAgnostic ) {
+	if( !context || context->count == 0 )
+		return 0;
+
+	DETECT_Sort( context );
+
+	size_t n = context->count;
+	for( size_t i = 0; i < n; i++ ) {
+		context->area[i] = (context->x2[i] - context->x1[i]) * (context->y2[i] - context->y1[i]);
+		context->suppressed[i] = 0;
+	}
+
+	size_t kept = 0;
+	for( size_t i = 0; i < n && kept < maxDetections; i++ ) {
+		if( context->suppressed[i] )
+			continue;
+		DETECT_Suppress( context, i, iou, classAgnostic );
+		//Compact kept boxes to the front. Index kept <= i so nothing ahead is overwritten
+		context->x1[kept] = context->x1[i];
+		context->y1[kept] = context->y1[i];
+		context->x2[kept] = context->x2[i];
+		context->y2[kept] = context->y2[i];
+		context->score[kept] = context->score[i];
+		context->classId[kept] = context->classId[i];
+		context->area[kept] = context->area[i];
+		kept++;
+	}
+	context->count = kept;
+	return kept;
+}
+
+size_t
+DETECT_Append( DETECT_Context* context, const DETECT_Context* src ) {
+	if( !context || !src )
+		return 0;
+	size_t n = src->count;
+	if( n > context->capacity - context->count )
+		n = context->capacity - context->count;
+	size_t at = context->count;
+	memcpy( context->x1 + at, src->x1, n * sizeof(float) );
+	memcpy( context->y1 + at, src->y1, n * sizeof(float) );
+	memcpy( context->x2 + at, src->x2, n * sizeof(float) );
+	memcpy( context->y2 + at, src->y2, n * sizeof(float) );
+	memcpy( context->score + at, src->score, n * sizeof(float) );
+	memcpy( context->classId + at, src->classId, n * sizeof(uint32_t) );
+	context->count += n;
+	return n;
+}
+
+void
+DETECT_Map( DETECT_Context* context, float cropX, float cropY, float cropW, float cropH ) {
+	if( !context )
+		return;
+	for( size_t i = 0; i < context->count; i++ ) {
+		context->x1[i] = cropX + context->x1[i] * cropW;
+		context->x2[i] = cropX + context->x2[i] * cropW;
+		context->y1[i] = cropY + context->y1[i] * cropH;
+		context->y2[i] = cropY + context->y2[i] * cropH;
+	}
+}
@@ -0,0 +1,76 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  DETECT decodes object detection outputs (TFLite SSD postprocess,
+ *  raw SSD anchors or YOLO) and runs non-maximum suppression.
+ *  All buffers are allocated once in DETECT_Create.
+ *------------------------------------------------------------------*/
+
+#ifndef _DETECT_H_
+#define _DETECT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define DETECT_FLOAT32	0
+#define DETECT_UINT8	1
+#define DETECT_INT8		2
+
+typedef struct DETECT_Tensor {
+	const void*	data;
+	int			type;		//DETECT_FLOAT32, DETECT_UINT8 or DETECT_INT8
+	float		scale;		//Quantization: real = scale * (q - zeroPoint)
+	int			zeroPoint;
+} DETECT_Tensor;
+
+typedef struct DETECT_Context {
+	size_t		capacity;	//Max number of candidates
+	size_t		count;		//Number of candidates (after decode) or detections (after NMS)
+	//Structure of arrays. Box corners are normalized 0-1 until DETECT_Map is called
+	float*		x1;
+	float*		y1;
+	float*		x2;
+	float*		y2;
+	float*		score;
+	uint32_t*	classId;
+	//Work buffers used by DETECT_NMS
+	float*		area;
+	uint32_t*	suppressed;
+	uint64_t*	keys;
+	float*		spare[5];
+	uint32_t*	spareClassId;
+} DETECT_Context;
+
+DETECT_Context*	DETECT_Create( size_t capacity );
+void			DETECT_Free( DETECT_Context* context );
+
+/*
+ * Decoders. The threshold is the minimum score 0-1. If classThreshold is set it
+ * holds one threshold per class id and overrides threshold.
+ * Returns the number of candidates.
+ */
+//TFLite_Detection_PostProcess: boxes [N][4] ymin,xmin,ymax,xmax, classes [N], scores [N], count [1]
+size_t	DETECT_DecodeSSD( DETECT_Context* context, const float* boxes, const float* classes, const float* scores, const float* count, size_t maxBoxes, float threshold, const float* classThreshold, size_t numClasses );
+//Raw SSD: boxes [N][4] ty,tx,th,tw, scores [N][numClasses] (class 0 = background), anchors [N][4] cy,cx,h,w
+size_t	DETECT_DecodeAnchors( DETECT_Context* context, const DETECT_Tensor* boxes, const DETECT_Tensor* scores, const float* anchors, size_t numAnchors, size_t numClasses, float threshold, const float* classThreshold );
+//YOLO (v5 style): output [N][5 + numClasses] cx,cy,w,h,objectness,class scores
+size_t	DETECT_DecodeYOLO( DETECT_Context* context, const DETECT_Tensor* output, size_t numBoxes, size_t numClasses, float threshold, const float* classThreshold );
+
+//Sorts by score and suppresses boxes of the same class (any class if classAgnostic) overlapping more than iou
+size_t	DETECT_NMS( DETECT_Context* context, float iou, size_t maxDetections, int classAgnostic );
+
+//Appends the candidates of src to context, up to its capacity. Returns the number appended
+size_t	DETECT_Append( DETECT_Context* context, const DETECT_Context* src );
+
+//Maps normalized boxes into the crop (in stream pixels) that was scaled to the model input
+void	DETECT_Map( DETECT_Context* context, float cropX, float cropY, float cropW, float cropH );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -23,7 +23,7 @@ int    		FILE_Delete( const char *filepath );
 cJSON* 		FILE_Read( const char *filepath );
 int    		FILE_Write( const char *filepath,  cJSON* object );
 int			FILE_WriteData( const char *filepath, const char *data );
-int    		FILE_exists( const char *filepath );
+int    		FILE_Exists( const char *filepath );
 
 #ifdef  __cplusplus
 }
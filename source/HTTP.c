@@ -169,6 +169,19 @@ HTTP_Respond_Text( HTTP_Response response, const char *message ) {
   return 1;
 }
 
+int
+HTTP_Respond_Defer( HTTP_Response response ) {
+  g_object_ref( response );
+  return 1;
+}
+
+int
+HTTP_Respond_Done( HTTP_Response response ) {
+  g_output_stream_close( (GOutputStream *)response, NULL, NULL );
+  g_object_unref( response );
+  return 1;
+}
+
 int
 HTTP_Respond_JSON( HTTP_Response response, cJSON *object) {
   char *jsonstring;
@@ -37,6 +37,10 @@ int         HTTP_Respond_JSON(  HTTP_Response response, cJSON *object);
 int         HTTP_Respond_Data( HTTP_Response response, size_t count, void *data );
 int         HTTP_Respond_Error( HTTP_Response response, int code, const char *message );
 int         HTTP_Respond_Text( HTTP_Response response, const char *message );
+int         HTTP_Respond_Defer( HTTP_Response response );
+			//Keeps the response open after the callback returns. Respond later on the main loop
+int         HTTP_Respond_Done( HTTP_Response response );
+			//Completes a deferred response
 
 #ifdef  __cplusplus
 }
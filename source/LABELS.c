@@ -0,0 +1,281 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "LABELS.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+#define LABELS_EMPTY_SLOT	UINT32_MAX
+
+//Open addressed hash set of string offsets, used only while building to intern duplicates
+typedef struct LABELS_Set {
+	uint32_t*	slots;
+	size_t		mask;
+} LABELS_Set;
+
+static uint32_t
+LABELS_Hash( const char* string, size_t length ) {
+	uint32_t hash = 2166136261u;  //FNV-1a
+	size_t i;
+	for( i = 0; i < length; i++ ) {
+		hash ^= (uint8_t)string[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool
+LABELS_Set_Create( LABELS_Set* set, size_t count ) {
+	size_t slots = 16;
+	while( slots < count * 2 )
+		slots <<= 1;
+	set->slots = malloc( slots * sizeof(uint32_t) );
+	set->mask = slots - 1;
+	if( !set->slots )
+		return false;
+	memset( set->slots, 0xff, slots * sizeof(uint32_t) );
+	return true;
+}
+
+//Offset of an equal label already in the table, or offset after adding it to the set
+static uint32_t
+LABELS_Intern( LABELS_Set* set, const LABELS_Table* table, uint32_t offset, size_t length ) {
+	const char* label = table->strings + offset;
+	size_t slot = LABELS_Hash( label, length ) & set->mask;
+	while( set->slots[slot] != LABELS_EMPTY_SLOT ) {
+		uint32_t other = set->slots[slot];
+		if( memcmp( table->strings + other, label, length ) == 0 && table->strings[other + length] == 0 )
+			return other;
+		slot = (slot + 1) & set->mask;
+	}
+	set->slots[slot] = offset;
+	return offset;
+}
+
+static LABELS_Table*
+LABELS_Create( size_t count ) {
+	LABELS_Table* table = calloc( 1, sizeof(LABELS_Table) );
+	if( !table )
+		return 0;
+	table->offsets = malloc( (count + 1) * sizeof(uint32_t) );
+	table->lengths = malloc( (count + 1) * sizeof(uint32_t) );
+	if( !table->offsets || !table->lengths ) {
+		LABELS_Free( table );
+		return 0;
+	}
+	return table;
+}
+
+LABELS_Table*
+LABELS_FromJSON( cJSON* list ) {
+	LOG_TRACE("%s:\n",__func__);
+
+	if( !list || list->type != cJSON_Array ) {
+		LOG_WARN("%s: Invalid label list\n",__func__);
+		return 0;
+	}
+
+	size_t count = 0;
+	size_t bytes = 0;
+	cJSON* item = list->child;
+	while( item ) {
+		if( item->type == cJSON_String && item->valuestring )
+			bytes += strlen(item->valuestring) + 1;
+		else
+			bytes += 1;
+		count++;
+		item = item->next;
+	}
+
+	LABELS_Table* table = LABELS_Create( count );
+	LABELS_Set set = { 0, 0 };
+	if( table )
+		table->strings = malloc( bytes + 1 );
+	if( !table || !table->strings || !LABELS_Set_Create( &set, count ) ) {
+		LOG_WARN("%s: Memory allocation error\n",__func__);
+		free( set.slots );
+		LABELS_Free( table );
+		return 0;
+	}
+
+	size_t id = 0;
+	item = list->child;
+	while( item ) {
+		const char* label = (item->type == cJSON_String && item->valuestring) ? item->valuestring : "";
+		size_t length = strlen( label );
+		uint32_t offset = (uint32_t)table->size;
+		memcpy( table->strings + offset, label, length + 1 );
+		table->lengths[id] = length;
+		table->offsets[id] = LABELS_Intern( &set, table, offset, length );
+		if( table->offsets[id] == offset )
+			table->size += length + 1;
+		id++;
+		item = item->next;
+	}
+	free( set.slots );
+
+	table->count = count;
+	LOG_TRACE("%s: %u labels, %u bytes\n",__func__,(unsigned)count,(unsigned)table->size);
+	return table;
+}
+
+/*
+ * Indexes text, size bytes with a writable NUL after them, in place. Line ends are
+ * replaced by NUL and empty lines skipped, as the label files have always been read
+ */
+static LABELS_Table*
+LABELS_Index( char* text, size_t size ) {
+	size_t lines = 1;
+	const char* line = text;
+	while( (line = memchr( line, '\n', size - (line - text) )) ) {
+		line++;
+		lines++;
+	}
+
+	LABELS_Table* table = LABELS_Create( lines );
+	LABELS_Set set = { 0, 0 };
+	if( !table || !LABELS_Set_Create( &set, lines ) ) {
+		LOG_WARN("%s: Memory allocation error\n",__func__);
+		free( set.slots );
+		LABELS_Free( table );
+		return 0;
+	}
+	table->strings = text;
+	table->size = size;
+
+	size_t position = 0;
+	while( position < size ) {
+		const char* end = memchr( text + position, '\n', size - position );
+		size_t next = end ? (size_t)(end - text) : size;
+		size_t length = next - position;
+		if( length && text[position + length - 1] == '\r' )
+			length--;
+		text[position + length] = 0;
+		if( length ) {
+			table->lengths[table->count] = length;
+			table->offsets[table->count] = LABELS_Intern( &set, table, position, length );
+			table->count++;
+		}
+		position = next + 1;
+	}
+	free( set.slots );
+	return table;
+}
+
+LABELS_Table*
+LABELS_FromText( const char* text, size_t length ) {
+	if( !text || length >= UINT32_MAX )
+		return 0;
+	char* copy = malloc( length + 1 );
+	if( !copy ) {
+		LOG_WARN("%s: Memory allocation error\n",__func__);
+		return 0;
+	}
+	memcpy( copy, text, length );
+	copy[length] = 0;
+	LABELS_Table* table = LABELS_Index( copy, length );
+	if( !table )
+		free( copy );
+	return table;
+}
+
+LABELS_Table*
+LABELS_FromFile( const char* path ) {
+	LOG_TRACE("%s: %s\n",__func__,path);
+
+	int fd = open( path, O_RDONLY );
+	if( fd < 0 ) {
+		LOG_WARN( "%s: Could not open labels file %s: %s\n", __func__, path, strerror(errno));
+		return 0;
+	}
+	struct stat st;
+	if( fstat( fd, &st ) < 0 || st.st_size == 0 || (uint64_t)st.st_size >= UINT32_MAX ) {
+		LOG_WARN( "%s: Invalid labels file %s\n", __func__, path);
+		close( fd );
+		return 0;
+	}
+	size_t size = st.st_size;
+	//The label after the last line end is terminated in the zero filled tail of the last page.
+	//A file ending exactly on a page without a line end has none, and is copied instead
+	long page = sysconf( _SC_PAGESIZE );
+	char* text = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( text == MAP_FAILED ) {
+		LOG_WARN( "%s: Could not map labels file %s: %s\n", __func__, path, strerror(errno));
+		return 0;
+	}
+	if( text[size - 1] != '\n' && size % page == 0 ) {
+		LABELS_Table* table = LABELS_FromText( text, size );
+		munmap( text, size );
+		return table;
+	}
+	LABELS_Table* table = LABELS_Index( text, size );
+	if( !table ) {
+		munmap( text, size );
+		return 0;
+	}
+	table->mapSize = size;
+	mprotect( text, size, PROT_READ );
+	LOG_TRACE("%s: %u labels, %u bytes\n",__func__,(unsigned)table->count,(unsigned)size);
+	return table;
+}
+
+const char*
+LABELS_Get( const LABELS_Table* table, size_t id ) {
+	if( !table || id >= table->count )
+		return "Undefined";
+	return table->strings + table->offsets[id];
+}
+
+size_t
+LABELS_Length( const LABELS_Table* table, size_t id ) {
+	if( !table || id >= table->count )
+		return 9;
+	return table->lengths[id];
+}
+
+size_t
+LABELS_Count( const LABELS_Table* table ) {
+	return table ? table->count : 0;
+}
+
+uint32_t
+LABELS_Digest( const LABELS_Table* table ) {
+	uint32_t hash = 2166136261u;
+	size_t id, i;
+	for( id = 0; table && id < table->count; id++ ) {
+		const char* label = table->strings + table->offsets[id];
+		for( i = 0; i <= table->lengths[id]; i++ ) {
+			hash ^= (uint8_t)label[i];
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+void
+LABELS_Free( LABELS_Table* table ) {
+	if( !table )
+		return;
+	if( table->mapSize )
+		munmap( table->strings, table->mapSize );
+	else
+		free( table->strings );
+	free( table->offsets );
+	free( table->lengths );
+	free( table );
+}
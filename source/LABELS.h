@@ -0,0 +1,45 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  LABELS keeps the model labels in one contiguous, interned
+ *  string table with O(1) lookup by class id. A label file is
+ *  mapped and indexed in place, so the cost scales with the file
+ *  size and not with the number of labels
+ *------------------------------------------------------------------*/
+
+#ifndef _LABELS_H_
+#define _LABELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef struct LABELS_Table {
+	char*		strings;	//NUL terminated label strings. Equal labels share one offset
+	size_t		size;		//Bytes used in strings
+	uint32_t*	offsets;	//Offset into strings, indexed by class id
+	uint32_t*	lengths;	//Label length, indexed by class id
+	size_t		count;		//Number of class ids
+	size_t		mapSize;	//strings is a read-only private mapping of the label file if set
+} LABELS_Table;
+
+LABELS_Table*	LABELS_FromJSON( cJSON* list );  //Builds a table from a cJSON string array
+//Maps a label file, one label per line, and indexes it in place. Empty lines are skipped
+LABELS_Table*	LABELS_FromFile( const char* path );
+//As LABELS_FromFile for label text in memory, e.g. embedded in the model. The text is copied
+LABELS_Table*	LABELS_FromText( const char* text, size_t length );
+const char*		LABELS_Get( const LABELS_Table* table, size_t id );  //Returns "Undefined" if id is out of range
+size_t			LABELS_Length( const LABELS_Table* table, size_t id );
+size_t			LABELS_Count( const LABELS_Table* table );
+uint32_t		LABELS_Digest( const LABELS_Table* table );  //Hash of the labels in class id order
+void			LABELS_Free( LABELS_Table* table );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
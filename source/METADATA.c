@@ -0,0 +1,373 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  A flatbuffer table starts with the signed offset back to its
+ *  vtable. The vtable holds the offset of each field in the table, 0
+ *  for fields left at their default. Tables, vectors and strings are
+ *  referenced by unsigned offsets from where the reference is stored.
+ *  Every read is bounds checked against the file size.
+ *
+ *  Files written with the TFLite metadata tools carry a ModelMetadata
+ *  flatbuffer in the buffer named "TFLITE_METADATA" and its associated
+ *  files in a zip archive appended to the model. Stored (uncompressed)
+ *  entries are used in place.
+ *------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "METADATA.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+//Field numbers in schema.fbs and metadata_schema.fbs
+#define MODEL_SUBGRAPHS			2
+#define MODEL_BUFFERS			4
+#define MODEL_METADATA			6
+#define SUBGRAPH_TENSORS		0
+#define SUBGRAPH_INPUTS			1
+#define SUBGRAPH_OUTPUTS		2
+#define TENSOR_SHAPE			0
+#define TENSOR_TYPE				1
+#define TENSOR_NAME				3
+#define TENSOR_QUANTIZATION		4
+#define QUANTIZATION_SCALE		2
+#define QUANTIZATION_ZERO_POINT	3
+#define BUFFER_DATA				0
+#define BUFFER_OFFSET			1
+#define BUFFER_SIZE				2
+#define METADATA_NAME			0
+#define METADATA_BUFFER			1
+#define MODELMETA_SUBGRAPHS		3
+#define SUBGRAPHMETA_OUTPUTS	3
+#define TENSORMETA_FILES		6
+#define FILE_NAME				0
+#define FILE_TYPE				2
+#define FILE_AXIS_LABELS		2
+#define FILE_VALUE_LABELS		3
+
+//A flatbuffer inside the file. Nested buffers are read with their own base
+typedef struct METADATA_Buffer {
+	const uint8_t*	data;
+	size_t			size;
+} METADATA_Buffer;
+
+static uint32_t
+METADATA_U32( const uint8_t* p ) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t
+METADATA_U16( const uint8_t* p ) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint64_t
+METADATA_U64( const uint8_t* p ) {
+	return METADATA_U32( p ) | ((uint64_t)METADATA_U32( p + 4 ) << 32);
+}
+
+static bool
+METADATA_Inside( const METADATA_Buffer* buffer, size_t position, size_t length ) {
+	return position <= buffer->size && length <= buffer->size - position;
+}
+
+//Position of field in the table at table. 0 if not set
+static size_t
+METADATA_Field( const METADATA_Buffer* buffer, size_t table, unsigned int field ) {
+	if( !table || !METADATA_Inside( buffer, table, 4 ) )
+		return 0;
+	int32_t back = (int32_t)METADATA_U32( buffer->data + table );
+	size_t vtable = table - back;
+	if( !METADATA_Inside( buffer, vtable, 4 ) )
+		return 0;
+	uint16_t vtableSize = METADATA_U16( buffer->data + vtable );
+	size_t entry = 4 + 2 * field;
+	if( entry + 2 > vtableSize || !METADATA_Inside( buffer, vtable, vtableSize ) )
+		return 0;
+	uint16_t offset = METADATA_U16( buffer->data + vtable + entry );
+	return offset ? table + offset : 0;
+}
+
+//Follows the reference stored at position. The root reference is at 0
+static size_t
+METADATA_Follow( const METADATA_Buffer* buffer, size_t position ) {
+	if( !METADATA_Inside( buffer, position, 4 ) )
+		return 0;
+	size_t target = position + METADATA_U32( buffer->data + position );
+	return METADATA_Inside( buffer, target, 4 ) ? target : 0;
+}
+
+static size_t
+METADATA_Table( const METADATA_Buffer* buffer, size_t table, unsigned int field ) {
+	size_t position = METADATA_Field( buffer, table, field );
+	return position ? METADATA_Follow( buffer, position ) : 0;
+}
+
+//Vector field. Returns the position of the first element and sets count
+static size_t
+METADATA_Vector( const METADATA_Buffer* buffer, size_t table, unsigned int field, size_t elementSize, size_t* count ) {
+	*count = 0;
+	size_t vector = METADATA_Table( buffer, table, field );
+	if( !vector )
+		return 0;
+	size_t length = METADATA_U32( buffer->data + vector );
+	if( elementSize && length > (buffer->size - vector - 4) / elementSize )
+		return 0;
+	*count = length;
+	return vector + 4;
+}
+
+//Table element i of a vector of tables
+static size_t
+METADATA_Element( const METADATA_Buffer* buffer, size_t vector, size_t i ) {
+	return METADATA_Follow( buffer, vector + i * 4 );
+}
+
+static const char*
+METADATA_String( const METADATA_Buffer* buffer, size_t table, unsigned int field, size_t* length ) {
+	size_t count = 0;
+	size_t string = METADATA_Vector( buffer, table, field, 1, &count );
+	*length = count;
+	return string ? (const char*)buffer->data + string : 0;
+}
+
+static bool
+METADATA_Tensor_Read( const METADATA_Buffer* buffer, size_t tensors, size_t numTensors, int32_t index, METADATA_Tensor* tensor ) {
+	if( index < 0 || (size_t)index >= numTensors )
+		return false;
+	size_t table = METADATA_Element( buffer, tensors, index );
+	if( !table )
+		return false;
+	memset( tensor, 0, sizeof(METADATA_Tensor) );
+	size_t count = 0, i;
+	size_t shape = METADATA_Vector( buffer, table, TENSOR_SHAPE, 4, &count );
+	for( i = 0; i < count && i < METADATA_MAX_DIMS; i++ )
+		tensor->dims[i] = (int32_t)METADATA_U32( buffer->data + shape + i * 4 );
+	tensor->len = i;
+	size_t type = METADATA_Field( buffer, table, TENSOR_TYPE );
+	tensor->type = type && METADATA_Inside( buffer, type, 1 ) ? buffer->data[type] : METADATA_FLOAT32;
+	tensor->name = METADATA_String( buffer, table, TENSOR_NAME, &tensor->nameLength );
+
+	size_t quantization = METADATA_Table( buffer, table, TENSOR_QUANTIZATION );
+	size_t scale = METADATA_Vector( buffer, quantization, QUANTIZATION_SCALE, 4, &count );
+	if( scale && count > 0 ) {
+		uint32_t bits = METADATA_U32( buffer->data + scale );
+		memcpy( &tensor->scale, &bits, sizeof(float) );
+		tensor->quantized = true;
+	}
+	size_t zeroPoint = METADATA_Vector( buffer, quantization, QUANTIZATION_ZERO_POINT, 8, &count );
+	if( zeroPoint && count > 0 )
+		tensor->zeroPoint = (int64_t)METADATA_U64( buffer->data + zeroPoint );
+	return true;
+}
+
+static size_t
+METADATA_Tensors( const METADATA_Buffer* buffer, size_t subgraph, unsigned int field, size_t tensors, size_t numTensors, METADATA_Tensor* list ) {
+	size_t count = 0, i, found = 0;
+	size_t indices = METADATA_Vector( buffer, subgraph, field, 4, &count );
+	for( i = 0; i < count && found < METADATA_MAX_TENSORS; i++ )
+		if( METADATA_Tensor_Read( buffer, tensors, numTensors, (int32_t)METADATA_U32( buffer->data + indices + i * 4 ), &list[found] ) )
+			found++;
+	return found;
+}
+
+//Content of the model buffer index. Large models keep it outside the flatbuffer at offset
+static bool
+METADATA_Data( const METADATA_Buffer* buffer, size_t model, uint32_t index, METADATA_Buffer* content ) {
+	size_t count = 0;
+	size_t buffers = METADATA_Vector( buffer, model, MODEL_BUFFERS, 4, &count );
+	if( index >= count )
+		return false;
+	size_t table = METADATA_Element( buffer, buffers, index );
+	size_t length = 0;
+	size_t data = METADATA_Vector( buffer, table, BUFFER_DATA, 1, &length );
+	if( data && length ) {
+		content->data = buffer->data + data;
+		content->size = length;
+		return true;
+	}
+	size_t offset = METADATA_Field( buffer, table, BUFFER_OFFSET );
+	size_t size = METADATA_Field( buffer, table, BUFFER_SIZE );
+	if( !offset || !size || !METADATA_Inside( buffer, offset, 8 ) || !METADATA_Inside( buffer, size, 8 ) )
+		return false;
+	uint64_t start = METADATA_U64( buffer->data + offset );
+	uint64_t bytes = METADATA_U64( buffer->data + size );
+	if( !METADATA_Inside( buffer, start, bytes ) )
+		return false;
+	content->data = buffer->data + start;
+	content->size = bytes;
+	return true;
+}
+
+//Name of the label file associated with the first output in the TFLite metadata
+static const char*
+METADATA_LabelFile( const METADATA_Buffer* buffer, size_t model, size_t* nameLength ) {
+	size_t count = 0, i;
+	size_t list = METADATA_Vector( buffer, model, MODEL_METADATA, 4, &count );
+	for( i = 0; i < count; i++ ) {
+		size_t entry = METADATA_Element( buffer, list, i );
+		size_t length = 0;
+		const char* name = METADATA_String( buffer, entry, METADATA_NAME, &length );
+		size_t index = METADATA_Field( buffer, entry, METADATA_BUFFER );
+		if( !name || length != 15 || strncmp( name, "TFLITE_METADATA", 15 ) != 0 || !index || !METADATA_Inside( buffer, index, 4 ) )
+			continue;
+		METADATA_Buffer meta;
+		if( !METADATA_Data( buffer, model, METADATA_U32( buffer->data + index ), &meta ) || meta.size < 8 )
+			return 0;
+		size_t root = METADATA_Follow( &meta, 0 );
+		size_t subgraphs = METADATA_Vector( &meta, root, MODELMETA_SUBGRAPHS, 4, &length );
+		size_t subgraph = length ? METADATA_Element( &meta, subgraphs, 0 ) : 0;
+		size_t outputs = METADATA_Vector( &meta, subgraph, SUBGRAPHMETA_OUTPUTS, 4, &length );
+		size_t output = length ? METADATA_Element( &meta, outputs, 0 ) : 0;
+		size_t files = METADATA_Vector( &meta, output, TENSORMETA_FILES, 4, &length );
+		size_t f;
+		for( f = 0; f < length; f++ ) {
+			size_t file = METADATA_Element( &meta, files, f );
+			size_t type = METADATA_Field( &meta, file, FILE_TYPE );
+			int value = type && METADATA_Inside( &meta, type, 1 ) ? meta.data[type] : 0;
+			if( value == FILE_AXIS_LABELS || value == FILE_VALUE_LABELS )
+				return METADATA_String( &meta, file, FILE_NAME, nameLength );
+		}
+		return 0;
+	}
+	return 0;
+}
+
+/*
+ * Finds a stored entry in the zip archive at the end of the file. With name 0 the first
+ * entry with "label" in its name is used. Offsets are corrected for the model in front
+ */
+static bool
+METADATA_Zip( METADATA_File* file, const char* name, size_t nameLength ) {
+	const uint8_t* data = file->data;
+	size_t size = file->size;
+	if( size < 22 )
+		return false;
+	size_t end = size - 22;
+	size_t stop = size > 22 + 65535 ? size - 22 - 65535 : 0;
+	while( METADATA_U32( data + end ) != 0x06054b50 ) {
+		if( end == stop )
+			return false;
+		end--;
+	}
+	size_t entries = METADATA_U16( data + end + 10 );
+	size_t directorySize = METADATA_U32( data + end + 12 );
+	size_t directoryOffset = METADATA_U32( data + end + 16 );
+	if( directorySize + directoryOffset > end )
+		return false;
+	size_t base = end - directorySize - directoryOffset;
+	size_t position = base + directoryOffset;
+	size_t i;
+	for( i = 0; i < entries; i++ ) {
+		if( position + 46 > end || METADATA_U32( data + position ) != 0x02014b50 )
+			return false;
+		unsigned int method = METADATA_U16( data + position + 10 );
+		size_t compressed = METADATA_U32( data + position + 20 );
+		size_t entryNameLength = METADATA_U16( data + position + 28 );
+		size_t extra = METADATA_U16( data + position + 30 );
+		size_t comment = METADATA_U16( data + position + 32 );
+		size_t local = base + METADATA_U32( data + position + 42 );
+		const char* entryName = (const char*)data + position + 46;
+		position += 46 + entryNameLength + extra + comment;
+		if( position > end )
+			return false;
+		bool match = name ? (entryNameLength == nameLength && memcmp( entryName, name, nameLength ) == 0) : (memmem( entryName, entryNameLength, "label", 5 ) != 0);
+		if( !match )
+			continue;
+		if( method != 0 ) {
+			LOG_WARN( "%s: Embedded %.*s is compressed\n", __func__, (int)entryNameLength, entryName );
+			return false;
+		}
+		if( local + 30 > size || METADATA_U32( data + local ) != 0x04034b50 )
+			return false;
+		size_t content = local + 30 + METADATA_U16( data + local + 26 ) + METADATA_U16( data + local + 28 );
+		if( content > size || compressed > size - content )
+			return false;
+		file->labels = (const char*)data + content;
+		file->labelsLength = compressed;
+		return true;
+	}
+	return false;
+}
+
+METADATA_File*
+METADATA_Open( const char* path ) {
+	int fd = open( path, O_RDONLY );
+	if( fd < 0 )
+		return 0;
+	struct stat st;
+	if( fstat( fd, &st ) < 0 || st.st_size < 16 ) {
+		close( fd );
+		return 0;
+	}
+	void* data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( data == MAP_FAILED )
+		return 0;
+	METADATA_File* file = calloc( 1, sizeof(METADATA_File) );
+	if( !file ) {
+		munmap( data, st.st_size );
+		return 0;
+	}
+	file->data = data;
+	file->size = st.st_size;
+
+	METADATA_Buffer buffer = { file->data, file->size };
+	if( memcmp( file->data + 4, "TFL3", 4 ) != 0 ) {
+		LOG_WARN( "%s: %s is not a TFLite model\n", __func__, path );
+		METADATA_Close( file );
+		return 0;
+	}
+	size_t model = METADATA_Follow( &buffer, 0 );
+	size_t count = 0, numTensors = 0;
+	size_t subgraphs = METADATA_Vector( &buffer, model, MODEL_SUBGRAPHS, 4, &count );
+	size_t subgraph = count ? METADATA_Element( &buffer, subgraphs, 0 ) : 0;
+	size_t tensors = METADATA_Vector( &buffer, subgraph, SUBGRAPH_TENSORS, 4, &numTensors );
+	file->numInputs = METADATA_Tensors( &buffer, subgraph, SUBGRAPH_INPUTS, tensors, numTensors, file->inputs );
+	file->numOutputs = METADATA_Tensors( &buffer, subgraph, SUBGRAPH_OUTPUTS, tensors, numTensors, file->outputs );
+	if( file->numInputs == 0 || file->numOutputs == 0 ) {
+		LOG_WARN( "%s: No inputs or outputs in %s\n", __func__, path );
+		METADATA_Close( file );
+		return 0;
+	}
+
+	size_t nameLength = 0;
+	const char* name = METADATA_LabelFile( &buffer, model, &nameLength );
+	METADATA_Zip( file, name, nameLength );
+	LOG_TRACE( "%s: %s %u inputs %u outputs labels %u bytes\n", __func__, path, (unsigned)file->numInputs, (unsigned)file->numOutputs, (unsigned)file->labelsLength );
+	return file;
+}
+
+void
+METADATA_Close( METADATA_File* file ) {
+	if( !file )
+		return;
+	if( file->data )
+		munmap( (void*)file->data, file->size );
+	free( file );
+}
+
+const char*
+METADATA_TypeName( int type ) {
+	switch( type ) {
+		case METADATA_FLOAT32: return "float32";
+		case METADATA_FLOAT16: return "float16";
+		case METADATA_INT32: return "int32";
+		case METADATA_UINT8: return "uint8";
+		case METADATA_INT64: return "int64";
+		case METADATA_INT16: return "int16";
+		case METADATA_INT8: return "int8";
+	}
+	return "other";
+}
@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  METADATA reads a .tflite file in place. Input and output shapes,
+ *  types and quantization come from the flatbuffer, and a labels file
+ *  embedded with the TFLite metadata is found in the appended zip.
+ *  Strings and labels point into the mapped file.
+ *------------------------------------------------------------------*/
+
+#ifndef _METADATA_H_
+#define _METADATA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define METADATA_MAX_TENSORS	4
+#define METADATA_MAX_DIMS		8
+
+//TFLite TensorType
+#define METADATA_FLOAT32	0
+#define METADATA_FLOAT16	1
+#define METADATA_INT32		2
+#define METADATA_UINT8		3
+#define METADATA_INT64		4
+#define METADATA_INT16		7
+#define METADATA_INT8		9
+
+typedef struct METADATA_Tensor {
+	int				type;
+	size_t			dims[METADATA_MAX_DIMS];
+	size_t			len;
+	bool			quantized;
+	float			scale;
+	int64_t			zeroPoint;
+	const char*		name;		//Not NUL terminated
+	size_t			nameLength;
+} METADATA_Tensor;
+
+typedef struct METADATA_File {
+	const uint8_t*	data;		//The mapped file
+	size_t			size;
+	METADATA_Tensor	inputs[METADATA_MAX_TENSORS];
+	size_t			numInputs;
+	METADATA_Tensor	outputs[METADATA_MAX_TENSORS];
+	size_t			numOutputs;
+	const char*		labels;		//Embedded label file, one label per line. 0 if none
+	size_t			labelsLength;
+} METADATA_File;
+
+//Maps and parses the model file. Returns 0 if it is not a TFLite flatbuffer
+METADATA_File*	METADATA_Open( const char* path );
+void			METADATA_Close( METADATA_File* file );
+const char*		METADATA_TypeName( int type );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1410 @@
+/*
+ *	Fred Juhlin 2023
+ *	One TFLITE model: larod setup, tensors and output decoding
+ *
+ *	Based on https://github.com/AxisCommunications/acap3-examples/tree/main/object-detection
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "imgconverter.h"
+#include "MODEL.h"
+#include "TENSOR.h"
+#include "AUDIT.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+// Hardcode to use three image "color" channels (eg. RGB).
+static const unsigned int CHANNELS = 3;
+
+
+cJSON*
+MODEL_Setting( MODEL_Instance* model, const char* name ) {
+	cJSON* item = cJSON_GetObjectItem( model->settings, name );
+	if( !item && model->defaults )
+		item = cJSON_GetObjectItem( model->defaults, name );
+	return item;
+}
+
+static double
+MODEL_Number( MODEL_Instance* model, const char* name, double fallback ) {
+	cJSON* item = MODEL_Setting( model, name );
+	return (item && item->type == cJSON_Number) ? item->valuedouble : fallback;
+}
+
+static const char*
+MODEL_String( MODEL_Instance* model, const char* name, const char* fallback ) {
+	cJSON* item = MODEL_Setting( model, name );
+	return (item && item->type == cJSON_String) ? item->valuestring : fallback;
+}
+
+//Chips in the order they are tried. LAROD_CHIP_TPU, LAROD_CHIP_TFLITE_ARTPEC8DLPU, LAROD_CHIP_TFLITE_CPU
+static const struct {
+	int			chip;
+	const char*	architecture;
+} MODEL_Chips[] = {
+	{ 4, "EdgeTPU" },
+	{ 12, "ARTPEC-8" },
+	{ 2, "CPU" }
+};
+#define MODEL_NUM_CHIPS	(sizeof(MODEL_Chips) / sizeof(MODEL_Chips[0]))
+
+static double
+MODEL_Ms( const struct timespec* start, const struct timespec* end ) {
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/*
+ * Model cache. Models are loaded public as package:name:hash so larod keeps them after the
+ * ACAP stops. On the next start a model with the same hash on the same chip is reused and
+ * not loaded and compiled again. Versions with another hash are deleted on start.
+ * A public model holds larod memory until it is deleted or the device reboots, also after the
+ * ACAP is removed, so the cache is off unless "modelCache" is true.
+ */
+static larodModel*
+MODEL_LoadModel( MODEL_Instance* model, larodConnection* conn, const char* package, int chip, larodError** error ) {
+	struct timespec start, end;
+	larodModel* loaded = NULL;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	if( model->useCache ) {
+		size_t count = 0, i;
+		size_t prefix = strrchr( model->cacheName, ':' ) - model->cacheName + 1;
+		larodModel** list = larodGetModels( conn, &count, error );
+		for( i = 0; list && i < count; i++ ) {
+			const char* name = larodGetModelName( list[i], NULL );
+			if( !name || strncmp( name, model->cacheName, prefix ) != 0 )
+				continue;
+			if( strcmp( name, model->cacheName ) != 0 ) {
+				if( model->pruneCache && larodDeleteModel( conn, list[i], NULL ) )
+					LOG( "%s: Deleted old model %s\n", __func__, name );
+				continue;
+			}
+			if( !loaded && (int)larodGetModelChip( list[i], NULL ) == chip )
+				loaded = larodGetModel( conn, larodGetModelId( list[i], NULL ), NULL );
+		}
+		if( list )
+			larodDestroyModels( &list, count );
+		larodClearError( error );
+	}
+	model->cache = loaded ? "hit" : (model->useCache ? "miss" : "off");
+	if( !loaded )
+		loaded = larodLoadModel( conn, model->modelFd, model->useCache ? LAROD_ACCESS_PUBLIC : LAROD_ACCESS_PRIVATE, model->useCache ? model->cacheName : package, error );
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	model->compileTime = MODEL_Ms( &start, &end );
+	return loaded;
+}
+
+/**
+ * @brief Sets up and configures a connection to larod, and loads a model.
+ *
+ * Opens a connection to larod for the model. The preferred chip is tried
+ * first. If it is missing or cannot load the model, the first chip that
+ * accepts the connection is used. Then the model file is loaded to the chip.
+ *
+ * @param model The model, with modelFd opened.
+ * @param package Name of the ACAP, used as larod model name.
+ * @param preferred Chip that worked last time, 0 if unknown.
+ * @return false if error has occurred, otherwise true.
+ */
+static bool
+setupLarod( MODEL_Instance* model, const char* package, int preferred ) {
+    larodError* error = NULL;
+    larodConnection* conn = NULL;
+    larodModel* loadedModel = NULL;
+    bool ret = false;
+    size_t i;
+
+	LOG_TRACE("%s:\n",__func__);
+
+    // Set up larod connection.
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!larodConnect(&conn, &error)) {
+        LOG_WARN( "%s: Could not connect to larod: %s\n", __func__, error->msg);
+        goto end;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    model->connectTime = MODEL_Ms(&start, &end);
+
+    for (i = 0; i < MODEL_NUM_CHIPS; i++) {
+		if (MODEL_Chips[i].chip != preferred)
+			continue;
+		if (larodSetChip(conn, preferred, &error)) {
+			loadedModel = MODEL_LoadModel(model, conn, package, preferred, &error);
+			if (loadedModel) {
+				model->chip = preferred;
+				model->architecture = MODEL_Chips[i].architecture;
+				goto loaded;
+			}
+			LOG_WARN( "%s: Previous chip %s failed. Trying all\n", __func__, MODEL_Chips[i].architecture);
+			//larod may keep the chip. Use a new connection for the full search
+			larodDisconnect(&conn, NULL);
+			larodClearError(&error);
+			if (!larodConnect(&conn, &error)) {
+				LOG_WARN( "%s: Could not connect to larod: %s\n", __func__, error->msg);
+				goto end;
+			}
+		}
+		larodClearError(&error);
+    }
+
+    // Test various chip configuration
+    for (i = 0; i < MODEL_NUM_CHIPS; i++) {
+		if (larodSetChip(conn, MODEL_Chips[i].chip, &error))
+			break;
+		larodClearError(&error);
+    }
+    if (i == MODEL_NUM_CHIPS) {
+		LOG_WARN("No Larod compatible chip found\n");
+		goto error;
+    }
+    model->chip = MODEL_Chips[i].chip;
+    model->architecture = MODEL_Chips[i].architecture;
+
+    loadedModel = MODEL_LoadModel(model, conn, package, model->chip, &error);
+    if (!loadedModel) {
+        LOG_WARN( "%s: Unable to load model: %s\n", __func__, error->msg);
+        goto error;
+    }
+
+loaded:
+    model->conn = conn;
+    model->model = loadedModel;
+
+    ret = true;
+
+    goto end;
+
+error:
+    if (conn) {
+        larodDisconnect(&conn, NULL);
+    }
+
+end:
+    if (error) {
+        larodClearError(&error);
+    }
+
+    return ret;
+}
+
+static int
+MODEL_Decoder( const char* name ) {
+	if( strcmp(name,"classification") == 0 )
+		return DECODER_CLASSIFICATION;
+	if( strcmp(name,"ssd") == 0 )
+		return DECODER_SSD;
+	if( strcmp(name,"ssd-anchors") == 0 )
+		return DECODER_SSD_ANCHORS;
+	if( strcmp(name,"yolo") == 0 )
+		return DECODER_YOLO;
+	if( strcmp(name,"segmentation") == 0 )
+		return DECODER_SEGMENTATION;
+	LOG_WARN("%s: Unknown decoder %s\n",__func__,name);
+	return -1;
+}
+
+static int
+MODEL_ClassifyType( MODEL_Instance* model ) {
+	switch( model->outputType[0] ) {
+		case LAROD_TENSOR_DATA_TYPE_FLOAT32:	return CLASSIFY_FLOAT32;
+		case LAROD_TENSOR_DATA_TYPE_INT8:		return CLASSIFY_INT8;
+		default:								return CLASSIFY_UINT8;
+	}
+}
+
+static void
+MODEL_GateLabels_Free( MODEL_Instance* model ) {
+	unsigned int i;
+	for( i = 0; i < model->numGateLabels; i++ )
+		free( model->gateLabels[i] );
+	free( model->gateLabels );
+	model->gateLabels = 0;
+	model->numGateLabels = 0;
+}
+
+//Settings read on the frame path are resolved here, not looked up per frame
+static void
+MODEL_Thresholds( MODEL_Instance* model ) {
+	model->confidenceLevel = MODEL_Number( model, "confidence", 60.0 );
+	model->topK = MODEL_Number( model, "topK", 5 );
+	//Same quantization as the output is decoded with. Set again once the outputs are known
+	const DETECT_Tensor* scores = &model->decoderTensor[0];
+	model->scoreThreshold = CLASSIFY_Threshold( model->confidenceLevel, MODEL_ClassifyType( model ), scores->scale, scores->zeroPoint );
+	model->iouThreshold = MODEL_Number( model, "iou", 0.5 );
+	model->maxDetections = MODEL_Number( model, "maxDetections", 20 );
+	//"tileMotion" 0 processes every tile on every pass
+	model->tileMotion = MODEL_Number( model, "tileMotion", 8 );
+
+	MODEL_GateLabels_Free( model );
+	cJSON* gateLabels = MODEL_Setting( model, "gateLabels" );
+	int count = gateLabels && gateLabels->type == cJSON_Array ? cJSON_GetArraySize( gateLabels ) : 0;
+	if( count > 0 && (model->gateLabels = calloc( count, sizeof(char*) )) ) {
+		cJSON* item;
+		for( item = gateLabels->child; item; item = item->next )
+			if( item->type == cJSON_String && (model->gateLabels[model->numGateLabels] = strdup( item->valuestring )) )
+				model->numGateLabels++;
+	}
+
+	if( !model->classThreshold )
+		return;
+	//"classConfidence": { "label": 0-100, ... } overrides confidence for individual labels
+	cJSON* classConfidence = MODEL_Setting( model, "classConfidence" );
+	size_t i;
+	for( i = 0; i < model->numberOfLabels; i++ ) {
+		cJSON* level = classConfidence ? cJSON_GetObjectItem(classConfidence, LABELS_Get( model->labelTable, i ) ) : 0;
+		model->classThreshold[i] = (level ? level->valuedouble : model->confidenceLevel) / 100.0;
+	}
+}
+
+//Tensor buffer. The path taken is reported in the status, tmp files if any buffer needed them
+static bool
+MODEL_Buffer( MODEL_Instance* model, const char* kind, size_t size, void** addr, int* fd ) {
+	char name[96];
+	snprintf( name, sizeof(name), "%s.%s", model->name, kind );
+	int path = TENSOR_Alloc( name, size, addr, fd );
+	if( path == TENSOR_NONE )
+		return false;
+	if( path > model->tensorPath )
+		model->tensorPath = path;
+	return true;
+}
+
+static size_t
+MODEL_TensorBytes( larodTensor* tensor, larodTensorDataType* type, const larodTensorDims** tensorDims ) {
+	larodError* error = NULL;
+	const larodTensorDims* dims = larodGetTensorDims( tensor, &error );
+	if( !dims ) {
+		LOG_WARN( "%s: Unable to get tensor dims: %s\n", __func__, error->msg);
+		larodClearError(&error);
+		return 0;
+	}
+	size_t elementSize = 1;
+	*type = larodGetTensorDataType( tensor, &error );
+	switch( *type ) {
+		case LAROD_TENSOR_DATA_TYPE_UINT8:
+		case LAROD_TENSOR_DATA_TYPE_INT8:
+			break;
+		case LAROD_TENSOR_DATA_TYPE_INT32:
+		case LAROD_TENSOR_DATA_TYPE_FLOAT32:
+			elementSize = 4;
+			break;
+		default:
+			LOG_WARN( "%s: Unsupported tensor data type\n", __func__);
+			larodClearError(&error);
+			return 0;
+	}
+	size_t bytes = elementSize;
+	size_t i;
+	for( i = 0; i < dims->len; i++ )
+		bytes *= dims->dims[i];
+	*tensorDims = dims;
+	return bytes;
+}
+
+static bool
+MODEL_LoadAnchors( MODEL_Instance* model, size_t count ) {
+	FILE* file = fopen( model->anchorsFilePath, "r" );
+	if( !file ) {
+        LOG_WARN( "%s: Unable to open anchors file %s: %s\n", __func__, model->anchorsFilePath, strerror(errno));
+		return false;
+	}
+	float* anchors = malloc( count * 4 * sizeof(float) );
+	size_t numAnchors = 0;
+	//One anchor per line: ycenter xcenter height width
+	while( anchors && numAnchors < count &&
+		   fscanf( file, "%f %f %f %f", &anchors[4*numAnchors], &anchors[4*numAnchors+1], &anchors[4*numAnchors+2], &anchors[4*numAnchors+3] ) == 4 )
+		numAnchors++;
+	fclose( file );
+	model->anchors = anchors;
+	model->numAnchors = numAnchors;
+	if( numAnchors != count ) {
+        LOG_WARN( "%s: Model has %u anchors but %s has %u\n", __func__, (unsigned)count, model->anchorsFilePath, (unsigned)numAnchors);
+		return false;
+	}
+	return true;
+}
+
+static bool
+MODEL_Segmentation_Setup( MODEL_Instance* model, const larodTensorDims* dims ) {
+	if( model->numOutputs != 1 || !dims || dims->len < 3 ) {
+		LOG_WARN( "%s: segmentation decoder expects one output [1][H][W][classes] or [1][H][W]\n", __func__);
+		return false;
+	}
+	//NHWC logits, or a class map with or without a trailing 1 dimension
+	size_t channels = dims->len >= 4 ? dims->dims[3] : 1;
+	size_t height = dims->dims[1];
+	size_t width = dims->dims[2];
+	larodTensorDataType type = model->outputType[0];
+	model->segmentationClassMap = channels == 1;
+	if( model->segmentationClassMap && type != LAROD_TENSOR_DATA_TYPE_UINT8 && type != LAROD_TENSOR_DATA_TYPE_INT32 ) {
+		LOG_WARN( "%s: Class map must be uint8 or int32\n", __func__);
+		return false;
+	}
+	if( !model->segmentationClassMap && type == LAROD_TENSOR_DATA_TYPE_INT32 ) {
+		LOG_WARN( "%s: Unsupported logits data type\n", __func__);
+		return false;
+	}
+	model->decoderClasses = model->segmentationClassMap ? model->numberOfLabels : channels;
+	if( model->decoderClasses > model->numberOfLabels ) {
+        LOG_WARN( "%s: Model has %u classes but only %u labels\n", __func__, (unsigned)model->decoderClasses, (unsigned)model->numberOfLabels);
+		return false;
+	}
+	model->segmentation = SEGMENT_Create( width, height, model->decoderClasses );
+	return model->segmentation != 0;
+}
+
+/**
+ * @brief Allocates and maps all output tensors and prepares the selected decoder.
+ *
+ * @return false if error has occurred, otherwise true.
+ */
+static bool
+MODEL_Outputs( MODEL_Instance* model ) {
+	const larodTensorDims* dims[MODEL_MAX_OUTPUTS] = { 0 };
+	larodError* error = NULL;
+	size_t o;
+
+	if( model->numOutputs > MODEL_MAX_OUTPUTS ) {
+        LOG_WARN( "%s: Model has %u outputs. Max is %d\n", __func__, (unsigned)model->numOutputs, MODEL_MAX_OUTPUTS);
+		return false;
+	}
+
+	model->rewind = true;
+	for( o = 0; o < model->numOutputs; o++ ) {
+		larodTensorDataType type = LAROD_TENSOR_DATA_TYPE_UINT8;
+		model->outputSize[o] = MODEL_TensorBytes( model->outputTensors[o], &type, &dims[o] );
+		if( o == 0 && model->decoder == DECODER_CLASSIFICATION && model->outputSize[o] == 0 )
+			model->outputSize[o] = model->numberOfLabels;
+		if( model->outputSize[o] == 0 )
+			return false;
+		if (!MODEL_Buffer(model, "output", model->outputSize[o], &model->outputAddr[o], &model->outputFd[o])) {
+			LOG_WARN( "%s: Output data allocation failed\n", __func__);
+			return false;
+		}
+		if (!larodSetTensorFd(model->outputTensors[o], model->outputFd[o], &error)) {
+			LOG_WARN( "%s: Failed setting output tensor fd: %s\n", __func__, error->msg);
+			larodClearError(&error);
+			return false;
+		}
+#ifdef LAROD_FD_PROP_MAP
+		//A mapped buffer is written from its offset and the file position is not used
+		if( larodSetTensorFdProps(model->outputTensors[o], LAROD_FD_PROP_MAP, &error) ) {
+			if( o == 0 )
+				model->rewind = false;
+		} else {
+			model->rewind = true;
+			larodClearError(&error);
+		}
+#endif
+		model->outputType[o] = type;
+		//Quantization parameters are not exposed by larod. Take them from the model file. model.json overrides
+		const METADATA_Tensor* meta = model->metadata && o < model->metadata->numOutputs ? &model->metadata->outputs[o] : 0;
+		bool quantized = meta && meta->quantized && meta->scale > 0;
+		model->decoderTensor[o].data = model->outputAddr[o];
+		model->decoderTensor[o].type = type == LAROD_TENSOR_DATA_TYPE_FLOAT32 ? DETECT_FLOAT32 : (type == LAROD_TENSOR_DATA_TYPE_INT8 ? DETECT_INT8 : DETECT_UINT8);
+		model->decoderTensor[o].scale = MODEL_Number( model, "outputScale", quantized ? meta->scale : 1.0/255.0 );
+		model->decoderTensor[o].zeroPoint = MODEL_Number( model, "outputZeroPoint", quantized ? meta->zeroPoint : 0 );
+	}
+
+	switch( model->decoder ) {
+		case DECODER_CLASSIFICATION:
+			if( model->outputType[0] != LAROD_TENSOR_DATA_TYPE_UINT8 && model->outputType[0] != LAROD_TENSOR_DATA_TYPE_INT8 && model->outputType[0] != LAROD_TENSOR_DATA_TYPE_FLOAT32 ) {
+				LOG_WARN( "%s: Classification output must be uint8, int8 or float32\n", __func__);
+				return false;
+			}
+			//Scores per batch item. A longer label file must not read past them
+			model->decoderClasses = model->outputSize[0] / (model->outputType[0] == LAROD_TENSOR_DATA_TYPE_FLOAT32 ? 4 : 1) / model->batch;
+			if( model->decoderClasses != model->numberOfLabels )
+				LOG_WARN( "%s: Model has %u classes but %u labels\n", __func__, (unsigned)model->decoderClasses, (unsigned)model->numberOfLabels);
+			if( model->decoderClasses > model->numberOfLabels )
+				model->decoderClasses = model->numberOfLabels;
+			MODEL_Thresholds( model );
+			return true;
+		case DECODER_SEGMENTATION:
+			return MODEL_Segmentation_Setup( model, dims[0] );
+		case DECODER_SSD:
+			if( model->numOutputs != 4 || !dims[0] || dims[0]->len < 2 || model->outputType[0] != LAROD_TENSOR_DATA_TYPE_FLOAT32 ) {
+				LOG_WARN( "%s: ssd decoder expects 4 float outputs (boxes, classes, scores, count)\n", __func__);
+				return false;
+			}
+			model->decoderBoxes = dims[0]->dims[dims[0]->len - 2];
+			break;
+		case DECODER_SSD_ANCHORS:
+			if( model->numOutputs != 2 || !dims[0] || dims[0]->len < 2 || !dims[1] || dims[1]->len < 2 ||
+				model->outputType[0] == LAROD_TENSOR_DATA_TYPE_INT32 || model->outputType[1] == LAROD_TENSOR_DATA_TYPE_INT32 ) {
+				LOG_WARN( "%s: ssd-anchors decoder expects 2 outputs (boxes, scores)\n", __func__);
+				return false;
+			}
+			model->decoderBoxes = dims[0]->dims[dims[0]->len - 2];
+			model->decoderClasses = dims[1]->dims[dims[1]->len - 1];
+			if( !MODEL_LoadAnchors( model, model->decoderBoxes ) )
+				return false;
+			break;
+		case DECODER_YOLO:
+			if( model->numOutputs != 1 || !dims[0] || dims[0]->len < 2 || dims[0]->dims[dims[0]->len - 1] <= 5 ||
+				model->outputType[0] == LAROD_TENSOR_DATA_TYPE_INT32 ) {
+				LOG_WARN( "%s: yolo decoder expects one output [N][5 + classes]\n", __func__);
+				return false;
+			}
+			model->decoderBoxes = dims[0]->dims[dims[0]->len - 2];
+			model->decoderClasses = dims[0]->dims[dims[0]->len - 1] - 5;
+			break;
+	}
+	if( model->decoderClasses > model->numberOfLabels ) {
+        LOG_WARN( "%s: Model has %u classes but only %u labels\n", __func__, (unsigned)model->decoderClasses, (unsigned)model->numberOfLabels);
+		return false;
+	}
+	model->detections = DETECT_Create( model->decoderBoxes );
+	return model->detections != 0;
+}
+
+//Input size from the model file, or from settings if the file can not be parsed
+static bool
+MODEL_Geometry( MODEL_Instance* model, const char** status ) {
+	model->metadata = METADATA_Open( model->modelFilePath );
+	const METADATA_Tensor* input = model->metadata ? &model->metadata->inputs[0] : 0;
+	if( !input || (input->len != 4 && input->len != 5) ) {
+		model->width = MODEL_Number( model, "modelWidth", 224 );
+		model->height = MODEL_Number( model, "modelHeight", 224 );
+		model->geometry = "settings";
+		return true;
+	}
+	//[N][H][W][C], or [N][T][H][W][C] for clip models
+	const size_t* hwc = input->dims + input->len - 3;
+	if( input->type != METADATA_UINT8 || hwc[2] != 3 ) {
+		LOG_WARN( "%s: %s input is %s with %u channels. Expected uint8 RGB\n", __func__, model->name, METADATA_TypeName( input->type ), (unsigned)hwc[2]);
+		*status = "Model input is not uint8 RGB";
+		return false;
+	}
+	model->width = hwc[1];
+	model->height = hwc[0];
+	model->geometry = "model";
+	unsigned int width = MODEL_Number( model, "modelWidth", model->width );
+	unsigned int height = MODEL_Number( model, "modelHeight", model->height );
+	if( width != model->width || height != model->height )
+		LOG( "%s: %s input is %ux%u. modelWidth/modelHeight %ux%u ignored\n", __func__, model->name, model->width, model->height, width, height );
+	return true;
+}
+
+/*
+ * Labels set in settings are used as is. Otherwise the label file embedded in the model,
+ * or the labels file, is indexed in place and settings only get "labelCount" and "labelHash"
+ */
+static bool
+MODEL_Labels( MODEL_Instance* model ) {
+	cJSON* labels = cJSON_GetObjectItem( model->settings, "labels" );
+	if( labels && labels->type == cJSON_Array ) {
+		model->labelTable = LABELS_FromJSON( labels );
+		model->labels = labels;
+		model->labelsSource = "settings";
+	} else {
+		if( model->metadata && model->metadata->labels ) {
+			model->labelTable = LABELS_FromText( model->metadata->labels, model->metadata->labelsLength );
+			model->labelsSource = "model";
+		}
+		if( LABELS_Count( model->labelTable ) == 0 ) {
+			LABELS_Free( model->labelTable );
+			model->labelTable = LABELS_FromFile( model->labelsFilePath );
+			model->labelsSource = "file";
+		}
+		char hash[9];
+		snprintf( hash, sizeof(hash), "%08x", LABELS_Digest( model->labelTable ) );
+		cJSON_DeleteItemFromObject( model->settings, "labels" );
+		cJSON_DeleteItemFromObject( model->settings, "labelCount" );
+		cJSON_DeleteItemFromObject( model->settings, "labelHash" );
+		cJSON_AddNumberToObject( model->settings, "labelCount", LABELS_Count( model->labelTable ) );
+		cJSON_AddStringToObject( model->settings, "labelHash", hash );
+		model->labels = 0;
+	}
+	model->numberOfLabels = LABELS_Count( model->labelTable );
+	return model->numberOfLabels > 0;
+}
+
+MODEL_Instance*
+MODEL_Open( const char* package, const char* name, cJSON* settings, cJSON* defaults, const char** status ) {
+	LOG_TRACE("%s: %s\n",__func__,name);
+
+	MODEL_Instance* model = calloc( 1, sizeof(MODEL_Instance) );
+	if( !model ) {
+		*status = "Memory allocation failed";
+		return 0;
+	}
+	model->pruneCache = true;
+	model->modelFd = -1;
+	model->inputFd = -1;
+	model->inputAddr = MAP_FAILED;
+	model->ringFd = -1;
+	model->ring = MAP_FAILED;
+	size_t o;
+	for( o = 0; o < MODEL_MAX_OUTPUTS; o++ ) {
+		model->outputFd[o] = -1;
+		model->outputAddr[o] = MAP_FAILED;
+	}
+	model->inputOwner = model;
+	model->tile = -1;
+	model->architecture = "Undefined";
+	model->settings = settings;
+	model->defaults = defaults;
+	snprintf( model->name, sizeof(model->name), "%s", name );
+
+	snprintf( model->modelFilePath, sizeof(model->modelFilePath), "/usr/local/packages/%s/%s", package, MODEL_String( model, "file", "model/model.tflite" ) );
+	snprintf( model->labelsFilePath, sizeof(model->labelsFilePath), "/usr/local/packages/%s/%s", package, MODEL_String( model, "labelsFile", "model/labels.txt" ) );
+	snprintf( model->anchorsFilePath, sizeof(model->anchorsFilePath), "/usr/local/packages/%s/%s", package, MODEL_String( model, "anchorsFile", "model/anchors.txt" ) );
+
+	if( !MODEL_Geometry( model, status ) ) {
+		MODEL_Close( model );
+		return 0;
+	}
+	model->every = MODEL_Number( model, "every", 1 );
+	if( model->every < 1 )
+		model->every = 1;
+	cJSON* crops = MODEL_Setting( model, "crops" );
+	model->crops = crops && crops->type == cJSON_True;
+	model->maxCrops = MODEL_Number( model, "maxCrops", 4 );
+	model->batchTimeout = MODEL_Number( model, "batchTimeout", 1000 );
+
+	if( !MODEL_Labels( model ) ) {
+		*status = "No labels for this model";
+		MODEL_Close( model );
+		return 0;
+	}
+
+	model->topResults = malloc( model->numberOfLabels * sizeof(CLASSIFY_Item) );
+	model->classThreshold = malloc( model->numberOfLabels * sizeof(float) );
+	if( !model->topResults || !model->classThreshold ) {
+		*status = "Label allocation failed";
+		MODEL_Close( model );
+		return 0;
+	}
+	MODEL_Thresholds( model );
+
+	model->decoder = MODEL_Decoder( MODEL_String( model, "decoder", "classification" ) );
+	if( model->decoder < 0 ) {
+		*status = "Unknown decoder";
+		MODEL_Close( model );
+		return 0;
+	}
+
+	return model;
+}
+
+bool
+MODEL_Load( MODEL_Instance* model, const char* package, int chip, const char** status ) {
+	struct timespec start, end;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+
+    model->modelFd = open(model->modelFilePath, O_RDONLY);
+    if (model->modelFd < 0) {
+        LOG_WARN( "%s: Unable to open model file %s: %s\n", __func__, model->modelFilePath, strerror(errno));
+		*status = "Model file does not exist";
+		return false;
+    }
+	cJSON* cache = MODEL_Setting( model, "modelCache" );
+	model->useCache = cache && cache->type == cJSON_True;
+	if( model->useCache ) {
+		struct timespec hashed;
+		model->useCache = MODEL_Hash( model );
+		clock_gettime( CLOCK_MONOTONIC, &hashed );
+		model->hashTime = MODEL_Ms( &start, &hashed );
+		snprintf( model->cacheName, sizeof(model->cacheName), "%s:%s:%s", package, model->name, model->hash );
+	}
+    if (!setupLarod(model, package, chip)) {
+		*status = "Failed setting up architecture";
+		return false;
+    }
+
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	model->loadTime = (unsigned int)MODEL_Ms( &start, &end );
+	return true;
+}
+
+bool
+MODEL_Hash( MODEL_Instance* model ) {
+	if( model->hash[0] )
+		return true;
+	int fd = open( model->modelFilePath, O_RDONLY );
+	if( fd < 0 )
+		return false;
+	struct stat st;
+	if( fstat( fd, &st ) < 0 || st.st_size == 0 ) {
+		close( fd );
+		return false;
+	}
+	const uint8_t* data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( data == MAP_FAILED )
+		return false;
+	//FNV-1a 64
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	off_t i;
+	for( i = 0; i < st.st_size; i++ ) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	munmap( (void*)data, st.st_size );
+	snprintf( model->hash, sizeof(model->hash), "%016llx", (unsigned long long)hash );
+	return true;
+}
+
+static int
+MODEL_CompareDouble( const void* a, const void* b ) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Loads the model on one chip with its own connection and tensors and times
+ * runs inferences on a synthetic input. The model's own larod state is not used.
+ */
+static bool
+MODEL_Benchmark( MODEL_Instance* model, const char* package, int chip, unsigned int runs, cJSON* result ) {
+	larodError* error = NULL;
+	larodConnection* conn = NULL;
+	larodModel* loaded = NULL;
+	larodTensor** inputs = NULL;
+	larodTensor** outputs = NULL;
+	larodInferenceRequest* request = NULL;
+	size_t numInputs = 0, numOutputs = 0, t;
+	int fd[2 * MODEL_MAX_OUTPUTS];
+	void* addr[2 * MODEL_MAX_OUTPUTS];
+	size_t size[2 * MODEL_MAX_OUTPUTS];
+	size_t numBuffers = 0;
+	double* durations = NULL;
+	bool ok = false;
+	struct timespec start, end;
+
+	int modelFd = open( model->modelFilePath, O_RDONLY );
+	if( modelFd < 0 )
+		return false;
+	if( !larodConnect( &conn, &error ) )
+		goto end;
+	if( !larodSetChip( conn, chip, &error ) )
+		goto end;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	loaded = larodLoadModel( conn, modelFd, LAROD_ACCESS_PRIVATE, package, &error );
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	if( !loaded )
+		goto end;
+	cJSON_AddNumberToObject( result, "loadTime", (int)MODEL_Ms( &start, &end ) );
+
+	inputs = larodCreateModelInputs( loaded, &numInputs, &error );
+	outputs = inputs ? larodCreateModelOutputs( loaded, &numOutputs, &error ) : NULL;
+	if( !outputs || numInputs + numOutputs > 2 * MODEL_MAX_OUTPUTS )
+		goto end;
+	unsigned int batch = 1;
+	for( t = 0; t < numInputs + numOutputs; t++ ) {
+		larodTensor* tensor = t < numInputs ? inputs[t] : outputs[t - numInputs];
+		larodTensorDataType type;
+		const larodTensorDims* dims = NULL;
+		size[t] = MODEL_TensorBytes( tensor, &type, &dims );
+		if( size[t] == 0 || !TENSOR_Alloc( "benchmark", size[t], &addr[t], &fd[t] ) )
+			goto end;
+		numBuffers++;
+		if( !larodSetTensorFd( tensor, fd[t], &error ) )
+			goto end;
+		if( t == 0 && dims->len == 4 && dims->dims[0] > 1 )
+			batch = dims->dims[0];
+		//Synthetic input. Noise rather than zeros so no runtime shortcut applies
+		if( t < numInputs ) {
+			uint32_t seed = 12345;
+			size_t i;
+			for( i = 0; i < size[t]; i++ ) {
+				seed = seed * 1103515245 + 12345;
+				((uint8_t*)addr[t])[i] = seed >> 24;
+			}
+		}
+	}
+	request = larodCreateInferenceRequest( loaded, inputs, numInputs, outputs, numOutputs, &error );
+	durations = malloc( runs * sizeof(double) );
+	if( !request || !durations )
+		goto end;
+
+	//The first inference pays one-time costs and is not counted
+	if( !larodRunInference( conn, request, &error ) )
+		goto end;
+	double total = 0;
+	unsigned int i;
+	for( i = 0; i < runs; i++ ) {
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		if( !larodRunInference( conn, request, &error ) )
+			goto end;
+		clock_gettime( CLOCK_MONOTONIC, &end );
+		durations[i] = MODEL_Ms( &start, &end );
+		total += durations[i];
+	}
+	qsort( durations, runs, sizeof(double), MODEL_CompareDouble );
+	cJSON_AddNumberToObject( result, "p50", durations[runs / 2] );
+	cJSON_AddNumberToObject( result, "p99", durations[(runs * 99) / 100] );
+	cJSON_AddNumberToObject( result, "mean", total / runs );
+	cJSON_AddNumberToObject( result, "itemsPerSecond", total > 0 ? batch * runs * 1000.0 / total : 0 );
+	ok = true;
+
+end:
+	if( error ) {
+		LOG_WARN( "%s: %s on chip %d: %s\n", __func__, model->name, chip, error->msg );
+		larodClearError( &error );
+	}
+	free( durations );
+	if( request )
+		larodDestroyInferenceRequest( &request );
+	if( inputs )
+		larodDestroyTensors( &inputs, numInputs );
+	if( outputs )
+		larodDestroyTensors( &outputs, numOutputs );
+	for( t = 0; t < numBuffers; t++ )
+		TENSOR_Free( addr[t], size[t], fd[t] );
+	if( loaded )
+		larodDestroyModel( &loaded );
+	if( conn )
+		larodDisconnect( &conn, NULL );
+	close( modelFd );
+	return ok;
+}
+
+cJSON*
+MODEL_Calibrate( MODEL_Instance* model, const char* package, unsigned int runs ) {
+	if( runs < 1 )
+		runs = 1;
+	cJSON* table = cJSON_CreateArray();
+	size_t i;
+	for( i = 0; i < MODEL_NUM_CHIPS; i++ ) {
+		cJSON* result = cJSON_CreateObject();
+		cJSON_AddStringToObject( result, "architecture", MODEL_Chips[i].architecture );
+		cJSON_AddNumberToObject( result, "chip", MODEL_Chips[i].chip );
+		bool ok = MODEL_Benchmark( model, package, MODEL_Chips[i].chip, runs, result );
+		cJSON_AddBoolToObject( result, "available", ok );
+		cJSON_AddItemToArray( table, result );
+		LOG( "%s: %s on %s %s\n", __func__, model->name, MODEL_Chips[i].architecture, ok ? "measured" : "not available" );
+	}
+	return table;
+}
+
+int
+MODEL_Fastest( cJSON* table, const char* metric ) {
+	//"throughput" picks the most items per second. "p50" and "p99" the lowest latency
+	bool throughput = metric && strcmp( metric, "throughput" ) == 0;
+	const char* key = throughput ? "itemsPerSecond" : ( metric && strcmp( metric, "p99" ) == 0 ? "p99" : "p50" );
+	int chip = 0;
+	double best = 0;
+	cJSON* result;
+	for( result = table ? table->child : 0; result; result = result->next ) {
+		cJSON* value = cJSON_GetObjectItem( result, key );
+		cJSON* id = cJSON_GetObjectItem( result, "chip" );
+		if( !value || !id )
+			continue;
+		if( chip == 0 || (throughput ? value->valuedouble > best : value->valuedouble < best) ) {
+			chip = id->valueint;
+			best = value->valuedouble;
+		}
+	}
+	return chip;
+}
+
+//Tile start positions along one axis. The last tile ends at the edge
+static size_t
+MODEL_TileSteps( unsigned int length, unsigned int tile, double overlap, unsigned int* start, size_t max ) {
+	double step = tile * (1.0 - overlap);
+	if( step < 1 )
+		step = 1;
+	size_t count = 1;
+	if( length > tile )
+		count += (size_t)((length - tile + step - 1) / step);
+	if( count > max )
+		count = max;
+	size_t i;
+	for( i = 0; i < count; i++ )
+		start[i] = count > 1 ? (unsigned int)((double)(length - tile) * i / (count - 1)) & ~1u : 0;
+	return count;
+}
+
+#define MODEL_MAX_TILES	8	//Per axis
+
+static bool
+MODEL_Tiles( MODEL_Instance* model, unsigned int streamWidth, unsigned int streamHeight ) {
+	cJSON* tiling = MODEL_Setting( model, "tiles" );
+	if( !tiling || tiling->type != cJSON_True )
+		return true;
+	if( model->decoder == DECODER_CLASSIFICATION || model->decoder == DECODER_SEGMENTATION ) {
+		LOG_WARN("%s: %s. Tiles requires a detection decoder\n",__func__,model->name);
+		return true;
+	}
+	//tileScale 1 cuts tiles at stream resolution. 0.5 covers twice the area per tile
+	double scale = MODEL_Number( model, "tileScale", 1.0 );
+	double overlap = MODEL_Number( model, "tileOverlap", 0.2 );
+	if( scale <= 0 )
+		scale = 1;
+	if( overlap < 0 || overlap > 0.9 )
+		overlap = 0.2;
+	unsigned int tileW = model->width / scale;
+	unsigned int tileH = model->height / scale;
+	if( tileW > streamWidth )
+		tileW = streamWidth;
+	if( tileH > streamHeight )
+		tileH = streamHeight;
+
+	unsigned int xs[MODEL_MAX_TILES], ys[MODEL_MAX_TILES];
+	size_t columns = MODEL_TileSteps( streamWidth, tileW, overlap, xs, MODEL_MAX_TILES );
+	size_t rows = MODEL_TileSteps( streamHeight, tileH, overlap, ys, MODEL_MAX_TILES );
+	model->numTiles = columns * rows;
+	model->tiles = calloc( model->numTiles, sizeof(MODEL_Tile) );
+	model->tileInput = malloc( model->numTiles * model->width * model->height * CHANNELS );
+	size_t capacity = model->maxDetections ? model->maxDetections : 1;
+	model->merged = DETECT_Create( capacity * model->numTiles );
+	if( !model->tiles || !model->tileInput || !model->merged ) {
+		LOG_WARN("%s: %s. Tile allocation failed\n",__func__,model->name);
+		return false;
+	}
+	size_t r, c;
+	for( r = 0; r < rows; r++ ) {
+		for( c = 0; c < columns; c++ ) {
+			MODEL_Tile* tile = &model->tiles[r * columns + c];
+			tile->x = xs[c];
+			tile->y = ys[r];
+			tile->w = tileW;
+			tile->h = tileH;
+			tile->cache = DETECT_Create( capacity );
+			if( !tile->cache || !reserveArgbScratch( &tile->scratch, (size_t)tileW * tileH, (size_t)model->width * model->height ) ) {
+				LOG_WARN("%s: %s. Tile allocation failed\n",__func__,model->name);
+				return false;
+			}
+		}
+	}
+	LOG("%s: %s runs on %ux%u tiles of %ux%u stream pixels\n",__func__,model->name,(unsigned)columns,(unsigned)rows,tileW,tileH);
+	return true;
+}
+
+static void
+MODEL_TileFree( MODEL_Instance* model ) {
+	size_t t;
+	for( t = 0; model->tiles && t < model->numTiles; t++ ) {
+		DETECT_Free( model->tiles[t].cache );
+		freeArgbScratch( &model->tiles[t].scratch );
+	}
+	free( model->tiles );
+	free( model->tileInput );
+	DETECT_Free( model->merged );
+	model->tiles = 0;
+	model->tileInput = 0;
+	model->merged = 0;
+	model->numTiles = 0;
+}
+
+void
+MODEL_Stream( MODEL_Instance* model, unsigned int streamWidth, unsigned int streamHeight ) {
+	getCropRegion( streamWidth, streamHeight, model->width, model->height, &model->cropX, &model->cropY, &model->cropW, &model->cropH );
+	//Without tiles the model runs on the full frame
+	if( !MODEL_Tiles( model, streamWidth, streamHeight ) )
+		MODEL_TileFree( model );
+}
+
+bool
+MODEL_TileMotion( MODEL_Instance* model, MODEL_Tile* tile, const uint8_t* luma, unsigned int stride, unsigned int shift ) {
+	uint8_t signature[MODEL_TILE_GRID * MODEL_TILE_GRID];
+	unsigned int cellW = (tile->w >> shift) / MODEL_TILE_GRID;
+	unsigned int cellH = (tile->h >> shift) / MODEL_TILE_GRID;
+	//Every 4th pixel and line is enough to see an object move. A reduced frame is read in full
+	unsigned int stepX = cellW >= 8 && shift == 0 ? 4 : 1;
+	unsigned int stepY = cellH >= 8 && shift == 0 ? 4 : 1;
+	unsigned int cx, cy, x, y;
+	for( cy = 0; cy < MODEL_TILE_GRID; cy++ ) {
+		for( cx = 0; cx < MODEL_TILE_GRID; cx++ ) {
+			const uint8_t* cell = luma + (size_t)((tile->y >> shift) + cy * cellH) * stride + (tile->x >> shift) + cx * cellW;
+			unsigned int sum = 0, samples = 0;
+			for( y = 0; y < cellH; y += stepY )
+				for( x = 0; x < cellW; x += stepX, samples++ )
+					sum += cell[(size_t)y * stride + x];
+			signature[cy * MODEL_TILE_GRID + cx] = samples ? sum / samples : 0;
+		}
+	}
+
+	int threshold = model->tileMotion;
+	tile->active = !tile->valid || threshold <= 0;
+	size_t i;
+	for( i = 0; i < sizeof(signature) && !tile->active; i++ )
+		if( abs( (int)signature[i] - (int)tile->signature[i] ) > threshold )
+			tile->active = true;
+	if( tile->active ) {
+		memcpy( tile->signature, signature, sizeof(signature) );
+		tile->valid = true;
+		model->tilesRun++;
+	} else {
+		model->tilesSkipped++;
+	}
+	return tile->active;
+}
+
+bool
+MODEL_Tensors( MODEL_Instance* model, MODEL_Instance* share, const char** status ) {
+	larodError* error = NULL;
+
+    model->inputTensors = larodCreateModelInputs(model->model, &model->numInputs, &error);
+    if (!model->inputTensors) {
+        LOG_WARN( "Failed retrieving input tensors: %s\n", error->msg);
+		larodClearError(&error);
+		*status = "Failed initializing input tensor";
+		return false;
+    }
+	//NHWC. A leading dimension above 1 is the batch size. NTHWC is a clip of T frames
+	model->batch = 1;
+	model->clip = 1;
+	const larodTensorDims* dims = larodGetTensorDims( model->inputTensors[0], &error );
+	if( dims && (dims->len == 4 || dims->len == 5) && dims->dims[0] > 1 )
+		model->batch = dims->dims[0];
+	if( dims && dims->len == 5 && dims->dims[1] > 1 )
+		model->clip = dims->dims[1];
+	larodClearError(&error);
+	if( model->clip > 1 && (model->batch > 1 || model->crops || model->numTiles) ) {
+		*status = "Clip models can not be batched, cropped or tiled";
+		return false;
+	}
+	model->slots = calloc( model->batch, sizeof(MODEL_Slot) );
+	if( !model->slots ) {
+		*status = "Memory allocation failed";
+		return false;
+	}
+
+	model->itemSize = model->width * model->height * CHANNELS * model->clip;
+	model->inputSize = model->itemSize * model->batch;
+	if( model->clip > 1 ) {
+		model->ringSize = model->itemSize;
+		if( !MODEL_Buffer( model, "ring", model->ringSize, &model->ring, &model->ringFd ) ) {
+			*status = "Clip buffer allocation failed";
+			return false;
+		}
+	}
+    // Allocate space for input tensor, or read the input of a model with the same geometry
+	if( share && model->batch == 1 && model->clip == 1 ) {
+		model->inputOwner = share->inputOwner;
+	} else if (!MODEL_Buffer(model, "input", model->inputSize, &model->inputAddr, &model->inputFd)) {
+		*status = "Input data allocation failed";
+		return false;
+    }
+    if (!larodSetTensorFd(model->inputTensors[0], model->inputOwner->inputFd, &error)) {
+        LOG_WARN( "%s: Failed setting input tensor fd: %s\n", __func__,error->msg);
+		larodClearError(&error);
+		*status = "Failed initializing input tensor";
+		return false;
+    }
+    model->outputTensors = larodCreateModelOutputs(model->model, &model->numOutputs, &error);
+    if (!model->outputTensors) {
+        LOG_WARN( "%s: Failed retrieving output tensors: %s\n", __func__, error->msg);
+		larodClearError(&error);
+		*status = "Failed initializing output tensor";
+		return false;
+    }
+	if( !MODEL_Outputs( model ) ) {
+		*status = "Failed initializing output tensor";
+		return false;
+	}
+    model->infReq = larodCreateInferenceRequest(model->model, model->inputTensors, model->numInputs, model->outputTensors, model->numOutputs, &error);
+    if (!model->infReq) {
+        LOG_WARN( "%s: Failed creating inference request: %s\n", __func__, error->msg);
+		larodClearError(&error);
+		*status = "Failed creating inference request";
+		return false;
+    }
+	return true;
+}
+
+void
+MODEL_Settings( MODEL_Instance* model ) {
+	cJSON* labels = cJSON_GetObjectItem( model->settings, "labels" );
+	if( labels && labels != model->labels ) {
+		LABELS_Table* table = LABELS_FromJSON( labels );
+		if( table && LABELS_Count(table) == model->numberOfLabels ) {
+			LABELS_Free( model->labelTable );
+			model->labelTable = table;
+			model->labels = labels;
+		} else {
+			LOG_WARN("%s: Label update ignored. Model %s has %u labels\n",__func__,model->name,(unsigned)model->numberOfLabels);
+			LABELS_Free( table );
+		}
+	}
+	MODEL_Thresholds( model );
+}
+
+uint8_t*
+MODEL_ClipFrame( MODEL_Instance* model ) {
+	return (uint8_t*)model->ring + model->ringHead * (model->itemSize / model->clip);
+}
+
+/*
+ * The ring holds the last clip frames, each converted once. The input is assembled
+ * oldest first with one copy. Until the ring is full the oldest frame is repeated
+ */
+void
+MODEL_ClipPush( MODEL_Instance* model ) {
+	size_t frameSize = model->itemSize / model->clip;
+	uint8_t* ring = model->ring;
+	uint8_t* input = model->inputAddr;
+	unsigned int head = (model->ringHead + 1) % model->clip;
+	if( model->ringFilled < model->clip )
+		model->ringFilled++;
+	unsigned int missing = model->clip - model->ringFilled;
+	unsigned int oldest = model->ringFilled < model->clip ? 0 : head;
+	unsigned int i;
+	for( i = 0; i < missing; i++ )
+		memcpy( input + i * frameSize, ring + oldest * frameSize, frameSize );
+	input += missing * frameSize;
+	unsigned int first = model->clip - oldest < model->ringFilled ? model->clip - oldest : model->ringFilled;
+	memcpy( input, ring + oldest * frameSize, first * frameSize );
+	memcpy( input + first * frameSize, ring, (model->ringFilled - first) * frameSize );
+	model->ringHead = head;
+	model->clipFrames++;
+}
+
+uint8_t*
+MODEL_Input( MODEL_Instance* model ) {
+	//The slot no longer holds the full frame the owner may have converted
+	model->inputOwner->preprocessed = 0;
+	model->inputOwner->preprocessedSequence = 0;
+	return (uint8_t*)model->inputOwner->inputAddr + model->queued * model->itemSize;
+}
+
+bool
+MODEL_Queue( MODEL_Instance* model, double timestamp, const int* box ) {
+	if( model->queued >= model->batch )
+		return true;
+	MODEL_Slot* slot = &model->slots[model->queued++];
+	slot->timestamp = timestamp;
+	slot->tile = model->tile;
+	slot->cropX = model->cropX;
+	slot->cropY = model->cropY;
+	slot->cropW = model->cropW;
+	slot->cropH = model->cropH;
+	slot->hasBox = box != 0;
+	if( box )
+		memcpy( slot->box, box, sizeof(slot->box) );
+	return model->queued == model->batch;
+}
+
+bool
+MODEL_Expired( MODEL_Instance* model, double now ) {
+	return model->queued > 0 && now - model->slots[0].timestamp >= model->batchTimeout;
+}
+
+bool
+MODEL_Run( MODEL_Instance* model ) {
+	struct timespec start, end;
+	larodError* error = NULL;
+	size_t o;
+
+	//Unfilled slots keep old data. Their outputs are ignored
+	model->batched = model->queued;
+	model->queued = 0;
+	if( model->batched == 0 )
+		return false;
+
+	//larod 1 writes outputs at the file position unless it maps the buffers
+	for( o = 0; model->rewind && o < model->numOutputs && o < MODEL_MAX_OUTPUTS; o++ ) {
+		if (lseek(model->outputFd[o], 0, SEEK_SET) == -1) {
+			LOG_WARN( "%s: Unable to rewind output file position: %s\n", __func__, strerror(errno));
+			return false;
+		}
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	AUDIT_Job( true );
+	bool ok = larodRunInference(model->conn, model->infReq, &error);
+	AUDIT_Job( false );
+	if( !ok ) {
+		LOG_WARN( "%s: Unable to run inference on model %s: %s (%d)\n", __func__, model->modelFilePath, error->msg, error->code);
+		larodClearError(&error);
+		return false;
+	}
+	clock_gettime( CLOCK_MONOTONIC, &end );
+
+	model->duration = (unsigned int)MODEL_Ms( &start, &end );
+	model->runs++;
+	model->items += model->batched;
+	model->totalDuration += model->duration;
+	return true;
+}
+
+bool
+MODEL_Warmup( MODEL_Instance* model, unsigned int count ) {
+	unsigned int i;
+	for( i = 0; i < count; i++ ) {
+		while( !MODEL_Queue( model, 0, 0 ) );
+		if( !MODEL_Run( model ) )
+			return false;
+	}
+	//Warm-up runs are not part of the statistics
+	model->runs = 0;
+	model->items = 0;
+	model->totalDuration = 0;
+	return true;
+}
+
+bool
+MODEL_Fires( MODEL_Instance* model, const char* label ) {
+	if( !model->gateLabels )
+		return true;
+	unsigned int i;
+	for( i = 0; i < model->numGateLabels; i++ )
+		if( strcmp( model->gateLabels[i], label ) == 0 )
+			return true;
+	return false;
+}
+
+static cJSON*
+MODEL_Item( MODEL_Instance* model, const char* label, int tagged ) {
+	cJSON* item = cJSON_CreateObject();
+	if( tagged )
+		cJSON_AddStringToObject( item,"model", model->name );
+	cJSON_AddStringToObject( item,"label", label );
+	return item;
+}
+
+static void
+MODEL_Classification( MODEL_Instance* model, cJSON* list, int tagged ) {
+	const DETECT_Tensor* scores = &model->decoderTensor[0];
+	int type = MODEL_ClassifyType( model );
+	size_t k = (model->topK && model->topK < model->decoderClasses) ? model->topK : model->decoderClasses;
+	size_t found = CLASSIFY_TopK( model->output[0], type, model->decoderClasses, model->scoreThreshold, model->topResults, k );
+
+	size_t i;
+	for( i = 0; i < found; i++ ) {
+		cJSON* item = MODEL_Item( model, LABELS_Get( model->labelTable, model->topResults[i].id ), tagged );
+		//Dequantized with (q - zeroPoint) * scale to 0-100%
+		cJSON_AddNumberToObject( item,"score", (int)CLASSIFY_Score( &model->topResults[i], type, scores->scale, scores->zeroPoint ) );
+		cJSON_AddItemToArray(list,item);
+	}
+}
+
+static void
+MODEL_Segmentation( MODEL_Instance* model, cJSON* payload, cJSON* list, int tagged ) {
+	SEGMENT_Mask* segmentation = model->segmentation;
+	larodTensorDataType type = model->outputType[0];
+	if( model->segmentationClassMap )
+		SEGMENT_ClassMap( segmentation, model->output[0], type == LAROD_TENSOR_DATA_TYPE_INT32 ? SEGMENT_INT32 : SEGMENT_UINT8 );
+	else
+		SEGMENT_Argmax( segmentation, model->output[0], type == LAROD_TENSOR_DATA_TYPE_FLOAT32 ? SEGMENT_FLOAT32 : (type == LAROD_TENSOR_DATA_TYPE_INT8 ? SEGMENT_INT8 : SEGMENT_UINT8) );
+	SEGMENT_Encode( segmentation );
+
+	//Only classes that cover any pixel. The mask itself is served by /mask
+	unsigned int c;
+	for( c = 0; c < segmentation->classes; c++ ) {
+		if( segmentation->pixels[c] == 0 )
+			continue;
+		cJSON* item = MODEL_Item( model, LABELS_Get( model->labelTable, c ), tagged );
+		cJSON_AddNumberToObject( item,"coverage", (int)(SEGMENT_Coverage( segmentation, c ) * 10) / 10.0 );
+		cJSON_AddItemToArray(list,item);
+	}
+	cJSON* mask = cJSON_CreateObject();
+	if( tagged )
+		cJSON_AddStringToObject( mask,"model", model->name );
+	cJSON_AddNumberToObject( mask,"width", segmentation->width );
+	cJSON_AddNumberToObject( mask,"height", segmentation->height );
+	cJSON_AddNumberToObject( mask,"runs", segmentation->runs );
+	if( cJSON_GetObjectItem( payload, "mask" ) )
+		cJSON_Delete( mask );  //Only the first segmentation model is summarized. Use /mask?model=name
+	else
+		cJSON_AddItemToObject( payload,"mask", mask);
+}
+
+static void
+MODEL_DetectionItems( MODEL_Instance* model, DETECT_Context* detections, cJSON* list, int tagged ) {
+	size_t i;
+	for( i = 0; i < detections->count; i++ ) {
+		cJSON* item = MODEL_Item( model, LABELS_Get( model->labelTable, detections->classId[i] ), tagged );
+		cJSON_AddNumberToObject( item,"score", (int)(detections->score[i] * 100) );
+		cJSON_AddNumberToObject( item,"x", (int)detections->x1[i] );
+		cJSON_AddNumberToObject( item,"y", (int)detections->y1[i] );
+		cJSON_AddNumberToObject( item,"w", (int)(detections->x2[i] - detections->x1[i]) );
+		cJSON_AddNumberToObject( item,"h", (int)(detections->y2[i] - detections->y1[i]) );
+		cJSON_AddItemToArray(list,item);
+	}
+}
+
+static void
+MODEL_Detection( MODEL_Instance* model, cJSON* list, int tagged ) {
+	DETECT_Context* detections = model->detections;
+	float threshold = model->confidenceLevel / 100.0;
+
+	switch( model->decoder ) {
+		case DECODER_SSD:
+			DETECT_DecodeSSD( detections, model->output[0], model->output[1], model->output[2], model->output[3], model->decoderBoxes, threshold, model->classThreshold, model->numberOfLabels );
+			break;
+		case DECODER_SSD_ANCHORS:
+			DETECT_DecodeAnchors( detections, &model->decoderTensor[0], &model->decoderTensor[1], model->anchors, model->decoderBoxes, model->decoderClasses, threshold, model->classThreshold );
+			break;
+		case DECODER_YOLO:
+			DETECT_DecodeYOLO( detections, &model->decoderTensor[0], model->decoderBoxes, model->decoderClasses, threshold, model->classThreshold );
+			break;
+	}
+	DETECT_NMS( detections, model->iouThreshold, model->maxDetections, 0 );
+	//Boxes in stream pixels
+	DETECT_Map( detections, model->cropX, model->cropY, model->cropW, model->cropH );
+
+	//Tile detections are reported by MODEL_TileMerge
+	if( model->tile >= 0 && model->tiles ) {
+		DETECT_Context* cache = model->tiles[model->tile].cache;
+		cache->count = 0;
+		DETECT_Append( cache, detections );
+		return;
+	}
+	MODEL_DetectionItems( model, detections, list, tagged );
+}
+
+void
+MODEL_TileMerge( MODEL_Instance* model, cJSON* list, int tagged ) {
+	if( !model->merged )
+		return;
+	model->merged->count = 0;
+	size_t t;
+	for( t = 0; t < model->numTiles; t++ )
+		DETECT_Append( model->merged, model->tiles[t].cache );
+	//Objects on a tile border are found in both tiles
+	DETECT_NMS( model->merged, model->iouThreshold, model->maxDetections, 0 );
+	MODEL_DetectionItems( model, model->merged, list, tagged );
+}
+
+void
+MODEL_Decode( MODEL_Instance* model, cJSON* payload, cJSON* list, int tagged ) {
+	unsigned int i;
+	size_t o;
+	for( i = 0; i < model->batched; i++ ) {
+		MODEL_Slot* slot = &model->slots[i];
+		for( o = 0; o < model->numOutputs; o++ ) {
+			model->output[o] = (uint8_t*)model->outputAddr[o] + i * (model->outputSize[o] / model->batch);
+			model->decoderTensor[o].data = model->output[o];
+		}
+		model->cropX = slot->cropX;
+		model->cropY = slot->cropY;
+		model->cropW = slot->cropW;
+		model->cropH = slot->cropH;
+		model->tile = slot->tile;
+
+		cJSON* last = list->child;
+		while( last && last->next )
+			last = last->next;
+		if( model->decoder == DECODER_CLASSIFICATION )
+			MODEL_Classification( model, list, tagged );
+		else if( model->decoder == DECODER_SEGMENTATION )
+			MODEL_Segmentation( model, payload, list, tagged );
+		else
+			MODEL_Detection( model, list, tagged );
+		if( !slot->hasBox && model->batch == 1 )
+			continue;
+
+		//Items from a crop get the gate box. Items from batched frames get the frame time
+		cJSON* item;
+		for( item = last ? last->next : list->child; item; item = item->next ) {
+			if( slot->hasBox && !cJSON_GetObjectItem( item, "x" ) ) {
+				cJSON_AddNumberToObject( item,"x", slot->box[0] );
+				cJSON_AddNumberToObject( item,"y", slot->box[1] );
+				cJSON_AddNumberToObject( item,"w", slot->box[2] );
+				cJSON_AddNumberToObject( item,"h", slot->box[3] );
+			}
+			if( model->batch > 1 )
+				cJSON_AddNumberToObject( item,"timestamp", slot->timestamp );
+		}
+	}
+}
+
+cJSON*
+MODEL_Status( MODEL_Instance* model ) {
+	cJSON* status = cJSON_CreateObject();
+	cJSON_AddStringToObject( status,"architecture", model->architecture );
+	cJSON_AddNumberToObject( status,"loadTime", model->loadTime );
+	cJSON* load = cJSON_CreateObject();
+	cJSON_AddStringToObject( load,"cache", model->cache ? model->cache : "off" );
+	cJSON_AddNumberToObject( load,"hash", model->hashTime );
+	cJSON_AddNumberToObject( load,"connect", model->connectTime );
+	cJSON_AddNumberToObject( load,"compile", model->compileTime );
+	cJSON_AddItemToObject( status,"load", load );
+	cJSON_AddStringToObject( status,"tensors", TENSOR_PathName( model->tensorPath ) );
+	cJSON_AddStringToObject( status,"decoder", MODEL_String( model, "decoder", "classification" ) );
+	cJSON_AddNumberToObject( status,"labels", model->numberOfLabels );
+	cJSON_AddStringToObject( status,"labelsSource", model->labelsSource ? model->labelsSource : "settings" );
+	cJSON_AddNumberToObject( status,"inputs", model->numInputs );
+	cJSON_AddNumberToObject( status,"outputs", model->numOutputs );
+	cJSON_AddNumberToObject( status,"width", model->width );
+	cJSON_AddNumberToObject( status,"height", model->height );
+	cJSON_AddStringToObject( status,"geometry", model->geometry );
+	cJSON_AddNumberToObject( status,"every", model->every );
+	cJSON_AddStringToObject( status,"input", model->inputOwner->name );
+	if( model->clip > 1 ) {
+		cJSON_AddNumberToObject( status,"clip", model->clip );
+		cJSON_AddNumberToObject( status,"clipFrames", model->clipFrames );
+	}
+	if( model->inputOwner == model )
+		cJSON_AddItemToObject( status,"preprocess", PREPROCESS_Status( &model->preprocess ) );
+	if( model->gate ) {
+		cJSON_AddStringToObject( status,"gate", model->gate->name );
+		cJSON_AddBoolToObject( status,"crops", model->crops );
+	}
+	cJSON_AddNumberToObject( status,"runs", model->runs );
+	if( model->numTiles ) {
+		cJSON_AddNumberToObject( status,"tiles", model->numTiles );
+		cJSON_AddNumberToObject( status,"tilesRun", model->tilesRun );
+		cJSON_AddNumberToObject( status,"tilesSkipped", model->tilesSkipped );
+	}
+	if( model->batch > 1 ) {
+		cJSON_AddNumberToObject( status,"batch", model->batch );
+		cJSON_AddNumberToObject( status,"items", model->items );
+		//Share of batch slots holding an item, and items per second of inference time
+		cJSON_AddNumberToObject( status,"fill", model->runs ? (int)(model->items * 100 / (model->runs * model->batch)) : 0 );
+		cJSON_AddNumberToObject( status,"itemsPerSecond", model->totalDuration ? (int)(model->items * 1000 / model->totalDuration) : 0 );
+	}
+	cJSON_AddNumberToObject( status,"latency", model->runs ? (double)model->totalDuration / model->runs : 0 );
+	return status;
+}
+
+void
+MODEL_Close( MODEL_Instance* model ) {
+	if( !model )
+		return;
+
+	if( model->infReq )
+		larodDestroyInferenceRequest(&model->infReq);
+	if( model->inputTensors )
+		larodDestroyTensors(&model->inputTensors, model->numInputs);
+	if( model->outputTensors )
+		larodDestroyTensors(&model->outputTensors, model->numOutputs);
+
+	if( model->model )
+		larodDestroyModel(&model->model);
+
+    if (model->conn)
+        larodDisconnect(&model->conn, NULL);
+
+    if (model->modelFd >= 0)
+        close(model->modelFd);
+
+    PREPROCESS_Close(&model->preprocess);
+    TENSOR_Free(model->inputAddr, model->inputSize, model->inputFd);
+    TENSOR_Free(model->ring, model->ringSize, model->ringFd);
+    for (size_t o = 0; o < MODEL_MAX_OUTPUTS; o++) {
+        TENSOR_Free(model->outputAddr[o], model->outputSize[o], model->outputFd[o]);
+    }
+
+	LABELS_Free( model->labelTable );
+	free( model->topResults );
+	free( model->classThreshold );
+	free( model->anchors );
+	MODEL_GateLabels_Free( model );
+	DETECT_Free( model->detections );
+	SEGMENT_Free( model->segmentation );
+	free( model->slots );
+	MODEL_TileFree( model );
+	METADATA_Close( model->metadata );
+	free( model );
+}
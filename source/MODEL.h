@@ -0,0 +1,230 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  MODEL holds everything needed to run one TFLITE model: the larod
+ *  connection, tensors, preprocessing geometry and output decoder.
+ *  The engine (TFLITE) owns the frame source and runs the models.
+ *------------------------------------------------------------------*/
+
+#ifndef _MODEL_H_
+#define _MODEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "larod.h"
+#include "cJSON.h"
+#include "LABELS.h"
+#include "CLASSIFY.h"
+#include "DETECT.h"
+#include "SEGMENT.h"
+#include "PREPROCESS.h"
+#include "METADATA.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define MODEL_MAX_OUTPUTS	4
+
+// Output decoders selected by "decoder" in model.json
+#define DECODER_CLASSIFICATION	0	// One output with uint8 label scores
+#define DECODER_SSD				1	// TFLite_Detection_PostProcess: boxes, classes, scores, count
+#define DECODER_SSD_ANCHORS		2	// Raw SSD: box encodings and class scores. Anchors in model/anchors.txt
+#define DECODER_YOLO			3	// One output [N][5 + classes]
+#define DECODER_SEGMENTATION	4	// One output [H][W][classes] logits or [H][W] class map
+
+#define MODEL_TILE_GRID		8	//Motion signature cells per tile side
+
+//One region of the stream in tiling mode
+typedef struct MODEL_Tile {
+	unsigned int			x, y, w, h;		//Stream region
+	uint8_t					signature[MODEL_TILE_GRID * MODEL_TILE_GRID];	//Mean luma per cell when last processed
+	bool					valid;			//Signature set
+	bool					active;			//Processed in this pass
+	DETECT_Context*			cache;			//Detections from the last time the tile was processed, in stream pixels
+	ArgbScratch_t			scratch;		//Conversion buffers of the tile job
+} MODEL_Tile;
+
+//One item of a batch
+typedef struct MODEL_Slot {
+	double					timestamp;		//Frame time of the item
+	int						tile;			//Tile index, -1 if not tiling
+	unsigned int			cropX, cropY, cropW, cropH;	//Stream region scaled into the slot
+	int						box[4];			//Gate box x, y, w, h for crops
+	bool					hasBox;
+} MODEL_Slot;
+
+typedef struct MODEL_Instance {
+	char					name[64];
+	cJSON*					settings;		//This model's settings. Missing keys are taken from defaults
+	cJSON*					defaults;
+	char					modelFilePath[128];
+	char					labelsFilePath[128];
+	char					anchorsFilePath[128];
+	const char*				architecture;
+	int						chip;			//larod chip the model is loaded on
+	unsigned int			loadTime;		//ms to load the model on the chip
+	char					hash[17];		//Content hash of the model file. Set by MODEL_Hash
+	METADATA_File*			metadata;		//Shapes, quantization and labels read from the model file. 0 if not readable
+
+	//Load time breakdown in ms. "modelCache" reuses a model larod still holds from the last run
+	bool					useCache;
+	bool					pruneCache;		//Delete cached versions with another hash. Not while one runs
+	char					cacheName[128];	//package:name:hash
+	const char*				cache;			//"hit", "miss" or "off"
+	unsigned int			hashTime;
+	unsigned int			connectTime;
+	unsigned int			compileTime;	//larodLoadModel, or the cache lookup on a hit
+
+	//Preprocessing geometry
+	unsigned int			width;
+	unsigned int			height;
+	const char*				geometry;		//"model" if read from the input shape, "settings" otherwise
+	unsigned int			cropX, cropY, cropW, cropH;	//Stream region scaled to the model input
+	struct MODEL_Instance*	inputOwner;		//Model whose input buffer this model reads. Itself if not shared
+	unsigned long			preprocessed;	//Frame tick the input buffer was last converted for
+	unsigned int			preprocessedSequence;	//VDO frame the input buffer holds, with its capture time
+	uint64_t				preprocessedTimestamp;
+	PREPROCESS_Job			preprocess;		//Writes the input tensor. Set up by the engine for input owners
+
+	//larod
+	larodConnection*		conn;
+	larodModel*				model;
+	larodTensor**			inputTensors;
+	size_t					numInputs;
+	larodTensor**			outputTensors;
+	size_t					numOutputs;
+	larodInferenceRequest*	infReq;
+	int						modelFd;
+	int						inputFd;
+	void*					inputAddr;
+	size_t					inputSize;
+	size_t					itemSize;		//Input bytes per batch item
+	int						tensorPath;		//TENSOR_MEMFD or TENSOR_TMPFILE
+	bool					rewind;			//Output file positions are rewound before each run
+	int						outputFd[MODEL_MAX_OUTPUTS];
+	void*					outputAddr[MODEL_MAX_OUTPUTS];
+	size_t					outputSize[MODEL_MAX_OUTPUTS];
+	larodTensorDataType		outputType[MODEL_MAX_OUTPUTS];
+	void*					output[MODEL_MAX_OUTPUTS];	//Outputs of the batch item being decoded
+
+	//Batching. Input tensors with a batch dimension > 1 are filled one slot at a time
+	//and run when full, or padded when the first item is older than batchTimeout
+	unsigned int			batch;
+	unsigned int			queued;			//Slots filled for the next run
+	unsigned int			batched;		//Slots filled in the last run
+	MODEL_Slot*				slots;
+	unsigned int			batchTimeout;	//ms
+	unsigned long			items;			//Number of batch items run
+
+	//Output decoding
+	int						decoder;
+	cJSON*					labels;			//Label list in settings (not owned). 0 if read from a file
+	const char*				labelsSource;	//"settings", "model" (embedded in the metadata) or "file"
+	LABELS_Table*			labelTable;
+	size_t					numberOfLabels;
+	double					confidenceLevel;
+	uint64_t				scoreThreshold;	//confidenceLevel as a raw score key of the classification output
+	size_t					topK;			//Max number of labels reported per inference. 0 = all labels above confidence
+	double					iouThreshold;
+	size_t					maxDetections;
+	float*					classThreshold;	//Per class score threshold 0-1
+	CLASSIFY_Item*			topResults;
+	float*					anchors;
+	size_t					numAnchors;
+	DETECT_Context*			detections;
+	DETECT_Tensor			decoderTensor[MODEL_MAX_OUTPUTS];
+	size_t					decoderBoxes;	//Boxes/anchors reported by the output tensor
+	size_t					decoderClasses;	//Classes decoded. Never more than the labels
+	SEGMENT_Mask*			segmentation;
+	bool					segmentationClassMap;	//Output is a class map instead of logits
+
+	//Scheduling
+	unsigned int			every;			//Run on every Nth inference tick
+	unsigned int			duration;		//Last inference time in ms
+	unsigned long			runs;			//Number of inferences
+	unsigned long			totalDuration;	//Sum of inference time in ms
+
+	//Clip models take the last clip frames as one [1][T][H][W][C] input. Frames are converted
+	//once into a ring and the input is assembled from it
+	unsigned int			clip;			//T. 1 if not a clip model
+	void*					ring;
+	size_t					ringSize;
+	int						ringFd;
+	unsigned int			ringHead;		//Slot the next frame is converted into
+	unsigned int			ringFilled;		//Frames in the ring, up to clip
+	unsigned long			clipFrames;		//Frames converted into the ring
+
+	//Tiling. Overlapping model size tiles of the stream at tileScale, merged with cross-tile NMS
+	MODEL_Tile*				tiles;
+	size_t					numTiles;
+	int						tile;			//Tile queued next, -1 if not tiling
+	uint8_t*				tileInput;		//Converted tiles, numTiles * itemSize
+	DETECT_Context*			merged;
+	unsigned long			tilesRun;
+	unsigned long			tilesSkipped;
+	int						tileMotion;		//Luma change that marks a tile active. 0 runs every tile
+
+	//Cascade. A gated model only runs when its gate model reports a label in "gateLabels" (any if not set)
+	struct MODEL_Instance*	gate;
+	char**					gateLabels;		//Copies of "gateLabels". 0 fires on any label
+	unsigned int			numGateLabels;
+	bool					crops;			//Run on each detection box of the gate instead of the full frame
+	unsigned int			maxCrops;		//Max boxes per frame in crops mode
+} MODEL_Instance;
+
+cJSON*	MODEL_Setting( MODEL_Instance* model, const char* name );  //Model setting, falling back on defaults
+
+//Reads settings, model metadata and labels. Returns 0 and sets *status on failure
+MODEL_Instance*	MODEL_Open( const char* package, const char* name, cJSON* settings, cJSON* defaults, const char** status );
+//Loads the model on a larod chip, trying chip first if set. Safe to run in another thread.
+//With "modelCache" true a model with the same hash and chip that larod holds is reused
+bool			MODEL_Load( MODEL_Instance* model, const char* package, int chip, const char** status );
+void			MODEL_Close( MODEL_Instance* model );
+//Hashes the model file content into model->hash, once
+bool			MODEL_Hash( MODEL_Instance* model );
+//Loads the model on every chip and times runs inferences on a synthetic input.
+//Returns a table with "chip", "architecture", "available", "loadTime", "p50", "p99", "mean" and "itemsPerSecond"
+cJSON*			MODEL_Calibrate( MODEL_Instance* model, const char* package, unsigned int runs );
+//Chip with the best "p50", "p99" or "throughput" in a calibration table. 0 if none
+int				MODEL_Fastest( cJSON* table, const char* metric );
+
+//Sets the stream the preprocessing crops from and lays out tiles. Call before MODEL_Tensors
+void	MODEL_Stream( MODEL_Instance* model, unsigned int streamWidth, unsigned int streamHeight );
+//Allocates tensors. If share is set, its input buffer is used instead of a new one
+bool	MODEL_Tensors( MODEL_Instance* model, MODEL_Instance* share, const char** status );
+//Re-reads thresholds (and labels if replaced) after a settings update
+void	MODEL_Settings( MODEL_Instance* model );
+
+//Input address of the next free batch slot
+uint8_t*	MODEL_Input( MODEL_Instance* model );
+//Marks the slot filled with the current crop region. Returns true when the batch is full
+bool	MODEL_Queue( MODEL_Instance* model, double timestamp, const int* box );
+//Ring slot the next clip frame is converted into
+uint8_t*	MODEL_ClipFrame( MODEL_Instance* model );
+//Adds the converted frame to the clip and assembles the input tensor
+void	MODEL_ClipPush( MODEL_Instance* model );
+//True if a partial batch has waited longer than batchTimeout
+bool	MODEL_Expired( MODEL_Instance* model, double now );
+
+//Runs the queued items, padding a partial batch
+bool	MODEL_Run( MODEL_Instance* model );
+//Runs a full batch count times to pay one-time runtime costs before the first frame
+bool	MODEL_Warmup( MODEL_Instance* model, unsigned int count );
+//Marks the tile active if its luma changed more than tileMotion since it was last processed.
+//luma is the frame reduced by 2^shift
+bool	MODEL_TileMotion( MODEL_Instance* model, MODEL_Tile* tile, const uint8_t* luma, unsigned int stride, unsigned int shift );
+//Merges the detections of all tiles into list
+void	MODEL_TileMerge( MODEL_Instance* model, cJSON* list, int tagged );
+
+//True if a label reported by the gate model should trigger this model
+bool	MODEL_Fires( MODEL_Instance* model, const char* label );
+void	MODEL_Decode( MODEL_Instance* model, cJSON* payload, cJSON* list, int tagged );
+cJSON*	MODEL_Status( MODEL_Instance* model );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,483 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  The local backend does what a larod preprocessing job does, on
+ *  the CPU: it maps the frame fd and the output tensor fd itself and
+ *  never uses the mappings of the engine. VDO cycles a few buffers so
+ *  their mappings are kept. larod 1 has no preprocessing jobs and the
+ *  larod backend falls back on the CPU.
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "imgconverter.h"
+#include "PREPROCESS.h"
+#include "AUDIT.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+int
+PREPROCESS_Backend( const char* name ) {
+	if( name && strcmp( name, "larod" ) == 0 )
+		return PREPROCESS_LAROD;
+	if( name && strcmp( name, "local" ) == 0 )
+		return PREPROCESS_LOCAL;
+	return PREPROCESS_CPU;
+}
+
+const char*
+PREPROCESS_Name( int backend ) {
+	switch( backend ) {
+		case PREPROCESS_LAROD: return "larod";
+		case PREPROCESS_LOCAL: return "local";
+	}
+	return "cpu";
+}
+
+/*
+ * Specialized kernels. Stream and model sizes are constants, so strides fold and the
+ * column loop unrolls. Taps for the full frame region are computed once at open.
+ * Colors are BT.601 limited range in 8 bit fixed point, as libyuv NV12ToARGB.
+ */
+static inline __attribute__((always_inline)) uint8_t
+PREPROCESS_Clamp( int value ) {
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline __attribute__((always_inline)) void
+PREPROCESS_Pixel( int luma, int u, int v, uint8_t* rgb ) {
+	int y = (luma - 16) * 298 + 128;
+	rgb[0] = PREPROCESS_Clamp( (y + 409 * v) >> 8 );
+	rgb[1] = PREPROCESS_Clamp( (y - 100 * u - 208 * v) >> 8 );
+	rgb[2] = PREPROCESS_Clamp( (y + 516 * u) >> 8 );
+}
+
+static inline __attribute__((always_inline)) void
+PREPROCESS_Bilinear( const PREPROCESS_Taps* taps, const uint8_t* nv12, uint8_t* rgb, const unsigned int srcWidth, const unsigned int srcHeight, const unsigned int dstWidth, const unsigned int dstHeight ) {
+	const uint8_t* uvPlane = nv12 + srcWidth * srcHeight;
+	unsigned int x, y;
+	for( y = 0; y < dstHeight; y++ ) {
+		const uint8_t* top = nv12 + taps->y0[y] * srcWidth;
+		const uint8_t* bottom = top + srcWidth;
+		const uint8_t* uvRow = uvPlane + taps->uvY[y] * srcWidth;
+		unsigned int fy = taps->fy[y];
+#pragma GCC unroll 8
+		for( x = 0; x < dstWidth; x++ ) {
+			unsigned int x0 = taps->x0[x], fx = taps->fx[x];
+			unsigned int upper = top[x0] * (256 - fx) + top[x0 + 1] * fx;
+			unsigned int lower = bottom[x0] * (256 - fx) + bottom[x0 + 1] * fx;
+			const uint8_t* uv = uvRow + taps->uvX[x];
+			PREPROCESS_Pixel( (upper * (256 - fy) + lower * fy + 32768) >> 16, uv[0] - 128, uv[1] - 128, rgb );
+			rgb += 3;
+		}
+	}
+}
+
+#define PREPROCESS_KERNEL( SW, SH, DW, DH ) \
+static void \
+PREPROCESS_Kernel_##SW##x##SH##_##DW##x##DH( const PREPROCESS_Taps* taps, const uint8_t* nv12, uint8_t* rgb ) { \
+	PREPROCESS_Bilinear( taps, nv12, rgb, SW, SH, DW, DH ); \
+}
+
+//The smallest VDO resolutions that fit 224 and 320 models, 16:9 and 4:3
+PREPROCESS_KERNEL( 480, 270, 224, 224 )
+PREPROCESS_KERNEL( 320, 240, 224, 224 )
+PREPROCESS_KERNEL( 640, 360, 320, 320 )
+PREPROCESS_KERNEL( 480, 360, 320, 320 )
+
+static const PREPROCESS_Kernel PREPROCESS_Kernels[] = {
+	{ 480, 270, 224, 224, PREPROCESS_Kernel_480x270_224x224, "480x270-224x224" },
+	{ 320, 240, 224, 224, PREPROCESS_Kernel_320x240_224x224, "320x240-224x224" },
+	{ 640, 360, 320, 320, PREPROCESS_Kernel_640x360_320x320, "640x360-320x320" },
+	{ 480, 360, 320, 320, PREPROCESS_Kernel_480x360_320x320, "480x360-320x320" }
+};
+
+//Source position of each output sample of one axis. Returns the left or top sample and its weight
+static void
+PREPROCESS_Axis( unsigned int start, unsigned int length, unsigned int size, unsigned int samples, uint32_t* first, uint16_t* weight, uint32_t* chroma ) {
+	unsigned int i;
+	for( i = 0; i < samples; i++ ) {
+		float position = start + (i + 0.5f) * length / samples - 0.5f;
+		if( position < 0 )
+			position = 0;
+		if( position > size - 1 )
+			position = size - 1;
+		unsigned int left = (unsigned int)position;
+		if( left > size - 2 )
+			left = size - 2;
+		float fraction = position - left;
+		first[i] = left;
+		weight[i] = (uint16_t)(fraction * 256 + 0.5f);
+		//Chroma is subsampled 2x2. The UV pair of the nearest luma sample
+		chroma[i] = ((unsigned int)(position + 0.5f) >> 1);
+	}
+}
+
+static void
+PREPROCESS_Taps_Free( PREPROCESS_Taps* taps ) {
+	free( taps->x0 );
+	free( taps->fx );
+	free( taps->uvX );
+	free( taps->y0 );
+	free( taps->fy );
+	free( taps->uvY );
+	memset( taps, 0, sizeof(PREPROCESS_Taps) );
+}
+
+static bool
+PREPROCESS_Specialize( PREPROCESS_Job* job ) {
+	size_t k;
+	for( k = 0; k < sizeof(PREPROCESS_Kernels) / sizeof(PREPROCESS_Kernel); k++ ) {
+		const PREPROCESS_Kernel* kernel = &PREPROCESS_Kernels[k];
+		if( kernel->srcWidth != job->srcWidth || kernel->srcHeight != job->srcHeight || kernel->dstWidth != job->dstWidth || kernel->dstHeight != job->dstHeight )
+			continue;
+		PREPROCESS_Taps* taps = &job->taps;
+		taps->x0 = malloc( job->dstWidth * sizeof(uint32_t) );
+		taps->fx = malloc( job->dstWidth * sizeof(uint16_t) );
+		taps->uvX = malloc( job->dstWidth * sizeof(uint32_t) );
+		taps->y0 = malloc( job->dstHeight * sizeof(uint32_t) );
+		taps->fy = malloc( job->dstHeight * sizeof(uint16_t) );
+		taps->uvY = malloc( job->dstHeight * sizeof(uint32_t) );
+		if( !taps->x0 || !taps->fx || !taps->uvX || !taps->y0 || !taps->fy || !taps->uvY ) {
+			PREPROCESS_Taps_Free( taps );
+			return false;
+		}
+		PREPROCESS_Axis( job->roi[0], job->roi[2], job->srcWidth, job->dstWidth, taps->x0, taps->fx, taps->uvX );
+		PREPROCESS_Axis( job->roi[1], job->roi[3], job->srcHeight, job->dstHeight, taps->y0, taps->fy, taps->uvY );
+		//UV pairs are two bytes
+		unsigned int x;
+		for( x = 0; x < job->dstWidth; x++ )
+			taps->uvX[x] *= 2;
+		job->kernel = kernel;
+		LOG_TRACE( "%s: %s\n", __func__, kernel->name );
+		return true;
+	}
+	return false;
+}
+
+static bool
+PREPROCESS_Convert_Region( PREPROCESS_Job* job, const uint8_t* nv12, const unsigned int* roi, uint8_t* output ) {
+	if( job->kernel && roi == job->roi ) {
+		job->kernel->convert( &job->taps, nv12, output );
+		return true;
+	}
+	return convertRegionScaleU8yuvToRGB( nv12, job->srcWidth, job->srcHeight, roi[0], roi[1], roi[2], roi[3], output, job->dstWidth, job->dstHeight, &job->scratch );
+}
+
+bool
+PREPROCESS_Open( PREPROCESS_Job* job, int backend, unsigned int srcWidth, unsigned int srcHeight, unsigned int dstWidth, unsigned int dstHeight, int outputFd, uint8_t* output, size_t outputSize ) {
+	memset( job, 0, sizeof(PREPROCESS_Job) );
+	job->backend = PREPROCESS_CPU;
+	job->srcWidth = srcWidth;
+	job->srcHeight = srcHeight;
+	job->dstWidth = dstWidth;
+	job->dstHeight = dstHeight;
+	job->output = output;
+	job->outputFd = outputFd;
+	job->outputSize = outputSize;
+	getCropRegion( srcWidth, srcHeight, dstWidth, dstHeight, &job->roi[0], &job->roi[1], &job->roi[2], &job->roi[3] );
+	PREPROCESS_Specialize( job );
+	//Any region fits, so the frame path never allocates
+	if( !reserveArgbScratch( &job->scratch, (size_t)srcWidth * srcHeight, (size_t)dstWidth * dstHeight ) )
+		LOG_WARN( "%s: Unable to allocate conversion buffers\n", __func__ );
+
+	if( backend == PREPROCESS_LAROD ) {
+		LOG_WARN( "%s: larod 1 has no preprocessing jobs. Using the CPU\n", __func__ );
+		return false;
+	}
+	if( backend == PREPROCESS_LOCAL ) {
+		void* addr = outputFd >= 0 ? mmap( NULL, outputSize, PROT_READ | PROT_WRITE, MAP_SHARED, outputFd, 0 ) : MAP_FAILED;
+		if( addr == MAP_FAILED ) {
+			LOG_WARN( "%s: Unable to map the output tensor: %s. Using the CPU\n", __func__, strerror(errno) );
+			return false;
+		}
+		job->outputMap = addr;
+		job->backend = PREPROCESS_LOCAL;
+	}
+	LOG_TRACE( "%s: %s %ux%u -> %ux%u\n", __func__, PREPROCESS_Name( job->backend ), srcWidth, srcHeight, dstWidth, dstHeight );
+	return true;
+}
+
+//Mapping of the frame buffer, reused while VDO cycles the same buffers
+static const uint8_t*
+PREPROCESS_Map_Frame( PREPROCESS_Job* job, int fd, int64_t offset ) {
+	size_t i;
+	for( i = 0; i < job->numMaps; i++ )
+		if( job->maps[i].fd == fd && job->maps[i].offset == offset )
+			return job->maps[i].addr + job->maps[i].delta;
+
+	long page = sysconf( _SC_PAGESIZE );
+	int64_t aligned = offset & ~(int64_t)(page - 1);
+	size_t delta = offset - aligned;
+	size_t size = delta + (size_t)job->srcWidth * job->srcHeight * 3 / 2;
+	void* addr = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, aligned );
+	if( addr == MAP_FAILED ) {
+		LOG_WARN( "%s: Unable to map frame buffer %d: %s\n", __func__, fd, strerror(errno) );
+		return 0;
+	}
+
+	PREPROCESS_Map* map;
+	if( job->numMaps < PREPROCESS_MAPS ) {
+		map = &job->maps[job->numMaps++];
+	} else {
+		map = &job->maps[job->nextMap];
+		job->nextMap = (job->nextMap + 1) % PREPROCESS_MAPS;
+		munmap( map->addr, map->size );
+	}
+	map->fd = fd;
+	map->offset = offset;
+	map->addr = addr;
+	map->size = size;
+	map->delta = delta;
+	return map->addr + map->delta;
+}
+
+/*
+ * Tensors recently produced for a frame, keyed by frame, region and output size.
+ * The output is always uint8 RGB. Only used from the inference thread
+ */
+typedef struct PREPROCESS_Entry {
+	unsigned int	sequence;
+	uint64_t		timestamp;
+	unsigned int	roi[4];
+	unsigned int	dstWidth, dstHeight;
+	uint8_t*		data;
+	unsigned long	used;		//LRU clock
+} PREPROCESS_Entry;
+
+static PREPROCESS_Entry cacheEntries[PREPROCESS_CACHE_MAX];
+static unsigned int cacheSize = 0;
+static size_t cacheEntrySize = 0;
+static unsigned long cacheClock = 0;
+static unsigned long cacheHits = 0;
+static unsigned long cacheMisses = 0;
+static unsigned long long cacheSaved = 0;
+
+bool
+PREPROCESS_Cache_Open( unsigned int entries, size_t maxSize ) {
+	PREPROCESS_Cache_Close();
+	if( entries > PREPROCESS_CACHE_MAX )
+		entries = PREPROCESS_CACHE_MAX;
+	unsigned int i;
+	for( i = 0; i < entries; i++ ) {
+		cacheEntries[i].data = malloc( maxSize );
+		if( !cacheEntries[i].data ) {
+			LOG_WARN( "%s: Memory allocation error\n", __func__ );
+			PREPROCESS_Cache_Close();
+			return false;
+		}
+		cacheEntries[i].dstWidth = 0;
+	}
+	cacheSize = entries;
+	cacheEntrySize = maxSize;
+	return true;
+}
+
+void
+PREPROCESS_Cache_Close() {
+	unsigned int i;
+	for( i = 0; i < PREPROCESS_CACHE_MAX; i++ ) {
+		free( cacheEntries[i].data );
+		cacheEntries[i].data = 0;
+	}
+	cacheSize = 0;
+}
+
+void
+PREPROCESS_Cache_Reused( size_t bytes ) {
+	cacheHits++;
+	cacheSaved += bytes;
+}
+
+static PREPROCESS_Entry*
+PREPROCESS_Cache_Find( const PREPROCESS_Job* job, const PREPROCESS_Frame* frame, const unsigned int* roi ) {
+	unsigned int i;
+	for( i = 0; i < cacheSize; i++ ) {
+		PREPROCESS_Entry* entry = &cacheEntries[i];
+		if( entry->sequence == frame->sequence && entry->timestamp == frame->timestamp &&
+			entry->dstWidth == job->dstWidth && entry->dstHeight == job->dstHeight &&
+			memcmp( entry->roi, roi, sizeof(entry->roi) ) == 0 )
+			return entry;
+	}
+	return 0;
+}
+
+static void
+PREPROCESS_Cache_Put( const PREPROCESS_Job* job, const PREPROCESS_Frame* frame, const unsigned int* roi, const uint8_t* output, size_t size ) {
+	PREPROCESS_Entry* entry = &cacheEntries[0];
+	unsigned int i;
+	for( i = 1; i < cacheSize; i++ )
+		if( cacheEntries[i].used < entry->used )
+			entry = &cacheEntries[i];
+	memcpy( entry->data, output, size );
+	entry->sequence = frame->sequence;
+	entry->timestamp = frame->timestamp;
+	memcpy( entry->roi, roi, sizeof(entry->roi) );
+	entry->dstWidth = job->dstWidth;
+	entry->dstHeight = job->dstHeight;
+	entry->used = ++cacheClock;
+}
+
+cJSON*
+PREPROCESS_Cache_Status() {
+	cJSON* status = cJSON_CreateObject();
+	cJSON_AddNumberToObject( status, "entries", cacheSize );
+	cJSON_AddNumberToObject( status, "hits", cacheHits );
+	cJSON_AddNumberToObject( status, "misses", cacheMisses );
+	cJSON_AddNumberToObject( status, "hitRate", cacheHits + cacheMisses ? (int)(cacheHits * 1000 / (cacheHits + cacheMisses)) / 10.0 : 0 );
+	cJSON_AddNumberToObject( status, "bytesSaved", (double)cacheSaved );
+	return status;
+}
+
+static bool
+PREPROCESS_Produce( PREPROCESS_Job* job, const PREPROCESS_Frame* frame, const unsigned int* roi, size_t outputOffset ) {
+	if( job->backend == PREPROCESS_LOCAL && frame->fd >= 0 ) {
+		const uint8_t* nv12 = PREPROCESS_Map_Frame( job, frame->fd, frame->offset );
+		if( nv12 && PREPROCESS_Convert_Region( job, nv12, roi, job->outputMap + outputOffset ) )
+			return true;
+	}
+	if( job->backend != PREPROCESS_CPU )
+		job->fallbacks++;
+
+	if( !frame->data || !job->output )
+		return false;
+	//Regions at least twice the output size are scaled from a pyramid level. Not the specialized kernels
+	if( frame->pyramid && !(job->kernel && roi == job->roi) ) {
+		unsigned int level = PYRAMID_Select( frame->pyramid, roi, job->dstWidth, job->dstHeight );
+		PYRAMID_View view;
+		if( level > 0 && PYRAMID_Region( frame->pyramid, level, roi, &view ) ) {
+			job->pyramidRuns++;
+			return convertRegionScaleU8yuvToRGB( view.data, view.width, view.height, view.x, view.y, view.w, view.h, job->output + outputOffset, job->dstWidth, job->dstHeight, &job->scratch );
+		}
+	}
+	return PREPROCESS_Convert_Region( job, frame->data, roi, job->output + outputOffset );
+}
+
+bool
+PREPROCESS_Run( PREPROCESS_Job* job, const PREPROCESS_Frame* frame, const unsigned int* roi, size_t outputOffset ) {
+	if( !roi )
+		roi = job->roi;
+	job->runs++;
+
+	size_t size = (size_t)job->dstWidth * job->dstHeight * 3;
+	bool cached = cacheSize && frame->sequence && job->output && size <= cacheEntrySize;
+	if( cached ) {
+		PREPROCESS_Entry* entry = PREPROCESS_Cache_Find( job, frame, roi );
+		if( entry ) {
+			memcpy( job->output + outputOffset, entry->data, size );
+			entry->used = ++cacheClock;
+			job->cacheHits++;
+			PREPROCESS_Cache_Reused( size );
+			return true;
+		}
+		cacheMisses++;
+	}
+	if( !PREPROCESS_Produce( job, frame, roi, outputOffset ) )
+		return false;
+	if( cached )
+		PREPROCESS_Cache_Put( job, frame, roi, job->output + outputOffset, size );
+	return true;
+}
+
+void
+PREPROCESS_Close( PREPROCESS_Job* job ) {
+	size_t i;
+	for( i = 0; i < job->numMaps; i++ )
+		munmap( job->maps[i].addr, job->maps[i].size );
+	job->numMaps = 0;
+	if( job->outputMap )
+		munmap( job->outputMap, job->outputSize );
+	job->outputMap = 0;
+	job->backend = PREPROCESS_CPU;
+	PREPROCESS_Taps_Free( &job->taps );
+	job->kernel = 0;
+	freeArgbScratch( &job->scratch );
+}
+
+static double
+PREPROCESS_Now() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+bool
+PREPROCESS_Benchmark( PREPROCESS_Job* job, unsigned int runs ) {
+	size_t frameSize = (size_t)job->srcWidth * job->srcHeight * 3 / 2;
+	size_t outputSize = (size_t)job->dstWidth * job->dstHeight * 3;
+	uint8_t* frame = malloc( frameSize );
+	uint8_t* output = malloc( outputSize );
+	uint8_t* kernelOutput = job->kernel ? malloc( outputSize ) : 0;
+	if( !frame || !output || (job->kernel && !kernelOutput) || runs == 0 ) {
+		free( frame );
+		free( output );
+		free( kernelOutput );
+		return false;
+	}
+	//Noise, so no path gets a shortcut
+	uint32_t seed = 12345;
+	size_t i;
+	for( i = 0; i < frameSize; i++ ) {
+		seed = seed * 1103515245 + 12345;
+		frame[i] = seed >> 24;
+	}
+
+	unsigned int run;
+	double start = PREPROCESS_Now();
+	for( run = 0; run < runs; run++ )
+		convertRegionScaleU8yuvToRGB( frame, job->srcWidth, job->srcHeight, job->roi[0], job->roi[1], job->roi[2], job->roi[3], output, job->dstWidth, job->dstHeight, &job->scratch );
+	job->genericTime = (PREPROCESS_Now() - start) / runs;
+	job->kernelTime = 0;
+	job->maxDiff = 0;
+	job->meanDiff = 0;
+	if( job->kernel ) {
+		start = PREPROCESS_Now();
+		for( run = 0; run < runs; run++ )
+			job->kernel->convert( &job->taps, frame, kernelOutput );
+		job->kernelTime = (PREPROCESS_Now() - start) / runs;
+		//A faster kernel is only worth it if the model sees the same input
+		uint64_t sum = 0;
+		for( i = 0; i < outputSize; i++ ) {
+			unsigned int diff = abs( (int)output[i] - (int)kernelOutput[i] );
+			sum += diff;
+			if( diff > job->maxDiff )
+				job->maxDiff = diff;
+		}
+		job->meanDiff = (double)sum / outputSize;
+	}
+	LOG( "%s: %ux%u to %ux%u generic %.2f ms, %s %.2f ms, max diff %u, mean diff %.3f\n", __func__, job->srcWidth, job->srcHeight, job->dstWidth, job->dstHeight, job->genericTime, job->kernel ? job->kernel->name : "no kernel", job->kernelTime, job->maxDiff, job->meanDiff );
+	free( frame );
+	free( output );
+	free( kernelOutput );
+	return true;
+}
+
+cJSON*
+PREPROCESS_Status( const PREPROCESS_Job* job ) {
+	cJSON* status = cJSON_CreateObject();
+	cJSON_AddStringToObject( status, "backend", PREPROCESS_Name( job->backend ) );
+	cJSON_AddNumberToObject( status, "runs", job->runs );
+	cJSON_AddNumberToObject( status, "fallbacks", job->fallbacks );
+	cJSON_AddNumberToObject( status, "pyramidRuns", job->pyramidRuns );
+	cJSON_AddNumberToObject( status, "cacheHits", job->cacheHits );
+	cJSON_AddNumberToObject( status, "mappedFrames", job->numMaps );
+	cJSON_AddStringToObject( status, "kernel", job->kernel ? job->kernel->name : "generic" );
+	if( job->genericTime > 0 ) {
+		cJSON_AddNumberToObject( status, "genericTime", (int)(job->genericTime * 100) / 100.0 );
+		if( job->kernel ) {
+			cJSON_AddNumberToObject( status, "kernelTime", (int)(job->kernelTime * 100) / 100.0 );
+			cJSON_AddNumberToObject( status, "maxDiff", job->maxDiff );
+			cJSON_AddNumberToObject( status, "meanDiff", (int)(job->meanDiff * 1000) / 1000.0 );
+		}
+	}
+	return status;
+}
@@ -0,0 +1,121 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  PREPROCESS crops, scales and converts an NV12 frame region into a
+ *  model input tensor. Job backends take the frame as a buffer fd and
+ *  write the tensor fd larod runs the model on, so the engine never
+ *  touches pixels. The CPU path is the fallback.
+ *------------------------------------------------------------------*/
+
+#ifndef _PREPROCESS_H_
+#define _PREPROCESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON.h"
+#include "PYRAMID.h"
+#include "imgconverter.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define PREPROCESS_CPU		0	//libyuv on the frame mapping of the engine
+#define PREPROCESS_LAROD	1	//larod preprocessing job on the frame fd
+#define PREPROCESS_LOCAL	2	//CPU stand-in for the larod job, for testing off the camera
+
+#define PREPROCESS_MAPS		8	//Frame buffers mapped by the local backend. VDO cycles a few buffers
+#define PREPROCESS_CACHE_MAX	16	//Most tensors kept by the tensor cache
+
+//The frame to preprocess. Job backends read fd at offset, the CPU reads data,
+//or a smaller level of pyramid if set
+typedef struct PREPROCESS_Frame {
+	int				fd;
+	int64_t			offset;
+	const uint8_t*	data;
+	PYRAMID_Pyramid*	pyramid;
+	unsigned int	sequence;	//VDO frame sequence number. 0 if unknown, then the frame is not cached
+	uint64_t		timestamp;	//Capture time. Tells frames apart if the stream restarts its sequence
+} PREPROCESS_Frame;
+
+typedef struct PREPROCESS_Map {
+	int				fd;
+	int64_t			offset;
+	uint8_t*		addr;		//Page aligned start of the mapping
+	size_t			size;
+	size_t			delta;		//offset - page aligned offset
+} PREPROCESS_Map;
+
+//Filter taps for a fixed region. Luma is bilinear in 8 bit fixed point, chroma the nearest sample
+typedef struct PREPROCESS_Taps {
+	uint32_t*		x0;			//Left luma column per output column
+	uint16_t*		fx;			//Weight of the right column, 0-256
+	uint32_t*		uvX;		//Chroma byte offset in the UV row
+	uint32_t*		y0;			//Top luma row per output row
+	uint16_t*		fy;
+	uint32_t*		uvY;		//Chroma row
+} PREPROCESS_Taps;
+
+typedef void (*PREPROCESS_Convert)( const PREPROCESS_Taps* taps, const uint8_t* nv12, uint8_t* rgb );
+
+//A kernel compiled for one stream and model geometry
+typedef struct PREPROCESS_Kernel {
+	unsigned int		srcWidth, srcHeight;
+	unsigned int		dstWidth, dstHeight;
+	PREPROCESS_Convert	convert;
+	const char*			name;
+} PREPROCESS_Kernel;
+
+typedef struct PREPROCESS_Job {
+	int				backend;
+	unsigned int	srcWidth, srcHeight;
+	unsigned int	dstWidth, dstHeight;
+	unsigned int	roi[4];		//Full frame region x, y, w, h
+	uint8_t*		output;		//Engine mapping of the output tensor, written by the CPU path
+	int				outputFd;
+	uint8_t*		outputMap;	//The local backend maps the output fd itself
+	size_t			outputSize;
+	PREPROCESS_Map	maps[PREPROCESS_MAPS];
+	size_t			numMaps;
+	size_t			nextMap;
+	unsigned long	runs;
+	unsigned long	fallbacks;	//Runs done on the CPU because the job failed
+	unsigned long	pyramidRuns;	//CPU runs scaled from a smaller pyramid level
+	unsigned long	cacheHits;		//Runs copied from the tensor cache
+	const PREPROCESS_Kernel*	kernel;	//Specialized kernel for the full frame region. 0 uses libyuv
+	PREPROCESS_Taps	taps;
+	ArgbScratch_t	scratch;	//libyuv work buffers, sized for the whole frame at open
+	double			genericTime;	//ms per frame measured by PREPROCESS_Benchmark
+	double			kernelTime;
+	unsigned int	maxDiff;		//Absolute difference of the kernel output from libyuv per channel value
+	double			meanDiff;
+} PREPROCESS_Job;
+
+int			PREPROCESS_Backend( const char* name );
+const char*	PREPROCESS_Name( int backend );
+
+//Sets up the job from a srcWidth x srcHeight stream into the dstWidth x dstHeight output tensor.
+//A kernel specialized for the geometry is selected here if there is one. Returns false if the backend is not available. The job is then set up for the CPU
+bool		PREPROCESS_Open( PREPROCESS_Job* job, int backend, unsigned int srcWidth, unsigned int srcHeight, unsigned int dstWidth, unsigned int dstHeight, int outputFd, uint8_t* output, size_t outputSize );
+//Converts the region roi (x, y, w, h), or the full frame region if 0, into the output at outputOffset.
+//A tensor cached for the same frame, region and size is copied instead
+bool		PREPROCESS_Run( PREPROCESS_Job* job, const PREPROCESS_Frame* frame, const unsigned int* roi, size_t outputOffset );
+void		PREPROCESS_Close( PREPROCESS_Job* job );
+//Times runs conversions of a synthetic frame with libyuv and with the specialized kernel and compares their outputs
+bool		PREPROCESS_Benchmark( PREPROCESS_Job* job, unsigned int runs );
+cJSON*		PREPROCESS_Status( const PREPROCESS_Job* job );
+
+//Keeps the last entries tensors of up to maxSize bytes. 0 entries disables the cache
+bool		PREPROCESS_Cache_Open( unsigned int entries, size_t maxSize );
+void		PREPROCESS_Cache_Close();
+//Counts a tensor the engine reused in place, without a copy, as a hit
+void		PREPROCESS_Cache_Reused( size_t bytes );
+//"entries", "hits", "misses", "hitRate" in % and "bytesSaved"
+cJSON*		PREPROCESS_Cache_Status();
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
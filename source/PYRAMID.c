@@ -0,0 +1,145 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include "PYRAMID.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+#define PYRAMID_MIN_SIZE	32
+
+bool
+PYRAMID_Open( PYRAMID_Pyramid* pyramid, unsigned int width, unsigned int height ) {
+	memset( pyramid, 0, sizeof(PYRAMID_Pyramid) );
+	pyramid->levels[0].width = width;
+	pyramid->levels[0].height = height;
+	pyramid->numLevels = 1;
+	while( pyramid->numLevels < PYRAMID_MAX_LEVELS ) {
+		const PYRAMID_Level* larger = &pyramid->levels[pyramid->numLevels - 1];
+		PYRAMID_Level* level = &pyramid->levels[pyramid->numLevels];
+		level->width = (larger->width / 2) & ~1u;
+		level->height = (larger->height / 2) & ~1u;
+		if( level->width < PYRAMID_MIN_SIZE || level->height < PYRAMID_MIN_SIZE )
+			break;
+		level->data = malloc( (size_t)level->width * level->height * 3 / 2 );
+		if( !level->data ) {
+			LOG_WARN( "%s: Memory allocation error\n", __func__ );
+			PYRAMID_Close( pyramid );
+			return false;
+		}
+		pyramid->numLevels++;
+	}
+	LOG_TRACE( "%s: %ux%u, %u levels\n", __func__, width, height, pyramid->numLevels );
+	return true;
+}
+
+void
+PYRAMID_Frame( PYRAMID_Pyramid* pyramid, const uint8_t* nv12, unsigned long sequence ) {
+	pyramid->levels[0].data = (uint8_t*)nv12;
+	pyramid->levels[0].sequence = sequence;
+	pyramid->sequence = sequence;
+}
+
+//2x2 box filter of rows pixels (or UV pairs with pair 2) from src into dst
+static void
+PYRAMID_Reduce( const uint8_t* src, unsigned int srcStride, uint8_t* dst, unsigned int dstStride, unsigned int columns, unsigned int rows, unsigned int pair ) {
+	unsigned int x, y, c;
+	for( y = 0; y < rows; y++ ) {
+		const uint8_t* a = src + (size_t)2 * y * srcStride;
+		const uint8_t* b = a + srcStride;
+		uint8_t* out = dst + (size_t)y * dstStride;
+		for( x = 0; x < columns; x++ )
+			for( c = 0; c < pair; c++ ) {
+				size_t i = (size_t)2 * x * pair + c;
+				out[x * pair + c] = (a[i] + a[i + pair] + b[i] + b[i + pair] + 2) >> 2;
+			}
+	}
+}
+
+const PYRAMID_Level*
+PYRAMID_Get( PYRAMID_Pyramid* pyramid, unsigned int index ) {
+	if( index >= pyramid->numLevels || !pyramid->levels[0].data )
+		return 0;
+	PYRAMID_Level* level = &pyramid->levels[index];
+	if( level->sequence == pyramid->sequence ) {
+		level->reused++;
+		return level;
+	}
+	const PYRAMID_Level* larger = PYRAMID_Get( pyramid, index - 1 );
+	//Luma, then the interleaved UV plane at half size
+	PYRAMID_Reduce( larger->data, larger->width, level->data, level->width, level->width, level->height, 1 );
+	PYRAMID_Reduce( larger->data + (size_t)larger->width * larger->height, larger->width,
+					level->data + (size_t)level->width * level->height, level->width, level->width / 2, level->height / 2, 2 );
+	level->sequence = pyramid->sequence;
+	level->built++;
+	return level;
+}
+
+unsigned int
+PYRAMID_Select( const PYRAMID_Pyramid* pyramid, const unsigned int* roi, unsigned int dstWidth, unsigned int dstHeight ) {
+	unsigned int level = 0;
+	while( level + 1 < pyramid->numLevels && (roi[2] >> (level + 1)) >= dstWidth && (roi[3] >> (level + 1)) >= dstHeight )
+		level++;
+	return level;
+}
+
+bool
+PYRAMID_Region( PYRAMID_Pyramid* pyramid, unsigned int index, const unsigned int* roi, PYRAMID_View* view ) {
+	const PYRAMID_Level* level = PYRAMID_Get( pyramid, index );
+	return level && PYRAMID_Crop( level, index, roi, view );
+}
+
+bool
+PYRAMID_Crop( const PYRAMID_Level* level, unsigned int index, const unsigned int* roi, PYRAMID_View* view ) {
+	view->data = level->data;
+	view->width = level->width;
+	view->height = level->height;
+	view->level = index;
+	//Even origin, so the chroma of the region starts on a sample
+	view->x = (roi[0] >> index) & ~1u;
+	view->y = (roi[1] >> index) & ~1u;
+	view->w = roi[2] >> index;
+	view->h = roi[3] >> index;
+	if( view->x >= level->width || view->y >= level->height )
+		return false;
+	if( view->w == 0 )
+		view->w = 1;
+	if( view->h == 0 )
+		view->h = 1;
+	if( view->x + view->w > level->width )
+		view->w = level->width - view->x;
+	if( view->y + view->h > level->height )
+		view->h = level->height - view->y;
+	return true;
+}
+
+void
+PYRAMID_Close( PYRAMID_Pyramid* pyramid ) {
+	unsigned int i;
+	for( i = 1; i < pyramid->numLevels; i++ )
+		free( pyramid->levels[i].data );
+	memset( pyramid, 0, sizeof(PYRAMID_Pyramid) );
+}
+
+cJSON*
+PYRAMID_Status( const PYRAMID_Pyramid* pyramid ) {
+	cJSON* list = cJSON_CreateArray();
+	unsigned int i;
+	for( i = 0; i < pyramid->numLevels; i++ ) {
+		const PYRAMID_Level* level = &pyramid->levels[i];
+		cJSON* item = cJSON_CreateObject();
+		cJSON_AddNumberToObject( item, "width", level->width );
+		cJSON_AddNumberToObject( item, "height", level->height );
+		cJSON_AddNumberToObject( item, "built", level->built );
+		cJSON_AddNumberToObject( item, "reused", level->reused );
+		cJSON_AddItemToArray( list, item );
+	}
+	return list;
+}
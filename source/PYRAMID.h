@@ -0,0 +1,66 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  PYRAMID holds the frame at half, quarter and eighth size. Levels
+ *  are NV12 and built on request from the next larger level with a
+ *  2x2 box filter, once per frame. Consumers take the smallest level
+ *  that still covers their output size and scale from there.
+ *------------------------------------------------------------------*/
+
+#ifndef _PYRAMID_H_
+#define _PYRAMID_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define PYRAMID_MAX_LEVELS	4	//Level 0 is the frame itself
+
+typedef struct PYRAMID_Level {
+	unsigned int	width, height;	//Even
+	uint8_t*		data;			//NV12, width * height * 3 / 2. The frame for level 0
+	unsigned long	sequence;		//Frame the level was built for
+	unsigned long	built;
+	unsigned long	reused;			//Requests served without building
+} PYRAMID_Level;
+
+typedef struct PYRAMID_Pyramid {
+	PYRAMID_Level	levels[PYRAMID_MAX_LEVELS];
+	unsigned int	numLevels;
+	unsigned long	sequence;		//Current frame
+} PYRAMID_Pyramid;
+
+//A region of one level. x, y, w, h are in level pixels
+typedef struct PYRAMID_View {
+	const uint8_t*	data;
+	unsigned int	width, height;
+	unsigned int	x, y, w, h;
+	unsigned int	level;
+} PYRAMID_View;
+
+//Allocates the levels of a width x height stream. Levels stop before 32 pixels
+bool			PYRAMID_Open( PYRAMID_Pyramid* pyramid, unsigned int width, unsigned int height );
+//Sets the frame the levels are built from. Levels from older frames are rebuilt on request
+void			PYRAMID_Frame( PYRAMID_Pyramid* pyramid, const uint8_t* nv12, unsigned long sequence );
+//The level for the current frame, built if needed. 0 if the level does not exist.
+//Not thread safe. Build levels before reading them from other threads
+const PYRAMID_Level*	PYRAMID_Get( PYRAMID_Pyramid* pyramid, unsigned int level );
+//Smallest level where the stream region roi (x, y, w, h) is still at least dstWidth x dstHeight
+unsigned int	PYRAMID_Select( const PYRAMID_Pyramid* pyramid, const unsigned int* roi, unsigned int dstWidth, unsigned int dstHeight );
+//View of the stream region roi at level, built if needed. False if the level does not exist
+bool			PYRAMID_Region( PYRAMID_Pyramid* pyramid, unsigned int level, const unsigned int* roi, PYRAMID_View* view );
+//View of the stream region roi in a built level. Safe from any thread
+bool			PYRAMID_Crop( const PYRAMID_Level* level, unsigned int index, const unsigned int* roi, PYRAMID_View* view );
+void			PYRAMID_Close( PYRAMID_Pyramid* pyramid );
+cJSON*			PYRAMID_Status( const PYRAMID_Pyramid* pyramid );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  The interval is adjusted once per second of measurement. Own CPU
+ *  time comes from /proc/self/stat. Time the inference thread spends
+ *  waiting on the run queue, from its /proc/self/task/<tid>/schedstat,
+ *  shows that other processes, like the stream encoder, need the CPU
+ *  and the rate backs off.
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include "RATE.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+#define RATE_PERIOD		1000.0	//Minimum ms between adjustments
+#define RATE_BUSY		25.0	//Run queue wait in percent that counts as a busy camera
+
+static double
+RATE_Now() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//utime + stime in clock ticks
+static unsigned long long
+RATE_CpuTicks() {
+	char buffer[512];
+	FILE* file = fopen( "/proc/self/stat", "r" );
+	if( !file )
+		return 0;
+	size_t length = fread( buffer, 1, sizeof(buffer) - 1, file );
+	fclose( file );
+	buffer[length] = 0;
+	//The command name may hold spaces. Fields are counted from the last ')'
+	char* position = strrchr( buffer, ')' );
+	if( !position )
+		return 0;
+	unsigned long long utime = 0, stime = 0;
+	if( sscanf( position + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime ) != 2 )
+		return 0;
+	return utime + stime;
+}
+
+//Nanoseconds the thread waited on a run queue
+static unsigned long long
+RATE_WaitNs( int thread ) {
+	unsigned long long run = 0, wait = 0;
+	char path[64];
+	if( thread )
+		snprintf( path, sizeof(path), "/proc/self/task/%d/schedstat", thread );
+	else
+		snprintf( path, sizeof(path), "/proc/self/schedstat" );
+	FILE* file = fopen( path, "r" );
+	if( !file )
+		return 0;
+	if( fscanf( file, "%llu %llu", &run, &wait ) != 2 )
+		wait = 0;
+	fclose( file );
+	return wait;
+}
+
+static int
+RATE_Compare( const void* a, const void* b ) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double
+RATE_P95( RATE_Controller* rate ) {
+	double sorted[RATE_WINDOW];
+	if( rate->samples == 0 )
+		return 0;
+	memcpy( sorted, rate->latency, rate->samples * sizeof(double) );
+	qsort( sorted, rate->samples, sizeof(double), RATE_Compare );
+	return sorted[(rate->samples * 95) / 100];
+}
+
+static double
+RATE_Setting( cJSON* settings, const char* name, double fallback ) {
+	cJSON* item = settings ? cJSON_GetObjectItem( settings, name ) : 0;
+	return (item && item->type == cJSON_Number) ? item->valuedouble : fallback;
+}
+
+const char*
+RATE_Mode( const RATE_Controller* rate ) {
+	switch( rate->mode ) {
+		case RATE_CPU: return "cpu";
+		case RATE_LATENCY: return "latency";
+	}
+	return "fixed";
+}
+
+void
+RATE_Init( RATE_Controller* rate, cJSON* settings ) {
+	memset( rate, 0, sizeof(RATE_Controller) );
+	cJSON* mode = settings ? cJSON_GetObjectItem( settings, "mode" ) : 0;
+	if( mode && mode->type == cJSON_String && strcmp( mode->valuestring, "cpu" ) == 0 ) {
+		rate->mode = RATE_CPU;
+		rate->target = RATE_Setting( settings, "cpu", 25 );
+	} else if( mode && mode->type == cJSON_String && strcmp( mode->valuestring, "latency" ) == 0 ) {
+		rate->mode = RATE_LATENCY;
+		rate->target = RATE_Setting( settings, "latency", 500 );
+	}
+	rate->interval = RATE_Setting( settings, "interval", 5000 );
+	double fps = RATE_Setting( settings, "fps", 0 );
+	if( fps > 0 )
+		rate->interval = 1000.0 / fps;
+	rate->minInterval = RATE_Setting( settings, "minInterval", 100 );
+	rate->maxInterval = RATE_Setting( settings, "maxInterval", 10000 );
+	if( rate->minInterval < 1 )
+		rate->minInterval = 1;
+	if( rate->maxInterval < rate->minInterval )
+		rate->maxInterval = rate->minInterval;
+	if( rate->mode != RATE_FIXED && rate->interval > rate->maxInterval )
+		rate->interval = rate->maxInterval;
+	rate->state = rate->mode == RATE_FIXED ? "Fixed" : "Starting";
+	rate->periodStart = RATE_Now();
+	rate->cpuTicks = RATE_CpuTicks();
+	rate->waitNs = RATE_WaitNs( 0 );
+	LOG_TRACE("%s: %s %f\n",__func__,RATE_Mode(rate),rate->target);
+}
+
+void
+RATE_Thread( RATE_Controller* rate, int thread ) {
+	rate->thread = thread;
+	rate->waitNs = RATE_WaitNs( thread );
+}
+
+unsigned int
+RATE_Update( RATE_Controller* rate, double latency ) {
+	if( latency >= 0 ) {
+		rate->latency[rate->next] = latency;
+		rate->next = (rate->next + 1) % RATE_WINDOW;
+		if( rate->samples < RATE_WINDOW )
+			rate->samples++;
+	}
+
+	double now = RATE_Now();
+	double period = now - rate->periodStart;
+	if( period < RATE_PERIOD )
+		return rate->interval;
+
+	unsigned long long ticks = RATE_CpuTicks();
+	unsigned long long wait = RATE_WaitNs( rate->thread );
+	long cores = sysconf( _SC_NPROCESSORS_ONLN );
+	long hz = sysconf( _SC_CLK_TCK );
+	if( cores < 1 )
+		cores = 1;
+	if( hz < 1 )
+		hz = 100;
+	rate->cpu = (ticks - rate->cpuTicks) * 1000.0 / hz / period / cores * 100.0;
+	rate->waiting = (wait - rate->waitNs) / 1000000.0 / period * 100.0;
+	rate->p95 = RATE_P95( rate );
+	rate->periodStart = now;
+	rate->cpuTicks = ticks;
+	rate->waitNs = wait;
+
+	if( rate->mode == RATE_FIXED )
+		return rate->interval;
+
+	double factor = 1;
+	if( rate->waiting > RATE_BUSY ) {
+		rate->state = "Busy";
+		factor = 1.5;
+	} else if( rate->mode == RATE_CPU ) {
+		double ratio = rate->target > 0 ? rate->cpu / rate->target : 2;
+		if( ratio > 1.1 ) {
+			rate->state = "Backing off";
+			factor = ratio < 2 ? ratio : 2;
+		} else if( ratio < 0.8 ) {
+			rate->state = "Increasing";
+			factor = ratio > 0.5 ? ratio : 0.5;
+		} else {
+			rate->state = "Holding";
+		}
+	} else {
+		if( rate->p95 > rate->target ) {
+			rate->state = "Backing off";
+			factor = 1.5;
+		} else if( rate->p95 < rate->target * 0.7 ) {
+			rate->state = "Increasing";
+			factor = 0.8;
+		} else {
+			rate->state = "Holding";
+		}
+	}
+
+	double interval = rate->interval * factor;
+	if( interval < rate->minInterval )
+		interval = rate->minInterval;
+	if( interval > rate->maxInterval )
+		interval = rate->maxInterval;
+	rate->interval = interval;
+	return rate->interval;
+}
@@ -0,0 +1,59 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  RATE sets the interval between timer inferences. It targets a
+ *  share of the CPU or a p95 inference latency, measured from the
+ *  inference times and /proc/self CPU and run queue accounting.
+ *------------------------------------------------------------------*/
+
+#ifndef _RATE_H_
+#define _RATE_H_
+
+#include <stddef.h>
+#include "cJSON.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define RATE_FIXED		0	//Use "interval"
+#define RATE_CPU		1	//Keep own CPU usage at "cpu" percent of all cores
+#define RATE_LATENCY	2	//Keep p95 inference time below "latency" ms
+
+#define RATE_WINDOW		32	//Inference times in the p95 window
+
+typedef struct RATE_Controller {
+	int				mode;
+	double			target;			//CPU percent or p95 ms
+	unsigned int	interval;		//ms between inferences
+	unsigned int	minInterval;
+	unsigned int	maxInterval;
+	const char*		state;
+
+	double			latency[RATE_WINDOW];	//ms
+	size_t			samples;
+	size_t			next;
+	double			p95;
+
+	//Measured over the last period of at least one second
+	double			cpu;			//Own CPU time, percent of all cores
+	double			waiting;		//Time the inference thread waited for a CPU, percent
+	int				thread;			//Kernel tid of the inference thread. 0 reads the main thread
+	double			periodStart;	//Monotonic ms
+	unsigned long long	cpuTicks;	//utime + stime
+	unsigned long long	waitNs;		//Run queue wait
+} RATE_Controller;
+
+//Reads "rate": { "mode": "fixed|cpu|latency", "interval" or "fps", "cpu", "latency", "minInterval", "maxInterval" }
+void			RATE_Init( RATE_Controller* rate, cJSON* settings );
+//Adds the time of one inference in ms (negative if it failed) and returns the next interval in ms
+unsigned int	RATE_Update( RATE_Controller* rate, double latency );
+const char*		RATE_Mode( const RATE_Controller* rate );
+//Sets the thread, a kernel tid, whose run queue wait tells that the camera is busy
+void			RATE_Thread( RATE_Controller* rate, int thread );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
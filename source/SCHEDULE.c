@@ -0,0 +1,146 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  A periodic timerfd on TFD_TIMER_ABSTIME keeps its own grid of
+ *  deadlines. Reading it returns the number of deadlines since the
+ *  last read, so a tick after a long inference counts the rest as
+ *  skipped. Jitter is the wake-up time after the deadline.
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "SCHEDULE.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+int64_t
+SCHEDULE_Now() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int
+SCHEDULE_Mode( const char* name ) {
+	if( name && strcmp( name, "fixed" ) == 0 )
+		return SCHEDULE_FIXED;
+	if( name && strcmp( name, "continuous" ) == 0 )
+		return SCHEDULE_CONTINUOUS;
+	return SCHEDULE_TIMER;
+}
+
+const char*
+SCHEDULE_Name( int mode ) {
+	switch( mode ) {
+		case SCHEDULE_FIXED: return "fixed";
+		case SCHEDULE_CONTINUOUS: return "continuous";
+	}
+	return "timer";
+}
+
+bool
+SCHEDULE_Open( SCHEDULE_Clock* clock, int mode ) {
+	memset( clock, 0, sizeof(SCHEDULE_Clock) );
+	clock->mode = mode;
+	clock->fd = -1;
+	if( mode == SCHEDULE_TIMER )
+		return true;
+	clock->fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+	if( clock->fd < 0 ) {
+		LOG_WARN( "%s: timerfd_create failed: %s\n", __func__, strerror(errno) );
+		return false;
+	}
+	return true;
+}
+
+void
+SCHEDULE_Close( SCHEDULE_Clock* clock ) {
+	if( clock->fd >= 0 )
+		close( clock->fd );
+	clock->fd = -1;
+}
+
+static bool
+SCHEDULE_Arm( SCHEDULE_Clock* clock, int64_t first, int64_t period ) {
+	struct itimerspec spec;
+	spec.it_value.tv_sec = first / 1000000;
+	spec.it_value.tv_nsec = (first % 1000000) * 1000;
+	spec.it_interval.tv_sec = period / 1000000;
+	spec.it_interval.tv_nsec = (period % 1000000) * 1000;
+	if( timerfd_settime( clock->fd, TFD_TIMER_ABSTIME, &spec, NULL ) < 0 ) {
+		LOG_WARN( "%s: timerfd_settime failed: %s\n", __func__, strerror(errno) );
+		return false;
+	}
+	return true;
+}
+
+bool
+SCHEDULE_Periodic( SCHEDULE_Clock* clock, int64_t origin, int64_t period ) {
+	if( clock->fd < 0 || period <= 0 )
+		return false;
+	int64_t now = SCHEDULE_Now();
+	uint64_t first = now > origin ? (now - origin) / period + 1 : 0;
+	clock->origin = origin;
+	clock->period = period;
+	//The tick reads the number of deadlines passed since the one before the first
+	clock->index = first - 1;
+	return SCHEDULE_Arm( clock, origin + first * period, period );
+}
+
+bool
+SCHEDULE_At( SCHEDULE_Clock* clock, int64_t deadline ) {
+	if( clock->fd < 0 )
+		return false;
+	clock->period = 0;
+	clock->origin = deadline;
+	//A zero it_value disarms the timer. A deadline in the past fires at once
+	return SCHEDULE_Arm( clock, deadline > 0 ? deadline : 1, 0 );
+}
+
+bool
+SCHEDULE_Tick( SCHEDULE_Clock* clock ) {
+	uint64_t expirations = 0;
+	if( clock->fd < 0 || read( clock->fd, &expirations, sizeof(expirations) ) != sizeof(expirations) || expirations == 0 )
+		return false;
+	int64_t now = SCHEDULE_Now();
+	if( clock->period ) {
+		clock->index += expirations;
+		clock->skipped += expirations - 1;
+		clock->deadline = clock->origin + clock->index * clock->period;
+	} else {
+		clock->deadline = clock->origin;
+	}
+	double jitter = now > clock->deadline ? (now - clock->deadline) / 1000.0 : 0;
+	clock->ticks++;
+	double delta = jitter - clock->jitterMean;
+	clock->jitterMean += delta / clock->ticks;
+	clock->jitterM2 += delta * (jitter - clock->jitterMean);
+	if( jitter > clock->jitterMax )
+		clock->jitterMax = jitter;
+	return true;
+}
+
+cJSON*
+SCHEDULE_Status( const SCHEDULE_Clock* clock ) {
+	cJSON* status = cJSON_CreateObject();
+	cJSON_AddStringToObject( status, "mode", SCHEDULE_Name( clock->mode ) );
+	if( clock->mode == SCHEDULE_TIMER )
+		return status;
+	cJSON_AddNumberToObject( status, "period", clock->period / 1000.0 );
+	cJSON_AddNumberToObject( status, "ticks", clock->ticks );
+	cJSON_AddNumberToObject( status, "skipped", clock->skipped );
+	cJSON_AddNumberToObject( status, "jitterMean", (int)(clock->jitterMean * 100) / 100.0 );
+	cJSON_AddNumberToObject( status, "jitterStd", clock->ticks > 1 ? (int)(sqrt( clock->jitterM2 / (clock->ticks - 1) ) * 100) / 100.0 : 0 );
+	cJSON_AddNumberToObject( status, "jitterMax", (int)(clock->jitterMax * 100) / 100.0 );
+	return status;
+}
@@ -0,0 +1,58 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  SCHEDULE is a timerfd clock with absolute deadlines for the
+ *  inference timer. Deadline n is origin + n * period, so the rate
+ *  does not drift, and missed deadlines are skipped, not bursted.
+ *------------------------------------------------------------------*/
+
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cJSON.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define SCHEDULE_TIMER		0	//GLib timeout with the interval from RATE
+#define SCHEDULE_FIXED		1	//Fixed rate on absolute deadlines
+#define SCHEDULE_CONTINUOUS	2	//As fast as possible, one inference per new frame
+
+typedef struct SCHEDULE_Clock {
+	int			mode;
+	int			fd;
+	int64_t		period;		//us. 0 for one-shot deadlines
+	int64_t		origin;		//us, CLOCK_MONOTONIC
+	int64_t		deadline;	//Deadline of the last tick
+	uint64_t	index;		//Deadline index of the last tick
+	uint64_t	ticks;		//Ticks handled
+	uint64_t	skipped;	//Deadlines missed while an inference ran
+
+	//Wake-up time after the deadline in ms
+	double		jitterMean;
+	double		jitterM2;	//Sum of squared differences from the mean
+	double		jitterMax;
+} SCHEDULE_Clock;
+
+int64_t		SCHEDULE_Now();		//CLOCK_MONOTONIC in us
+int			SCHEDULE_Mode( const char* name );
+const char*	SCHEDULE_Name( int mode );
+
+bool		SCHEDULE_Open( SCHEDULE_Clock* clock, int mode );
+void		SCHEDULE_Close( SCHEDULE_Clock* clock );
+//Fires on origin + n * period from the next deadline after now
+bool		SCHEDULE_Periodic( SCHEDULE_Clock* clock, int64_t origin, int64_t period );
+//Fires once at deadline, or at once if it has passed
+bool		SCHEDULE_At( SCHEDULE_Clock* clock, int64_t deadline );
+//Reads the timerfd when it is readable and updates the statistics. Returns false if it had not expired
+bool		SCHEDULE_Tick( SCHEDULE_Clock* clock );
+cJSON*		SCHEDULE_Status( const SCHEDULE_Clock* clock );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,299 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  The argmax is NEON for the class counts where the loads stay
+ *  contiguous. With 2-4 classes vld2/vld3/vld4 split a block of
+ *  pixels into one vector per class and the class id of the best
+ *  value is kept per lane. With many classes the contiguous class
+ *  values of each pixel are reduced with vector max and the first
+ *  class holding the max wins. Other class counts are scalar.
+ *------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include "SEGMENT.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SEGMENT_NEON 1
+#endif
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+SEGMENT_Mask*
+SEGMENT_Create( unsigned int width, unsigned int height, unsigned int classes ) {
+	LOG_TRACE("%s: %ux%ux%u\n",__func__,width,height,classes);
+
+	if( width == 0 || height == 0 || classes == 0 || classes > SEGMENT_MAX_CLASSES ) {
+		LOG_WARN("%s: Invalid mask geometry %ux%ux%u\n",__func__,width,height,classes);
+		return 0;
+	}
+	SEGMENT_Mask* mask = calloc( 1, sizeof(SEGMENT_Mask) );
+	if( !mask )
+		return 0;
+	size_t pixels = (size_t)width * height;
+	mask->width = width;
+	mask->height = height;
+	mask->classes = classes;
+	mask->mask = malloc( pixels );
+	mask->pixels = calloc( SEGMENT_MAX_CLASSES, sizeof(uint32_t) );
+	//A run of length L needs at most 1 + L bytes
+	mask->rle = malloc( 2 * pixels );
+	if( !mask->mask || !mask->pixels || !mask->rle ) {
+		LOG_WARN("%s: Memory allocation error\n",__func__);
+		SEGMENT_Free( mask );
+		return 0;
+	}
+	return mask;
+}
+
+void
+SEGMENT_Free( SEGMENT_Mask* mask ) {
+	if( !mask )
+		return;
+	free( mask->mask );
+	free( mask->pixels );
+	free( mask->rle );
+	free( mask );
+}
+
+static void
+SEGMENT_ArgmaxU8( SEGMENT_Mask* mask, const uint8_t* in, int isSigned ) {
+	size_t pixels = (size_t)mask->width * mask->height;
+	size_t classes = mask->classes;
+	uint8_t flip = isSigned ? 0x80 : 0;	//int8 compares like uint8 after flipping the sign bit
+	size_t p = 0;
+
+#ifdef SEGMENT_NEON
+	uint8x16_t sign = vdupq_n_u8( flip );
+	if( classes >= 2 && classes <= 4 ) {
+		for( ; p + 16 <= pixels; p += 16 ) {
+			const uint8_t* block = in + p * classes;
+			uint8x16_t value[4];
+			if( classes == 2 ) {
+				uint8x16x2_t v = vld2q_u8( block );
+				value[0] = v.val[0]; value[1] = v.val[1];
+			} else if( classes == 3 ) {
+				uint8x16x3_t v = vld3q_u8( block );
+				value[0] = v.val[0]; value[1] = v.val[1]; value[2] = v.val[2];
+			} else {
+				uint8x16x4_t v = vld4q_u8( block );
+				value[0] = v.val[0]; value[1] = v.val[1]; value[2] = v.val[2]; value[3] = v.val[3];
+			}
+			uint8x16_t best = veorq_u8( value[0], sign );
+			uint8x16_t index = vdupq_n_u8( 0 );
+			for( size_t c = 1; c < classes; c++ ) {
+				uint8x16_t v = veorq_u8( value[c], sign );
+				uint8x16_t greater = vcgtq_u8( v, best );
+				best = vmaxq_u8( best, v );
+				index = vbslq_u8( greater, vdupq_n_u8( (uint8_t)c ), index );
+			}
+			vst1q_u8( mask->mask + p, index );
+		}
+	} else if( classes >= 16 ) {
+		for( ; p < pixels; p++ ) {
+			const uint8_t* pixel = in + p * classes;
+			uint8x16_t best = veorq_u8( vld1q_u8( pixel ), sign );
+			size_t c = 16;
+			for( ; c + 16 <= classes; c += 16 )
+				best = vmaxq_u8( best, veorq_u8( vld1q_u8( pixel + c ), sign ) );
+			uint8x8_t max = vpmax_u8( vget_low_u8( best ), vget_high_u8( best ) );
+			max = vpmax_u8( max, max );
+			max = vpmax_u8( max, max );
+			max = vpmax_u8( max, max );
+			uint8_t top = vget_lane_u8( max, 0 );
+			for( ; c < classes; c++ )
+				if( (uint8_t)(pixel[c] ^ flip) > top )
+					top = pixel[c] ^ flip;
+			//First class with the max, as in the scalar loop
+			mask->mask[p] = (uint8_t)((const uint8_t*)memchr( pixel, top ^ flip, classes ) - pixel);
+		}
+	}
+#endif
+
+	for( ; p < pixels; p++ ) {
+		const uint8_t* pixel = in + p * classes;
+		uint8_t best = pixel[0] ^ flip;
+		uint8_t index = 0;
+		for( size_t c = 1; c < classes; c++ ) {
+			uint8_t value = pixel[c] ^ flip;
+			if( value > best ) {
+				best = value;
+				index = (uint8_t)c;
+			}
+		}
+		mask->mask[p] = index;
+	}
+}
+
+static void
+SEGMENT_ArgmaxF32( SEGMENT_Mask* mask, const float* in ) {
+	size_t pixels = (size_t)mask->width * mask->height;
+	size_t classes = mask->classes;
+	size_t p = 0;
+
+#ifdef SEGMENT_NEON
+	if( classes >= 2 && classes <= 4 ) {
+		for( ; p + 4 <= pixels; p += 4 ) {
+			const float* block = in + p * classes;
+			float32x4_t value[4];
+			if( classes == 2 ) {
+				float32x4x2_t v = vld2q_f32( block );
+				value[0] = v.val[0]; value[1] = v.val[1];
+			} else if( classes == 3 ) {
+				float32x4x3_t v = vld3q_f32( block );
+				value[0] = v.val[0]; value[1] = v.val[1]; value[2] = v.val[2];
+			} else {
+				float32x4x4_t v = vld4q_f32( block );
+				value[0] = v.val[0]; value[1] = v.val[1]; value[2] = v.val[2]; value[3] = v.val[3];
+			}
+			float32x4_t best = value[0];
+			uint32x4_t index = vdupq_n_u32( 0 );
+			for( size_t c = 1; c < classes; c++ ) {
+				uint32x4_t greater = vcgtq_f32( value[c], best );
+				best = vmaxq_f32( best, value[c] );
+				index = vbslq_u32( greater, vdupq_n_u32( (uint32_t)c ), index );
+			}
+			uint16x4_t narrow = vmovn_u32( index );
+			mask->mask[p] = (uint8_t)vget_lane_u16( narrow, 0 );
+			mask->mask[p + 1] = (uint8_t)vget_lane_u16( narrow, 1 );
+			mask->mask[p + 2] = (uint8_t)vget_lane_u16( narrow, 2 );
+			mask->mask[p + 3] = (uint8_t)vget_lane_u16( narrow, 3 );
+		}
+	} else if( classes >= 8 ) {
+		for( ; p < pixels; p++ ) {
+			const float* pixel = in + p * classes;
+			float32x4_t best = vld1q_f32( pixel );
+			size_t c = 4;
+			for( ; c + 4 <= classes; c += 4 )
+				best = vmaxq_f32( best, vld1q_f32( pixel + c ) );
+			float32x2_t max = vpmax_f32( vget_low_f32( best ), vget_high_f32( best ) );
+			max = vpmax_f32( max, max );
+			float top = vget_lane_f32( max, 0 );
+			for( ; c < classes; c++ )
+				if( pixel[c] > top )
+					top = pixel[c];
+			//First class with the max, as in the scalar loop
+			uint8_t index = 0;
+			while( index + 1 < classes && pixel[index] != top )
+				index++;
+			mask->mask[p] = index;
+		}
+	}
+#endif
+
+	for( ; p < pixels; p++ ) {
+		const float* pixel = in + p * classes;
+		float best = pixel[0];
+		uint8_t index = 0;
+		for( size_t c = 1; c < classes; c++ ) {
+			if( pixel[c] > best ) {
+				best = pixel[c];
+				index = (uint8_t)c;
+			}
+		}
+		mask->mask[p] = index;
+	}
+}
+
+void
+SEGMENT_Argmax( SEGMENT_Mask* mask, const void* logits, int type ) {
+	if( !mask || !logits )
+		return;
+	switch( type ) {
+		case SEGMENT_UINT8:	SEGMENT_ArgmaxU8( mask, logits, 0 ); break;
+		case SEGMENT_INT8:	SEGMENT_ArgmaxU8( mask, logits, 1 ); break;
+		case SEGMENT_FLOAT32: SEGMENT_ArgmaxF32( mask, logits ); break;
+		default:
+			LOG_WARN("%s: Unsupported data type %d\n",__func__,type);
+	}
+}
+
+void
+SEGMENT_ClassMap( SEGMENT_Mask* mask, const void* map, int type ) {
+	if( !mask || !map )
+		return;
+	size_t pixels = (size_t)mask->width * mask->height;
+	size_t p;
+	uint8_t last = (uint8_t)(mask->classes - 1);
+	switch( type ) {
+		case SEGMENT_UINT8:
+		case SEGMENT_INT8:
+			memcpy( mask->mask, map, pixels );
+			for( p = 0; p < pixels; p++ )
+				if( mask->mask[p] > last )
+					mask->mask[p] = last;
+			break;
+		case SEGMENT_INT32:
+			for( p = 0; p < pixels; p++ ) {
+				int32_t c = ((const int32_t*)map)[p];
+				mask->mask[p] = c < 0 ? 0 : (c > last ? last : (uint8_t)c);
+			}
+			break;
+		default:
+			LOG_WARN("%s: Unsupported class map type %d\n",__func__,type);
+	}
+}
+
+size_t
+SEGMENT_Encode( SEGMENT_Mask* mask ) {
+	if( !mask )
+		return 0;
+	size_t pixels = (size_t)mask->width * mask->height;
+	uint8_t* out = mask->rle;
+	size_t runs = 0;
+	size_t p = 0;
+
+	memset( mask->pixels, 0, SEGMENT_MAX_CLASSES * sizeof(uint32_t) );
+	while( p < pixels ) {
+		uint8_t c = mask->mask[p];
+		size_t start = p;
+		while( p < pixels && mask->mask[p] == c )
+			p++;
+		uint32_t length = (uint32_t)(p - start);
+		mask->pixels[c] += length;
+		*out++ = c;
+		do {
+			uint8_t byte = length & 0x7f;
+			length >>= 7;
+			*out++ = length ? (byte | 0x80) : byte;
+		} while( length );
+		runs++;
+	}
+	mask->rleBytes = (size_t)(out - mask->rle);
+	mask->runs = runs;
+	return runs;
+}
+
+double
+SEGMENT_Coverage( const SEGMENT_Mask* mask, unsigned int classId ) {
+	if( !mask || classId >= mask->classes )
+		return 0;
+	return 100.0 * mask->pixels[classId] / ((double)mask->width * mask->height);
+}
+
+const uint8_t*
+SEGMENT_NextRun( const SEGMENT_Mask* mask, const uint8_t* position, unsigned int* classId, uint32_t* length ) {
+	if( !mask || !position )
+		return 0;
+	const uint8_t* end = mask->rle + mask->rleBytes;
+	if( position >= end )
+		return 0;
+	*classId = *position++;
+	uint32_t value = 0;
+	int shift = 0;
+	while( position < end ) {
+		uint8_t byte = *position++;
+		value |= (uint32_t)(byte & 0x7f) << shift;
+		shift += 7;
+		if( !(byte & 0x80) )
+			break;
+	}
+	*length = value;
+	return position;
+}
@@ -0,0 +1,56 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  SEGMENT turns a semantic segmentation output (H x W x C logits or
+ *  an H x W class map) into a class mask, a run-length encoded mask
+ *  and per class pixel coverage. All buffers are allocated once.
+ *------------------------------------------------------------------*/
+
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define SEGMENT_FLOAT32	0
+#define SEGMENT_UINT8	1
+#define SEGMENT_INT8	2
+#define SEGMENT_INT32	3	//Class map only
+
+#define SEGMENT_MAX_CLASSES	256
+
+typedef struct SEGMENT_Mask {
+	unsigned int	width;
+	unsigned int	height;
+	unsigned int	classes;
+	uint8_t*		mask;		//Class id per pixel, row by row
+	uint32_t*		pixels;		//Number of pixels per class id
+	uint8_t*		rle;		//Runs in raster order encoded as [class id][length as LEB128 varint]
+	size_t			rleBytes;
+	size_t			runs;
+} SEGMENT_Mask;
+
+SEGMENT_Mask*	SEGMENT_Create( unsigned int width, unsigned int height, unsigned int classes );
+void			SEGMENT_Free( SEGMENT_Mask* mask );
+
+//Per pixel argmax over the class dimension (NHWC). Quantized data is compared without dequantizing
+//NEON for 2-4 classes and for 16 or more (8 or more for float32). Ties go to the lowest class id
+void			SEGMENT_Argmax( SEGMENT_Mask* mask, const void* logits, int type );
+//Output is already a class map
+void			SEGMENT_ClassMap( SEGMENT_Mask* mask, const void* map, int type );
+//Run-length encodes the mask and updates the pixel count per class. Returns number of runs
+size_t			SEGMENT_Encode( SEGMENT_Mask* mask );
+//Coverage 0-100% of a class
+double			SEGMENT_Coverage( const SEGMENT_Mask* mask, unsigned int classId );
+//Decodes the next run. Returns the position after the run or 0 at the end
+const uint8_t*	SEGMENT_NextRun( const SEGMENT_Mask* mask, const uint8_t* position, unsigned int* classId, uint32_t* length );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  memfd buffers never touch a file system. Shrinking and growing
+ *  are sealed so the size larod was given stays valid. Kernels and
+ *  libraries without memfd fall back on the tmp file path.
+ *------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "TENSOR.h"
+
+#define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
+#define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
+//#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
+#define LOG_TRACE(fmt, args...)    {}
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC			0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		1033
+#define F_SEAL_SEAL		0x0001
+#define F_SEAL_SHRINK	0x0002
+#define F_SEAL_GROW		0x0004
+#endif
+
+static const char TENSOR_FILE_PATTERN[] = "/tmp/larod.tensor-XXXXXX";
+
+static int
+TENSOR_Memfd( const char* name, size_t size ) {
+#ifdef SYS_memfd_create
+	int fd = syscall( SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING );
+	if( fd < 0 )
+		return -1;
+	if( ftruncate( fd, (off_t)size ) < 0 ) {
+		close( fd );
+		return -1;
+	}
+	if( fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) < 0 )
+		LOG_TRACE("%s: Sealing failed: %s\n", __func__, strerror(errno));
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+static int
+TENSOR_TmpFile( size_t size ) {
+	// mkstemp() modifies the name so every call needs a fresh copy of the pattern
+	char fileName[64];
+	snprintf( fileName, sizeof(fileName), "%s", TENSOR_FILE_PATTERN );
+	int fd = mkstemp( fileName );
+	if( fd < 0 ) {
+		LOG_WARN( "%s: Unable to open temp file %s: %s\n", __func__, fileName, strerror(errno));
+		return -1;
+	}
+	// Remove since we don't actually care about writing to the file system.
+	unlink( fileName );
+	if( ftruncate( fd, (off_t)size ) < 0 ) {
+		LOG_WARN( "%s: Unable to truncate temp file %s: %s\n", __func__, fileName, strerror(errno));
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+int
+TENSOR_Alloc( const char* name, size_t size, void** addr, int* fd ) {
+	int path = TENSOR_MEMFD;
+	*fd = TENSOR_Memfd( name, size );
+	if( *fd < 0 ) {
+		path = TENSOR_TMPFILE;
+		*fd = TENSOR_TmpFile( size );
+	}
+	if( *fd < 0 )
+		return TENSOR_NONE;
+
+	*addr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0 );
+	if( *addr == MAP_FAILED ) {
+		LOG_WARN( "%s: Unable to mmap %s: %s\n", __func__, name, strerror(errno));
+		close( *fd );
+		*fd = -1;
+		return TENSOR_NONE;
+	}
+	LOG_TRACE("%s: %s %u bytes %s\n", __func__, name, (unsigned)size, TENSOR_PathName(path));
+	return path;
+}
+
+void
+TENSOR_Free( void* addr, size_t size, int fd ) {
+	if( addr != MAP_FAILED && addr )
+		munmap( addr, size );
+	if( fd >= 0 )
+		close( fd );
+}
+
+const char*
+TENSOR_PathName( int path ) {
+	switch( path ) {
+		case TENSOR_MEMFD: return "memfd";
+		case TENSOR_TMPFILE: return "tmpfile";
+	}
+	return "none";
+}
@@ -0,0 +1,31 @@
+/*------------------------------------------------------------------
+ *  Fred Juhlin (2023)
+ *
+ *  TENSOR allocates the fd backed buffers larod reads and writes
+ *  tensors through. Anonymous sealed memory is used where the kernel
+ *  has memfd, otherwise unlinked files in /tmp.
+ *------------------------------------------------------------------*/
+
+#ifndef _TENSOR_H_
+#define _TENSOR_H_
+
+#include <stddef.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define TENSOR_NONE		0	//Allocation failed
+#define TENSOR_MEMFD	1	//memfd_create, size sealed
+#define TENSOR_TMPFILE	2	//mkstemp in /tmp, unlinked
+
+//Creates and maps a buffer of size bytes. Returns the path taken
+int			TENSOR_Alloc( const char* name, size_t size, void** addr, int* fd );
+void		TENSOR_Free( void* addr, size_t size, int fd );
+const char*	TENSOR_PathName( int path );
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +1,17 @@
 /*
  *	Fred Juhlin 2023
  *	Optimized for quantized TFLITE files with one output where lable scores are provided as an int8 array
+ *	Runs one or more models (see MODEL.c) on frames from one shared image provider
  *	
  *	Based on https://github.com/AxisCommunications/acap3-examples/tree/main/object-detection
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <string.h>
@@ -18,6 +23,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "imgconverter.h"
@@ -32,334 +38,942 @@
 #include "HTTP.h"
 #include "FILE.h"
 #include "STATUS.h"
-#include "PARSER.h"
+#include "MODEL.h"
+#include "PREPROCESS.h"
+#include "AUDIT.h"
+#include "TFLITE_1.h"
 
 #define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
 #define LOG_WARN(fmt, args...)    { syslog(LOG_WARNING, fmt, ## args); printf(fmt, ## args);}
 //#define LOG_TRACE(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
 #define LOG_TRACE(fmt, args...)    {}
 
-// Hardcode to use three image "color" channels (eg. RGB).
-const unsigned int CHANNELS = 3;
+#define MAX_MODELS	4
 
-
-unsigned modelWidth = 224;
-unsigned modelHeigth = 224;
-double confidenceLevel = 60;
+MODEL_Instance* models[MAX_MODELS];
+size_t numModels = 0;
 unsigned int streamWidth = 0;
 unsigned int streamHeight = 0;
+unsigned long inferenceTick = 0;	//Number of frames fetched for inference
+bool roundRobin = false;	//"scheduling": "round-robin" runs one due model per tick instead of all
+size_t nextModel = 0;
 
-char modelFilePath[128];
-char labelsFilePath[128];
-size_t numberOfLabels = 0; // Will be parsed from the labels file
-
-// Name patterns for the temp file we will create.
-char CONV_INP_FILE_PATTERN[] = "/tmp/larod.in.test-XXXXXX";
-char CONV_OUT1_FILE_PATTERN[] = "/tmp/larod.out1.test-XXXXXX";
-
-larodModel* model = NULL;
 ImgProvider_t* provider = NULL;
-larodError* error = NULL;
-larodConnection* conn = NULL;
-larodTensor** inputTensors = NULL;
-size_t numInputs = 0;
-larodTensor** outputTensors = NULL;
-size_t numOutputs = 0;
-larodInferenceRequest* infReq = NULL;
-void* larodInputAddr = MAP_FAILED;
-void* larodOutput1Addr = MAP_FAILED;
-int larodModelFd = -1;
-int larodInputFd = -1;
-int larodOutput1Fd = -1;
-
-cJSON* labels = 0;
 cJSON* TFLITE_Settings = 0;
+cJSON* calibration = 0;		//Chip timings per model hash. See TFLITE_Calibration
+bool calibrationChanged = false;
 const char* ACAP_PACKAGE = 0;
 
-cJSON*
-parseLabels(const char *labelsPath ) {
-    const size_t LINE_MAX_LEN = 120;
-    bool ret = false;
-    char* labelsData = NULL;  // Buffer containing the label file contents.
-
-	LOG_TRACE("%s:\n",__func__);
-
-    struct stat fileStats = {0};
-    if (stat(labelsPath, &fileStats) < 0) {
-        LOG_WARN( "%s: Unable to get stats for label file %s: %s\n", __func__, labelsPath, strerror(errno));
-        return 0;
-    }
-
-    if (fileStats.st_size > (10 * 1024 * 1024)) {
-        LOG_WARN( "%s: failed sanity check on labels file size\n", __func__);
-        return 0;
-    }
+//Hot path state. STATUS holds the same for the web page but is a tree of string keys
+atomic_int inferenceRunning = 0;
+atomic_int modelReady = 0;
+unsigned int triggerTimeout = 1000;	//ms
+gint64 coalesceTime = 250000;		//us
+GMutex modelMutex;		//Held while a request is served. The main loop takes it to read or change the models
 
-    int labelsFd = open(labelsPath, O_RDONLY);
-    if (labelsFd < 0) {
-        LOG_WARN( "%s: Could not open labels file %s: %s\n", __func__, labelsPath, strerror(errno));
-        return false;
-    }
+static void
+TFLITE_State( int state, const char* status ) {
+	atomic_store( &modelReady, state );
+	STATUS_SetBool( "model", "state", state );
+	if( status )
+		STATUS_SetString( "model", "status", status );
+}
 
-    size_t labelsFileSize = (size_t) fileStats.st_size;
-    // Allocate room for a terminating NULL char after the last line.
-    labelsData = malloc(labelsFileSize + 50);
-    if (labelsData == NULL) {
-        LOG_WARN( "%s: Failed allocating lbuffer: %s\n", __func__, strerror(errno));
-		free(labelsData);
-		return cJSON_CreateArray();
-    }
+//Settings read per inference are kept in variables
+static void
+TFLITE_Limits() {
+	cJSON* setting = cJSON_GetObjectItem( TFLITE_Settings, "triggerTimeout" );
+	triggerTimeout = setting && setting->type == cJSON_Number ? setting->valueint : 1000;
+	setting = cJSON_GetObjectItem( TFLITE_Settings, "coalesce" );
+	coalesceTime = (setting && setting->type == cJSON_Number ? setting->valueint : 250) * 1000LL;
+}
 
-    ssize_t numBytesRead = -1;
-    size_t totalBytesRead = 0;
-    char* fileReadPtr = labelsData;
-    while (totalBytesRead < labelsFileSize) {
-        numBytesRead = read(labelsFd, fileReadPtr, labelsFileSize - totalBytesRead);
-        if (numBytesRead < 1) {
-            LOG_WARN( "%s: Failed reading from labels file: %s\n", __func__, strerror(errno));
-			free(labelsData);
-			return 0;
-        }
-        totalBytesRead += (size_t) numBytesRead;
-        fileReadPtr += numBytesRead;
-    }
-	cJSON* list = PARSER_SplitToJSON( labelsData,'\n');
-	free( labelsData );
-	return list;
+static MODEL_Instance*
+TFLITE_Model( const char* name ) {
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		if( name && strcmp( models[i]->name, name ) == 0 )
+			return models[i];
+		if( !name && models[i]->segmentation )
+			return models[i];
+	}
+	return 0;
 }
 
-/**
- * @brief Creates a temporary fd and truncated to correct size and mapped.
- *
- * This convenience function creates temp files to be used for input and output.
- *
- * @param fileName Pattern for how the temp file will be named in file system.
- * @param fileSize How much space needed to be allocated (truncated) in fd.
- * @param mappedAddr Pointer to the address of the fd mapped for this process.
- * @param Pointer to the generated fd.
- * @return Positive errno style return code (zero means success).
+/*
+ * Responds with the mask from the last inference.
+ * model=name selects the model. Default is the first segmentation model.
+ * Default is JSON with run-length pairs [class, length, class, length...] in raster order.
+ * format=binary responds with the raw runs: [class id][length as LEB128 varint]...
  */
-bool createAndMapTmpFile(char* fileName, size_t fileSize, void** mappedAddr, int* convFd) {
+static void
+TFLITE_Mask(const HTTP_Response response,const HTTP_Request request) {
+	MODEL_Instance* model = TFLITE_Model( HTTP_Request_Param( request, "model") );
+	SEGMENT_Mask* segmentation = model ? model->segmentation : 0;
+	if( !segmentation || segmentation->runs == 0 ) {
+		HTTP_Respond_Error( response, 400, "No segmentation mask available");
+		return;
+	}
 
-    int fd = mkstemp(fileName);
-    if (fd < 0) {
-        LOG_WARN( "%s: Unable to open temp file %s: %s\n", __func__, fileName, strerror(errno));
-        goto error;
-    }
-    // Allocate enough space in for the fd.
-    if (ftruncate(fd, (off_t) fileSize) < 0) {
-        LOG_WARN( "%s: Unable to truncate temp file %s: %s\n", __func__, fileName, strerror(errno));
-        goto error;
-    }
+	const char* format = HTTP_Request_Param( request, "format");
+	if( format && strcmp(format,"binary") == 0 ) {
+		HTTP_Header_FILE( response, "mask.rle", "application/octet-stream", (unsigned)segmentation->rleBytes );
+		HTTP_Respond_Data( response, segmentation->rleBytes, segmentation->rle );
+		return;
+	}
 
-    // Remove since we don't actually care about writing to the file system.
-    if (unlink(fileName)) {
-        LOG_WARN( "%s: Unable to unlink from temp file %s: %s\n", __func__, fileName, strerror(errno));
-        goto error;
-    }
+	//Written straight into one text buffer. Runs are at most "255,4294967295,"
+	size_t size = 256 + segmentation->runs * 16 + segmentation->classes * 16;
+	char* json = malloc( size );
+	if( !json ) {
+		HTTP_Respond_Error( response, 500, "Memory allocation error");
+		return;
+	}
+	size_t length = snprintf( json, size, "{\"width\":%u,\"height\":%u,\"pixels\":[", segmentation->width, segmentation->height );
+	unsigned int c;
+	for( c = 0; c < segmentation->classes; c++ )
+		length += snprintf( json + length, size - length, c ? ",%u" : "%u", segmentation->pixels[c] );
+	length += snprintf( json + length, size - length, "],\"rle\":[" );
+	const uint8_t* position = segmentation->rle;
+	uint32_t run;
+	int first = 1;
+	while( (position = SEGMENT_NextRun( segmentation, position, &c, &run )) ) {
+		length += snprintf( json + length, size - length, first ? "%u,%u" : ",%u,%u", c, run );
+		first = 0;
+	}
+	snprintf( json + length, size - length, "]}" );
+	HTTP_Header_JSON( response );
+	HTTP_Respond_Data( response, strlen(json), json );
+	free( json );
+}
 
-    // Get an address to fd's memory for this process's memory space.
-    void* data = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+//The mask is written by the inference thread
+static void
+TFLITE_HTTP_Mask(const HTTP_Response response,const HTTP_Request request) {
+	g_mutex_lock( &modelMutex );
+	TFLITE_Mask( response, request );
+	g_mutex_unlock( &modelMutex );
+}
 
-    if (data == MAP_FAILED) {
-        LOG_WARN( "%s: Unable to mmap temp file %s: %s\n", __func__, fileName, strerror(errno));
-        goto error;
-    }
+static bool
+TFLITE_Due( MODEL_Instance* model ) {
+	return (inferenceTick - 1) % model->every == 0;
+}
 
-    *mappedAddr = data;
-    *convFd = fd;
+//The frame being processed. Job backends read it through the buffer fd
+PREPROCESS_Frame frame = { -1, 0, 0, 0, 0, 0 };
+//Scaled versions of the frame shared by the models, tiles and the motion gate. "pyramid": false disables it
+PYRAMID_Pyramid pyramid;
+bool usePyramid = false;
 
-    return true;
+//"preprocessing": "cpu", "larod" or "local" selects the backend that writes an input owner's tensor
+static void
+TFLITE_Preprocess_Open( MODEL_Instance* model ) {
+	if( model->inputOwner != model )
+		return;
+	cJSON* setting = MODEL_Setting( model, "preprocessing" );
+	int backend = PREPROCESS_Backend( setting && setting->type == cJSON_String ? setting->valuestring : 0 );
+	//Clip models convert into their frame ring
+	if( model->clip > 1 )
+		PREPROCESS_Open( &model->preprocess, backend, streamWidth, streamHeight, model->width, model->height, model->ringFd, (uint8_t*)model->ring, model->ringSize );
+	else
+		PREPROCESS_Open( &model->preprocess, backend, streamWidth, streamHeight, model->width, model->height, model->inputFd, (uint8_t*)model->inputAddr, model->inputSize );
+	//"preprocessBenchmark": N times N conversions with libyuv and the specialized kernel
+	setting = MODEL_Setting( model, "preprocessBenchmark" );
+	if( setting && setting->type == cJSON_Number && setting->valueint > 0 )
+		PREPROCESS_Benchmark( &model->preprocess, setting->valueint );
+}
 
-error:
-    if (fd >= 0) {
-        close(fd);
-    }
+// Covert image data from NV12 format to interleaved uint8_t RGB format.
+// Models with the same geometry read the same input buffer, converted once per frame
+// Batch models convert into their next free slot, clip models into their ring
+static void
+TFLITE_Preprocess( MODEL_Instance* model ) {
+	if( model->clip > 1 ) {
+		if( !PREPROCESS_Run( &model->preprocess, &frame, 0, MODEL_ClipFrame( model ) - (uint8_t*)model->ring ) ) {
+			LOG_WARN( "%s: Failed img scale/convert (continue anyway)\n", __func__);
+		}
+		MODEL_ClipPush( model );
+		return;
+	}
+	if( model->batch > 1 ) {
+		if( !PREPROCESS_Run( &model->preprocess, &frame, 0, MODEL_Input( model ) - (uint8_t*)model->inputAddr ) ) {
+			LOG_WARN( "%s: Failed img scale/convert (continue anyway)\n", __func__);
+		}
+		return;
+	}
+	//The input buffer already holds this frame if another model converted it this tick,
+	//or an earlier request got the same frame. It goes to larod as is
+	MODEL_Instance* owner = model->inputOwner;
+	if( owner->preprocessed == inferenceTick || (frame.sequence && owner->preprocessedSequence == frame.sequence && owner->preprocessedTimestamp == frame.timestamp) ) {
+		owner->preprocessed = inferenceTick;
+		PREPROCESS_Cache_Reused( owner->itemSize );
+		return;
+	}
+	owner->preprocessedSequence = 0;
+	if( !PREPROCESS_Run( &owner->preprocess, &frame, 0, 0 ) ) {
+		LOG_WARN( "%s: Failed img scale/convert (continue anyway)\n", __func__);
+	} else {
+		owner->preprocessedSequence = frame.sequence;
+		owner->preprocessedTimestamp = frame.timestamp;
+	}
+	owner->preprocessed = inferenceTick;
+}
 
+//Inference time per model in the current tick. Crop models may run several times
+unsigned int tickDuration[MAX_MODELS];
 
-    return false;
+static cJSON*
+TFLITE_Last( cJSON* list ) {
+	cJSON* last = list->child;
+	while( last && last->next )
+		last = last->next;
+	return last;
 }
 
-/**
- * @brief Sets up and configures a connection to larod, and loads a model.
- *
- * Opens a connection to larod, which is tied to larodConn. After opening a
- * larod connection the chip specified by larodChip is set for the
- * connection. Then the model file specified by larodModelFd is loaded to the
- * chip, and a corresponding larodModel object is tied to model.
- *
- * @param larodChip Speficier for which larod chip to use.
- * @param larodModelFd Fd for a model file to load.
- * @param larodConn Pointer to a larod connection to be opened.
- * @param model Pointer to a larodModel to be obtained.
- * @return false if error has occurred, otherwise true.
- */
-bool setupLarod(const int larodModelFd, larodConnection** larodConn, larodModel** model) {
-    larodError* error = NULL;
-    larodConnection* conn = NULL;
-    larodModel* loadedModel = NULL;
-    bool ret = false;
-
-	LOG_TRACE("%s:\n",__func__);
-
-    // Set up larod connection.
-    if (!larodConnect(&conn, &error)) {
-        LOG_WARN( "%s: Could not connect to larod: %s\n", __func__, error->msg);
-        goto end;
-    }
+static bool
+TFLITE_Execute( size_t i, cJSON* payload, cJSON* list ) {
+	MODEL_Instance* model = models[i];
+	if( !MODEL_Run( model ) )
+		return false;
+	tickDuration[i] += model->duration;
+	AUDIT_Result( true );
+	MODEL_Decode( model, payload, list, numModels > 1 );
+	AUDIT_Result( false );
+	return true;
+}
 
-    // Test various chip configuration
-	//LAROD_CHIP_TFLITE_CPU, LAROD_CHIP_TPU, LAROD_CHIP_TFLITE_CPU, LAROD_CHIP_TFLITE_ARTPEC8DLPU	
-    if (larodSetChip(conn, 4, &error)) {
-		STATUS_SetString( "model", "architecture", "EdgeTPU" );	
+//Grows the box to the model aspect ratio, within the stream
+static void
+TFLITE_CropRegion( MODEL_Instance* model, DETECT_Context* boxes, size_t b ) {
+	float x = boxes->x1[b], y = boxes->y1[b];
+	float w = boxes->x2[b] - x, h = boxes->y2[b] - y;
+	float aspect = (float)model->width / model->height;
+	if( w < 2 ) { x -= (2 - w) / 2; w = 2; }
+	if( h < 2 ) { y -= (2 - h) / 2; h = 2; }
+	if( w / h < aspect ) {
+		x -= (h * aspect - w) / 2;
+		w = h * aspect;
 	} else {
-		larodClearError(&error);
-		if (larodSetChip(conn, 12, &error)) {
-			STATUS_SetString( "model", "architecture", "ARTPEC-8" );	
-		} else {
-			larodClearError(&error);
-			if (larodSetChip(conn, 2, &error)) {
-				STATUS_SetString( "model", "architecture", "CPU" );	
-			} else {
-				STATUS_SetString("model","status", "No compatible architecture found");
-				LOG_WARN("No Larod compatible chip found\n");
-				goto error;
+		y -= (w / aspect - h) / 2;
+		h = w / aspect;
+	}
+	if( w > streamWidth ) w = streamWidth;
+	if( h > streamHeight ) h = streamHeight;
+	if( x < 0 ) x = 0;
+	if( y < 0 ) y = 0;
+	if( x + w > streamWidth ) x = streamWidth - w;
+	if( y + h > streamHeight ) y = streamHeight - h;
+	model->cropX = (unsigned int)x & ~1u;
+	model->cropY = (unsigned int)y & ~1u;
+	model->cropW = (unsigned int)w;
+	model->cropH = (unsigned int)h;
+}
+
+/*
+ * Runs the models gated by gate. first is the first list item the gate reported this tick.
+ * Full frame models are queued once if any reported label fires. Crop models are queued
+ * with each firing detection box and run when the batch is full or the boxes are done.
+ */
+static size_t
+TFLITE_Cascade( MODEL_Instance* gate, const uint8_t* nv12Data, double timestamp, cJSON* payload, cJSON* list, cJSON* first ) {
+	size_t completed = 0;
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		MODEL_Instance* model = models[i];
+		if( model->gate != gate )
+			continue;
+
+		if( !model->crops || !gate->detections ) {
+			cJSON* item;
+			for( item = first; item; item = item->next ) {
+				cJSON* label = cJSON_GetObjectItem( item, "label" );
+				if( label && MODEL_Fires( model, label->valuestring ) )
+					break;
+			}
+			if( !item )
+				continue;
+			TFLITE_Preprocess( model );
+			if( !MODEL_Queue( model, timestamp, 0 ) && !MODEL_Expired( model, timestamp ) )
+				continue;
+			cJSON* last = TFLITE_Last( list );
+			if( TFLITE_Execute( i, payload, list ) ) {
+				completed++;
+				completed += TFLITE_Cascade( model, nv12Data, timestamp, payload, list, last ? last->next : list->child );
 			}
+			continue;
 		}
-    }
-
-    loadedModel = larodLoadModel(conn, larodModelFd, LAROD_ACCESS_PRIVATE, ACAP_PACKAGE, &error);
-    if (!loadedModel) {
-		STATUS_SetString("model","status", "Unable to load model");
-        LOG_WARN( "%s: Unable to load model: %s\n", __func__, error->msg);
-        goto error;
-    }
 
-    *larodConn = conn;
-    *model = loadedModel;
-
-    ret = true;
+		DETECT_Context* boxes = gate->merged ? gate->merged : gate->detections;
+		unsigned int crops = 0;
+		size_t b;
+		for( b = 0; b < boxes->count && crops < model->maxCrops; b++ ) {
+			if( !MODEL_Fires( model, LABELS_Get( gate->labelTable, boxes->classId[b] ) ) )
+				continue;
+			TFLITE_CropRegion( model, boxes, b );
+			unsigned int roi[4] = { model->cropX, model->cropY, model->cropW, model->cropH };
+			if( !PREPROCESS_Run( &model->preprocess, &frame, roi, MODEL_Input( model ) - (uint8_t*)model->inputAddr ) )
+				continue;
+			crops++;
+			int box[4] = { (int)boxes->x1[b], (int)boxes->y1[b], (int)(boxes->x2[b] - boxes->x1[b]), (int)(boxes->y2[b] - boxes->y1[b]) };
+			if( MODEL_Queue( model, timestamp, box ) && TFLITE_Execute( i, payload, list ) )
+				completed++;
+		}
+		//The boxes belong to this frame. Run a partial batch now
+		if( model->queued && TFLITE_Execute( i, payload, list ) )
+			completed++;
+	}
+	return completed;
+}
 
-    goto end;
+/*
+ * Thread placement. "affinity" pins the inference thread (the main loop), the tile
+ * preprocessing pool and the VDO fetcher thread to lists of cores, e.g.
+ * "affinity": { "inference": [0], "preprocess": [1], "fetcher": [1] }
+ */
+static bool
+TFLITE_Affinity( const char* name, cpu_set_t* set ) {
+	cJSON* affinity = cJSON_GetObjectItem( TFLITE_Settings, "affinity" );
+	cJSON* cores = affinity ? cJSON_GetObjectItem( affinity, name ) : 0;
+	if( !cores || cores->type != cJSON_Array )
+		return false;
+	CPU_ZERO( set );
+	int count = g_get_num_processors();
+	cJSON* core;
+	for( core = cores->child; core; core = core->next )
+		if( core->type == cJSON_Number && core->valueint >= 0 && core->valueint < count )
+			CPU_SET( core->valueint, set );
+	if( CPU_COUNT( set ) == 0 ) {
+		LOG_WARN( "%s: No valid cores for %s\n", __func__, name );
+		return false;
+	}
+	return true;
+}
 
-error:
-    if (conn) {
-        larodDisconnect(&conn, NULL);
-    }
+//Tiles are converted in parallel on "preprocessThreads" threads, default all cores
+GThreadPool* tilePool = NULL;
+GMutex tileMutex;
+GCond tileCond;
+unsigned int tilesPending = 0;
+MODEL_Instance* tileModel = NULL;
+const uint8_t* tileFrame = NULL;
+const PYRAMID_Level* tileLevel = NULL;	//Pyramid level the tiles are scaled from, built before the jobs run
+unsigned int tileLevelIndex = 0;
+static __thread bool tileThreadPlaced = false;
 
-end:
-    if (error) {
-        larodClearError(&error);
-    }
+static void
+TFLITE_TileJob( gpointer data, gpointer userData ) {
+	MODEL_Tile* tile = data;
+	//Pool threads get the affinity name as userData and place themselves on their first job
+	if( !tileThreadPlaced && userData ) {
+		cpu_set_t cores;
+		if( TFLITE_Affinity( userData, &cores ) )
+			pthread_setaffinity_np( pthread_self(), sizeof(cores), &cores );
+		tileThreadPlaced = true;
+	}
+	size_t t = tile - tileModel->tiles;
+	unsigned int roi[4] = { tile->x, tile->y, tile->w, tile->h };
+	PYRAMID_View view;
+	if( !tileLevel || !PYRAMID_Crop( tileLevel, tileLevelIndex, roi, &view ) ) {
+		view.data = tileFrame;
+		view.width = streamWidth;
+		view.height = streamHeight;
+		view.x = tile->x;
+		view.y = tile->y;
+		view.w = tile->w;
+		view.h = tile->h;
+	}
+	if( !convertRegionScaleU8yuvToRGB(view.data, view.width, view.height, view.x, view.y, view.w, view.h, tileModel->tileInput + t * tileModel->itemSize, tileModel->width, tileModel->height, &tile->scratch) )
+		tile->active = false;
+	g_mutex_lock( &tileMutex );
+	tilesPending--;
+	g_cond_signal( &tileCond );
+	g_mutex_unlock( &tileMutex );
+}
 
-    return ret;
+/*
+ * Runs a tiling model. Tiles without motion since they were last processed are skipped
+ * and keep their detections. The others are converted in parallel, queued into the
+ * batch and run. The detections of all tiles are merged with NMS.
+ */
+static void
+TFLITE_Tiles( size_t i, const uint8_t* nv12Data, double timestamp, cJSON* payload, cJSON* list ) {
+	MODEL_Instance* model = models[i];
+	size_t t;
+
+	tileModel = model;
+	tileFrame = nv12Data;
+	tileLevel = 0;
+	//The motion gate reads quarter size luma, the tiles the smallest level covering the model size
+	const uint8_t* luma = nv12Data;
+	unsigned int stride = streamWidth, shift = 0;
+	if( frame.pyramid ) {
+		const MODEL_Tile* tile = &model->tiles[0];
+		unsigned int roi[4] = { tile->x, tile->y, tile->w, tile->h };
+		tileLevelIndex = PYRAMID_Select( frame.pyramid, roi, model->width, model->height );
+		if( tileLevelIndex > 0 )
+			tileLevel = PYRAMID_Get( frame.pyramid, tileLevelIndex );
+		shift = tile->w >> 2 >= 4 * MODEL_TILE_GRID && tile->h >> 2 >= 4 * MODEL_TILE_GRID ? 2 : 0;
+		//Only if the level was not cropped when rounded to even sizes
+		const PYRAMID_Level* level = shift && frame.pyramid->numLevels > shift ? &frame.pyramid->levels[shift] : 0;
+		if( level && level->width == streamWidth >> shift && level->height == streamHeight >> shift )
+			level = PYRAMID_Get( frame.pyramid, shift );
+		else
+			level = 0;
+		if( level ) {
+			luma = level->data;
+			stride = level->width;
+		} else {
+			shift = 0;
+		}
+	}
+	for( t = 0; t < model->numTiles; t++ ) {
+		MODEL_Tile* tile = &model->tiles[t];
+		if( !MODEL_TileMotion( model, tile, luma, stride, shift ) )
+			continue;
+		g_mutex_lock( &tileMutex );
+		tilesPending++;
+		g_mutex_unlock( &tileMutex );
+		if( !tilePool || !g_thread_pool_push( tilePool, tile, NULL ) )
+			TFLITE_TileJob( tile, NULL );
+	}
+	g_mutex_lock( &tileMutex );
+	while( tilesPending )
+		g_cond_wait( &tileCond, &tileMutex );
+	g_mutex_unlock( &tileMutex );
+
+	for( t = 0; t < model->numTiles; t++ ) {
+		MODEL_Tile* tile = &model->tiles[t];
+		if( !tile->active )
+			continue;
+		memcpy( MODEL_Input( model ), model->tileInput + t * model->itemSize, model->itemSize );
+		model->tile = t;
+		model->cropX = tile->x;
+		model->cropY = tile->y;
+		model->cropW = tile->w;
+		model->cropH = tile->h;
+		if( MODEL_Queue( model, timestamp, 0 ) )
+			TFLITE_Execute( i, payload, list );
+	}
+	model->tile = -1;
+	if( model->queued )
+		TFLITE_Execute( i, payload, list );
+	AUDIT_Result( true );
+	MODEL_TileMerge( model, list, numModels > 1 );
+	AUDIT_Result( false );
 }
 
-int inferenceRunning = 0;
+/*
+ * Thread sweep. With "threadSweep": true each preprocessing pool size from 1 to the number
+ * of cores runs "sweepRuns" inferences on live frames. The size with the highest frame rate
+ * is kept. The first inference after a change is not counted.
+ */
+unsigned int poolThreads = 0;
+unsigned int sweepThreads = 0;		//Pool size being measured. 0 when not sweeping
+unsigned int sweepRuns = 10;
+unsigned int sweepCount = 0;
+gint64 sweepTotal = 0;
+double sweepBest = 0;
+unsigned int sweepBestThreads = 0;
+cJSON* sweepTable = 0;
+const char* sweepState = "Fixed";
 
-cJSON*
-TFLITE_Inference() {
+static void
+TFLITE_Sweep( gint64 elapsed ) {
+	if( !sweepThreads || sweepCount++ == 0 )
+		return;
+	sweepTotal += elapsed;
+	if( sweepCount <= sweepRuns )
+		return;
 
-	struct timeval startTs, endTs;
-	unsigned int elapsedMs = 0;
+	double latency = sweepTotal / 1000.0 / sweepRuns;
+	double fps = latency > 0 ? 1000.0 / latency : 0;
+	cJSON* item = cJSON_CreateObject();
+	cJSON_AddNumberToObject( item, "threads", sweepThreads );
+	cJSON_AddNumberToObject( item, "latency", latency );
+	cJSON_AddNumberToObject( item, "fps", fps );
+	cJSON_AddItemToArray( sweepTable, item );
+	if( fps > sweepBest ) {
+		sweepBest = fps;
+		sweepBestThreads = sweepThreads;
+	}
 
-	if( !TFLITE_Settings ) {
-		LOG_WARN("%s: TFLITE_Settings is NULL\n", __func__ );
-		return 0;
+	sweepCount = 0;
+	sweepTotal = 0;
+	if( sweepThreads < (unsigned int)g_get_num_processors() ) {
+		sweepThreads++;
+	} else {
+		sweepThreads = 0;
+		LOG( "%s: %u preprocessing threads selected\n", __func__, sweepBestThreads );
 	}
+	poolThreads = sweepThreads ? sweepThreads : sweepBestThreads;
+	g_thread_pool_set_max_threads( tilePool, poolThreads, NULL );
+	sweepState = sweepThreads ? "Sweeping" : "Swept";
+}
 
-	//Check that everything is initialized
-	if( !STATUS_Bool( "model", "state" ) ) {
+int64_t
+TFLITE_FrameArrival( int64_t* interval ) {
+	if( !provider ) {
+		*interval = 0;
 		return 0;
 	}
+	*interval = provider->frameInterval;
+	return provider->frameArrival;
+}
 
+//Model state set from the inference thread. STATUS is only written on the main loop
+static gboolean
+TFLITE_Lost( gpointer data ) {
+	TFLITE_State( 0, data );
+	return FALSE;
+}
 
-	if( inferenceRunning )
-		return 0;
-	inferenceRunning = 1;
+/*
+ * Model and thread status. The inference thread holds modelMutex for a whole request, the
+ * wait for a frame included, so the main loop never waits for it. If the models are busy the
+ * inference thread copies a snapshot after its request and the next status tick publishes it
+ */
+GMutex statusMutex;			//Guards statusSnapshot
+cJSON* statusSnapshot = 0;
+atomic_int statusWanted = 0;
+
+//Called with modelMutex held, or before the inference thread runs
+static cJSON*
+TFLITE_Snapshot() {
+	cJSON* snapshot = cJSON_CreateObject();
+	cJSON* modelStatus = cJSON_CreateArray();
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		cJSON* status = MODEL_Status( models[i] );
+		//Percent of frames the model ran on
+		cJSON_AddNumberToObject( status,"rate", inferenceTick ? (int)(models[i]->runs * 1000 / inferenceTick) / 10.0 : 0 );
+		cJSON_AddItemToArray( modelStatus, status );
+	}
+	cJSON_AddItemToObject( snapshot, "models", modelStatus );
+	if( usePyramid )
+		cJSON_AddItemToObject( snapshot, "pyramid", PYRAMID_Status( &pyramid ) );
+	cJSON_AddItemToObject( snapshot, "tensorCache", PREPROCESS_Cache_Status() );
+	cJSON_AddNumberToObject( snapshot, "preprocess", poolThreads );
+	cJSON_AddStringToObject( snapshot, "state", sweepState );
+	if( sweepTable )
+		cJSON_AddItemToObject( snapshot, "sweep", cJSON_Duplicate( sweepTable, 1 ) );
+	return snapshot;
+}
 
-	if( !provider) {
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","No image provider");
+//Writes a snapshot to the status groups "model" and "threads" and deletes it
+static void
+TFLITE_Publish( cJSON* snapshot ) {
+	STATUS_SetObject( "model", "models", cJSON_DetachItemFromObject( snapshot, "models" ) );
+	cJSON* item = cJSON_DetachItemFromObject( snapshot, "pyramid" );
+	if( item )
+		STATUS_SetObject( "model", "pyramid", item );
+	STATUS_SetObject( "model", "tensorCache", cJSON_DetachItemFromObject( snapshot, "tensorCache" ) );
+	STATUS_SetNumber( "threads", "preprocess", cJSON_GetObjectItem( snapshot, "preprocess" )->valuedouble );
+	STATUS_SetNumber( "threads", "cores", g_get_num_processors() );
+	STATUS_SetString( "threads", "state", cJSON_GetObjectItem( snapshot, "state" )->valuestring );
+	item = cJSON_DetachItemFromObject( snapshot, "sweep" );
+	if( item )
+		STATUS_SetObject( "threads", "sweep", item );
+	cJSON_Delete( snapshot );
+}
+
+gint64 frameWork = 0;	//us from frame to result in the last TFLITE_Frame, without the wait for the frame
+
+/*
+ * Runs the due models on one frame. after is 0 for the latest frame, or the monotonic us of
+ * a trigger to use the first frame captured at or after it
+ */
+static cJSON*
+TFLITE_Frame( gint64 after ) {
+
+	//Check that everything is initialized
+	if( !atomic_load( &modelReady ) || !provider )
 		return 0;
+	if( atomic_exchange( &inferenceRunning, 1 ) )
+		return 0;
+
+	//The first frame at or after the trigger arrives within about one frame interval of it,
+	//so the wait is capped there. "triggerTimeout" bounds it while the interval is unknown
+	unsigned int timeout = triggerTimeout;
+	if( after && provider->frameInterval > 0 ) {
+		gint64 now = g_get_monotonic_time();
+		gint64 cap = ((after > now ? after - now : 0) + provider->frameInterval * 3 / 2) / 1000 + 1;
+		if( cap < timeout )
+			timeout = cap;
 	}
 
-	// Get latest frame from image pipeline.
-	VdoBuffer* buf = getLastFrameBlocking(provider);
+	// Get latest frame from image pipeline, or the first after the trigger
+	VdoBuffer* buf = after ? getFrameAfterBlocking(provider, after, timeout) : getLastFrameBlocking(provider);
+	gint64 frameTime = g_get_monotonic_time();
 	if (!buf) {
+		atomic_store( &inferenceRunning, 0 );
+		if( after ) {
+			LOG_WARN( "%s: No frame after the trigger\n", __func__ );
+			return 0;
+		}
 		LOG_WARN( "%s: No image avaialable\n", __func__ );
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","No image provider");
-		inferenceRunning = 0;
+		atomic_store( &modelReady, 0 );
+		g_idle_add( TFLITE_Lost, (gpointer)"No image provider" );
 		return 0;
 	}
+	inferenceTick++;
 
 	// Get data from latest frame.
 	uint8_t* nv12Data = (uint8_t*) vdo_buffer_get_data(buf);
+	frame.fd = vdo_buffer_get_fd(buf);
+	frame.offset = vdo_buffer_get_offset(buf);
+	frame.data = nv12Data;
+	VdoFrame* vdoFrame = vdo_buffer_get_frame( buf );
+	frame.sequence = vdo_frame_get_sequence_nbr( vdoFrame );
+	frame.timestamp = vdo_frame_get_timestamp( vdoFrame );
+	if( usePyramid ) {
+		PYRAMID_Frame( &pyramid, nv12Data, inferenceTick );
+		frame.pyramid = &pyramid;
+	}
 
-	// Covert image data from NV12 format to interleaved uint8_t RGB format.
-	gettimeofday(&startTs, NULL);
-
+	double timestamp = DEVICE_Timestamp();
+	cJSON* payload = cJSON_CreateObject();
+	cJSON_AddStringToObject( payload,"device", DEVICE_Prop("serial"));
+	cJSON_AddNumberToObject( payload,"timestamp", timestamp);
+	//Capture time is CLOCK_MONOTONIC us
+	guint64 captured = frame.timestamp;
+	if( captured )
+		cJSON_AddNumberToObject( payload,"frameAge", (int)((frameTime - (gint64)captured) / 100) / 10.0 );
+	if( captured && after )
+		cJSON_AddNumberToObject( payload,"triggerToCapture", (int)(((gint64)captured - after) / 100) / 10.0 );
+	cJSON* list = cJSON_CreateArray();
+	size_t completed = 0;
+	memset( tickDuration, 0, sizeof(tickDuration) );
+	AUDIT_Begin();
+
+	size_t n;
+	for( n = 0; n < numModels; n++ ) {
+		size_t i = (nextModel + n) % numModels;
+		MODEL_Instance* model = models[i];
+		cJSON* last = TFLITE_Last( list );
+		if( model->numTiles && !model->gate ) {
+			if( !TFLITE_Due( model ) )
+				continue;
+			TFLITE_Tiles( i, nv12Data, timestamp, payload, list );
+			completed++;
+			completed += TFLITE_Cascade( model, nv12Data, timestamp, payload, list, last ? last->next : list->child );
+			if( roundRobin ) {
+				nextModel = (i + 1) % numModels;
+				break;
+			}
+			continue;
+		}
 
-	if (!convertCropScaleU8yuvToRGB(nv12Data, streamWidth, streamHeight, (uint8_t*) larodInputAddr, modelWidth,	modelHeigth)) {
-		LOG_WARN( "%s: Failed img scale/convert in convertCropScaleU8yuvToRGB() (continue anyway)\n", __func__);
-	}
+		//Gated models are queued when their gate fires. Here they only flush an expired batch
+		if( model->gate ) {
+			if( !MODEL_Expired( model, timestamp ) )
+				continue;
+		} else if( TFLITE_Due( model ) ) {
+			TFLITE_Preprocess( model );
+			if( !MODEL_Queue( model, timestamp, 0 ) && !MODEL_Expired( model, timestamp ) )
+				continue;
+		} else if( !MODEL_Expired( model, timestamp ) ) {
+			continue;
+		}
 
-	gettimeofday(&endTs, NULL);
+		if( !TFLITE_Execute( i, payload, list ) )
+			continue;
+		completed++;
+		completed += TFLITE_Cascade( model, nv12Data, timestamp, payload, list, last ? last->next : list->child );
 
-	elapsedMs = (unsigned int) (((endTs.tv_sec - startTs.tv_sec) * 1000) +
-								((endTs.tv_usec - startTs.tv_usec) / 1000));
+		if( roundRobin ) {
+			nextModel = (i + 1) % numModels;
+			break;
+		}
+	}
 
-	if (lseek(larodOutput1Fd, 0, SEEK_SET) == -1) {
-		LOG_WARN( "%s: Unable to rewind output file position: %s\n", __func__, strerror(errno));
+	returnFrame(provider, buf);
+	AUDIT_End();
+	atomic_store( &inferenceRunning, 0 );
+	if( completed )
+		TFLITE_Sweep( g_get_monotonic_time() - frameTime );
+
+	if( completed == 0 ) {
+		cJSON_Delete( list );
+		cJSON_Delete( payload );
 		return 0;
 	}
 
-	inferenceRunning = 1;
-
-	gettimeofday(&startTs, NULL);
-	
-	if (!larodRunInference(conn, infReq, &error)) {
-		LOG_WARN( "%s: Unable to run inference on model %s: %s (%d)\n", __func__, modelFilePath, error->msg, error->code);
-		larodClearError(&error);		
-		inferenceRunning = 0;
-		return 0;
+	unsigned int elapsedMs = 0;
+	cJSON* durations = numModels > 1 ? cJSON_CreateObject() : 0;
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		elapsedMs += tickDuration[i];
+		if( durations && models[i]->runs && tickDuration[i] )
+			cJSON_AddNumberToObject( durations, models[i]->name, tickDuration[i] );
 	}
+	cJSON_AddNumberToObject( payload,"duration", elapsedMs);
+	if( durations )
+		cJSON_AddItemToObject( payload,"models", durations);
+	cJSON_AddItemToObject( payload,"list", list);
+	gint64 done = g_get_monotonic_time();
+	frameWork = done - frameTime;
+	if( after )
+		cJSON_AddNumberToObject( payload,"triggerToResult", (int)((done - after) / 100) / 10.0 );
+	LOG_TRACE("%s: Exit\n",__func__);
+	return payload;
+}
+
+cJSON*
+TFLITE_Inference() {
+	return TFLITE_Frame( 0 );
+}
 
-	gettimeofday(&endTs, NULL);
+/*
+ * Request classes. Requests wait in a queue per class and the inference thread serves the
+ * highest class with a pending request first, so a trigger is not served after queued
+ * interactive or timer requests. Nobody waits for a result: HTTP requests and the timer submit
+ * and get the result in a callback on the main loop, which stays free to accept triggers.
+ * Interactive and background requests get a copy of the last result if it is younger than
+ * "coalesce" ms, so a backlog of polling requests drains without running an inference each.
+ * Events always get a new inference.
+ */
+#define TFLITE_CLASSES	3
+#define TFLITE_BUCKETS	8
+#define TFLITE_DEPTH	16	//Most pending requests per class
+static const char* TFLITE_ClassNames[TFLITE_CLASSES] = { "event", "interactive", "background" };
+static const unsigned int TFLITE_BucketLimits[TFLITE_BUCKETS - 1] = { 1, 5, 20, 50, 100, 200, 500 };	//ms
+
+typedef struct TFLITE_Class {
+	unsigned long	requests;
+	unsigned long	fresh;			//Served by a new inference
+	unsigned long	coalesced;		//Served by the last result
+	unsigned long	failed;
+	unsigned long	rejected;		//Submitted while the queue was full
+	unsigned int	pending;		//Queued and not yet started
+	unsigned int	maxPending;
+	unsigned long	wait[TFLITE_BUCKETS];		//Due to start, ms
+	unsigned long	latency[TFLITE_BUCKETS];	//Due to result, ms
+} TFLITE_Class;
+
+typedef struct TFLITE_Ticket {
+	int				priority;
+	gint64			ready;		//Monotonic us the request was due
+	TFLITE_Callback	callback;
+	void*			data;
+	cJSON*			result;
+	gint64			started;
+	double			latency;	//Frame to result, ms. Preprocess, job and decode
+	bool			cached;
+} TFLITE_Ticket;
+
+TFLITE_Class requestClasses[TFLITE_CLASSES];
+GQueue pendingRequests[TFLITE_CLASSES];
+GMutex queueMutex;		//Guards the classes and the queues
+GCond queueCond;		//A request was queued
+GThread* inferenceThread = NULL;
+bool inferenceStop = false;
+int inferenceTid = 0;	//Kernel tid of the inference thread, for its scheduler statistics
+cJSON* lastResult = 0;
+gint64 lastResultTime = 0;
 
-	elapsedMs = (unsigned int) (((endTs.tv_sec - startTs.tv_sec) * 1000) + ((endTs.tv_usec - startTs.tv_usec) / 1000));
+static void
+TFLITE_Histogram( unsigned long* histogram, gint64 us ) {
+	unsigned int b = 0;
+	while( b < TFLITE_BUCKETS - 1 && us >= TFLITE_BucketLimits[b] * 1000LL )
+		b++;
+	histogram[b]++;
+}
 
-	cJSON* payload = cJSON_CreateObject();
-	cJSON_AddStringToObject( payload,"device", DEVICE_Prop("serial"));
-	cJSON_AddNumberToObject( payload,"timestamp", DEVICE_Timestamp());
-	cJSON_AddNumberToObject( payload,"duration", elapsedMs);
+static cJSON*
+TFLITE_HistogramJSON( const unsigned long* histogram ) {
 	cJSON* list = cJSON_CreateArray();
-	cJSON_AddItemToObject( payload,"list", list);
+	unsigned int b;
+	for( b = 0; b < TFLITE_BUCKETS; b++ ) {
+		cJSON* bucket = cJSON_CreateObject();
+		if( b < TFLITE_BUCKETS - 1 )
+			cJSON_AddNumberToObject( bucket, "le", TFLITE_BucketLimits[b] );
+		cJSON_AddNumberToObject( bucket, "count", histogram[b] );
+		cJSON_AddItemToArray( list, bucket );
+	}
+	return list;
+}
 
-	uint8_t* outputPtr = (uint8_t*) larodOutput1Addr;
-	
-	int i;
-	for( i = 0; i < numberOfLabels; i++ ) {
-		double score = (double)(*((uint8_t*) (outputPtr + i)) / 255.0 * 100);  //Turn 0-255 to 0-100%
-		if( score >=  confidenceLevel && labels && labels->type != cJSON_NULL ) {
-			cJSON* item = cJSON_CreateObject();
-			cJSON_AddStringToObject( item,"label",cJSON_GetArrayItem(labels,i)->valuestring );
-			cJSON_AddNumberToObject( item,"score", (int)score );
-			cJSON_AddItemToArray(list,item);
+static void
+TFLITE_Queue() {
+	TFLITE_Class classes[TFLITE_CLASSES];
+	g_mutex_lock( &queueMutex );
+	memcpy( classes, requestClasses, sizeof(classes) );
+	g_mutex_unlock( &queueMutex );
+	int c;
+	for( c = 0; c < TFLITE_CLASSES; c++ ) {
+		TFLITE_Class* class = &classes[c];
+		cJSON* status = cJSON_CreateObject();
+		cJSON_AddNumberToObject( status, "requests", class->requests );
+		cJSON_AddNumberToObject( status, "fresh", class->fresh );
+		cJSON_AddNumberToObject( status, "coalesced", class->coalesced );
+		cJSON_AddNumberToObject( status, "failed", class->failed );
+		cJSON_AddNumberToObject( status, "rejected", class->rejected );
+		cJSON_AddNumberToObject( status, "pending", class->pending );
+		cJSON_AddNumberToObject( status, "maxPending", class->maxPending );
+		cJSON_AddItemToObject( status, "wait", TFLITE_HistogramJSON( class->wait ) );
+		cJSON_AddItemToObject( status, "latency", TFLITE_HistogramJSON( class->latency ) );
+		STATUS_SetObject( "queue", TFLITE_ClassNames[c], status );
+	}
+}
+
+//Runs the request on the inference thread with modelMutex held
+static void
+TFLITE_Serve( TFLITE_Ticket* ticket ) {
+	gint64 now = g_get_monotonic_time();
+	ticket->started = now;
+	if( ticket->priority != TFLITE_EVENT && lastResult && now - lastResultTime < coalesceTime ) {
+		ticket->result = cJSON_Duplicate( lastResult, 1 );
+		cJSON_AddBoolToObject( ticket->result, "cached", 1 );
+		cJSON_AddNumberToObject( ticket->result, "age", (now - lastResultTime) / 1000 );
+		ticket->cached = true;
+	} else {
+		ticket->result = TFLITE_Frame( ticket->priority == TFLITE_EVENT ? ticket->ready : 0 );
+		if( ticket->result ) {
+			cJSON_Delete( lastResult );
+			lastResult = cJSON_Duplicate( ticket->result, 1 );
+			lastResultTime = now;
+			ticket->latency = frameWork / 1000.0;
 		}
 	}
-	
-	returnFrame(provider, buf);
-	inferenceRunning = 0;	
-	LOG_TRACE("%s: Exit\n",__func__);
-	return payload;
 }
 
+static gboolean
+TFLITE_Deliver( gpointer data ) {
+	TFLITE_Ticket* ticket = data;
+	ticket->callback( ticket->result, ticket->latency, ticket->data );
+	free( ticket );
+	return FALSE;
+}
+
+//Counts the served request and hands the result to the main loop. Called with queueMutex held
+static void
+TFLITE_Served( TFLITE_Ticket* ticket ) {
+	TFLITE_Class* class = &requestClasses[ticket->priority];
+	gint64 now = g_get_monotonic_time();
+	TFLITE_Histogram( class->wait, ticket->started > ticket->ready ? ticket->started - ticket->ready : 0 );
+	if( ticket->result ) {
+		if( ticket->cached )
+			class->coalesced++;
+		else
+			class->fresh++;
+		TFLITE_Histogram( class->latency, now > ticket->ready ? now - ticket->ready : 0 );
+	} else {
+		class->failed++;
+	}
+	//Ahead of HTTP requests waiting on the main loop, triggers first
+	g_idle_add_full( ticket->priority == TFLITE_EVENT ? G_PRIORITY_HIGH : G_PRIORITY_DEFAULT, TFLITE_Deliver, ticket, NULL );
+}
+
+static gpointer
+TFLITE_Worker( gpointer data ) {
+	g_mutex_lock( &queueMutex );
+	inferenceTid = syscall( SYS_gettid );
+	g_cond_broadcast( &queueCond );
+	while( !inferenceStop ) {
+		TFLITE_Ticket* ticket = 0;
+		int c;
+		for( c = 0; c < TFLITE_CLASSES && !ticket; c++ )
+			ticket = g_queue_pop_head( &pendingRequests[c] );
+		if( !ticket ) {
+			g_cond_wait( &queueCond, &queueMutex );
+			continue;
+		}
+		requestClasses[ticket->priority].pending--;
+		g_mutex_unlock( &queueMutex );
+		g_mutex_lock( &modelMutex );
+		TFLITE_Serve( ticket );
+		if( atomic_exchange( &statusWanted, 0 ) ) {
+			cJSON* snapshot = TFLITE_Snapshot();
+			g_mutex_lock( &statusMutex );
+			cJSON_Delete( statusSnapshot );
+			statusSnapshot = snapshot;
+			g_mutex_unlock( &statusMutex );
+		}
+		g_mutex_unlock( &modelMutex );
+		g_mutex_lock( &queueMutex );
+		TFLITE_Served( ticket );
+	}
+	g_mutex_unlock( &queueMutex );
+	return NULL;
+}
+
+int
+TFLITE_ThreadId() {
+	return inferenceTid;
+}
+
+bool
+TFLITE_Submit( int priority, int64_t ready, TFLITE_Callback callback, void* data ) {
+	if( priority < 0 || priority >= TFLITE_CLASSES )
+		priority = TFLITE_BACKGROUND;
+	gint64 now = g_get_monotonic_time();
+	//An event may be stamped a little in the future. It then waits for a frame after it
+	if( !ready || (ready > now && priority != TFLITE_EVENT) )
+		ready = now;
+	TFLITE_Class* class = &requestClasses[priority];
+	g_mutex_lock( &queueMutex );
+	if( !inferenceThread || class->pending >= TFLITE_DEPTH ) {
+		if( inferenceThread )
+			class->rejected++;
+		g_mutex_unlock( &queueMutex );
+		return false;
+	}
+	TFLITE_Ticket* ticket = calloc( 1, sizeof(TFLITE_Ticket) );
+	if( !ticket ) {
+		g_mutex_unlock( &queueMutex );
+		return false;
+	}
+	ticket->priority = priority;
+	ticket->ready = ready;
+	ticket->callback = callback;
+	ticket->data = data;
+	g_queue_push_tail( &pendingRequests[priority], ticket );
+	class->requests++;
+	class->pending++;
+	if( class->pending > class->maxPending )
+		class->maxPending = class->pending;
+	g_cond_signal( &queueCond );
+	g_mutex_unlock( &queueMutex );
+	return true;
+}
+
+//The inference path only updates counters. The status groups are built from them once a second
+static gboolean
+TFLITE_Status( gpointer data ) {
+	cJSON* snapshot = 0;
+	if( g_mutex_trylock( &modelMutex ) ) {
+		snapshot = TFLITE_Snapshot();
+		g_mutex_unlock( &modelMutex );
+	} else {
+		g_mutex_lock( &statusMutex );
+		snapshot = statusSnapshot;
+		statusSnapshot = 0;
+		g_mutex_unlock( &statusMutex );
+		atomic_store( &statusWanted, 1 );
+	}
+	if( snapshot )
+		TFLITE_Publish( snapshot );
+	TFLITE_Queue();
+	AUDIT_Status();
+	return TRUE;
+}
+
+/*
+ * Settings for model i. With a "models" array each entry holds the model specific
+ * settings and the root object the defaults. Without it the root object is the only model.
+ */
+static cJSON*
+TFLITE_ModelSettings( size_t i ) {
+	cJSON* list = cJSON_GetObjectItem(TFLITE_Settings,"models");
+	if( list && list->type == cJSON_Array && cJSON_GetArraySize(list) > 0 )
+		return cJSON_GetArrayItem( list, i );
+	return TFLITE_Settings;
+}
 
 static void
 TFLITE_HTTP_Settings(const HTTP_Response response,const HTTP_Request request) {
-	
+
 	if( !TFLITE_Settings ) {
 		LOG_WARN("%s: TFLITE_Settings is NULL\n",__func__ );
 		HTTP_Respond_Error( response, 400, "Settings corrupt");
@@ -382,71 +996,616 @@ TFLITE_HTTP_Settings(const HTTP_Response response,const HTTP_Request request) {
 		return;
 	}
 
+	//The inference thread reads the settings
+	g_mutex_lock( &modelMutex );
 	cJSON* param = params->child;
 	while(param) {
-		if( cJSON_GetObjectItem(TFLITE_Settings,param->string ) )
+		cJSON* current = cJSON_GetObjectItem(TFLITE_Settings,param->string );
+		if( current && strcmp(param->string,"models") == 0 ) {
+			//Loaded models can be tuned but not added or removed
+			if( param->type != cJSON_Array || cJSON_GetArraySize(param) != cJSON_GetArraySize(current) ) {
+				LOG_WARN("%s: models ignored. Number of models can not change\n",__func__);
+				param = param->next;
+				continue;
+			}
+			int i;
+			for( i = 0; i < cJSON_GetArraySize(param); i++ ) {
+				cJSON* entry = cJSON_GetArrayItem(param,i);
+				if( !cJSON_GetObjectItem(entry,"labels") && cJSON_GetObjectItem(cJSON_GetArrayItem(current,i),"labels") )
+					cJSON_AddItemToObject(entry,"labels",cJSON_Duplicate(cJSON_GetObjectItem(cJSON_GetArrayItem(current,i),"labels"),1));
+			}
+		}
+		if( current )
 			cJSON_ReplaceItemInObject(TFLITE_Settings,param->string,cJSON_Duplicate(param,1) );
 		param = param->next;
 	}
 	cJSON_Delete(params);
 
-	confidenceLevel = cJSON_GetObjectItem(TFLITE_Settings,"confidence")?cJSON_GetObjectItem(TFLITE_Settings,"confidence")->valuedouble:60.0;
-	
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		models[i]->settings = TFLITE_ModelSettings(i);
+		MODEL_Settings( models[i] );
+	}
+	TFLITE_Limits();
+	g_mutex_unlock( &modelMutex );
+
 	FILE_Write( "localdata/model.json", TFLITE_Settings);
 	LOG_TRACE("HTTP Exit\n");
 	HTTP_Respond_Text( response, "OK" );
 }
 
-void 
+/*
+ * Hot model swap. A replacement model is opened on its own larod connection and warmed
+ * up in a background thread while inference continues with the current model. The swap
+ * itself runs on the main loop between two requests, holding modelMutex, and only replaces pointers.
+ * The old model is closed in the background.
+ */
+typedef struct TFLITE_Swap_Job {
+	MODEL_Instance*	old;
+	MODEL_Instance*	model;		//Replacement. 0 if it failed
+	cJSON*			settings;	//Replacement settings, a copy of the old settings with the new files
+	cJSON*			defaults;	//Copy of the root settings for the thread
+	const char*		status;
+	unsigned int	warmup;
+	gint64			started;
+	double			loadTime;	//ms
+	double			warmupTime;	//ms
+	MODEL_Instance*	close;		//Model closed by the close thread
+	char			remove[2][128];	//Files deleted after it is closed
+	guint			idle;		//Source of TFLITE_Swap once loaded
+} TFLITE_Swap_Job;
+
+TFLITE_Swap_Job* swapJob = NULL;	//Set while a swap is in progress
+GThread* swapThread = NULL;		//Loads swapJob. Joined when the swap runs or on close
+GThread* closeThread = NULL;	//Closes the last replaced model
+
+static gpointer
+TFLITE_Swap_Close( gpointer data ) {
+	TFLITE_Swap_Job* job = data;
+	int i;
+	if( job->close )
+		MODEL_Close( job->close );
+	for( i = 0; i < 2; i++ )
+		if( job->remove[i][0] && remove( job->remove[i] ) != 0 )
+			LOG_WARN("%s: Unable to delete %s\n",__func__,job->remove[i]);
+	free( job );
+	return NULL;
+}
+
+//Closes the model and deletes the files in job->remove off the main loop. Frees the job
+static void
+TFLITE_Swap_Finish( TFLITE_Swap_Job* job ) {
+	cJSON_Delete( job->defaults );
+	swapJob = NULL;
+	//The last close had a whole load and warm-up to finish
+	if( closeThread )
+		g_thread_join( closeThread );
+	closeThread = g_thread_new( "close", TFLITE_Swap_Close, job );
+	if( !closeThread )
+		TFLITE_Swap_Close( job );
+}
+
+//The upload file a model uses, if it is one
+static void
+TFLITE_Swap_Uploaded( const char* path, const char* prefix, char* copy ) {
+	const char* name = strstr( path, prefix );
+	if( name && strlen( name ) < sizeof(((TFLITE_Swap_Job*)0)->remove[0]) )
+		strcpy( copy, name );
+}
+
+static gboolean
+TFLITE_Swap( gpointer data ) {
+	TFLITE_Swap_Job* job = data;
+	MODEL_Instance* old = job->old;
+	MODEL_Instance* model = job->model;
+	cJSON* list = cJSON_GetObjectItem( TFLITE_Settings, "models" );
+	int index = 0;
+
+	//The load thread has returned or is about to
+	g_thread_join( swapThread );
+	swapThread = NULL;
+
+	//The settings entry of the old model is replaced. Fail if it was removed meanwhile
+	if( model && old->settings != TFLITE_Settings ) {
+		for( index = 0; index < cJSON_GetArraySize( list ); index++ )
+			if( cJSON_GetArrayItem( list, index ) == old->settings )
+				break;
+		if( index == cJSON_GetArraySize( list ) ) {
+			job->status = "Model settings no longer exist";
+			model = 0;
+		}
+	}
+	if( !model ) {
+		LOG_WARN("%s: %s\n",__func__,job->status);
+		STATUS_SetString( "swap", "state", "Failed" );
+		STATUS_SetString( "swap", "status", job->status );
+		cJSON_Delete( job->settings );
+		//job->remove holds the files renamed from the upload
+		job->close = job->model;
+		TFLITE_Swap_Finish( job );
+		return FALSE;
+	}
+
+	g_mutex_lock( &modelMutex );
+	gint64 start = g_get_monotonic_time();
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		if( models[i] == old )
+			models[i] = model;
+		if( models[i]->gate == old )
+			models[i]->gate = model;
+	}
+	model->gate = old->gate;
+	//The replacement takes over the settings entry of the old model
+	if( old->settings == TFLITE_Settings ) {
+		//Labels read from a file are not kept in settings
+		if( !cJSON_GetObjectItem( job->settings, "labels" ) )
+			cJSON_DeleteItemFromObject( TFLITE_Settings, "labels" );
+		cJSON* item = job->settings->child;
+		while( item ) {
+			cJSON* next = item->next;
+			if( cJSON_GetObjectItem( TFLITE_Settings, item->string ) )
+				cJSON_ReplaceItemInObject( TFLITE_Settings, item->string, cJSON_Duplicate( item, 1 ) );
+			else
+				cJSON_AddItemToObject( TFLITE_Settings, item->string, cJSON_Duplicate( item, 1 ) );
+			item = next;
+		}
+		cJSON_Delete( job->settings );
+		model->settings = TFLITE_Settings;
+		model->labels = cJSON_GetObjectItem( TFLITE_Settings, "labels" );
+		model->defaults = 0;
+	} else {
+		cJSON_ReplaceItemInArray( list, index, job->settings );
+		model->settings = job->settings;
+		model->defaults = TFLITE_Settings;
+	}
+	double downtime = (g_get_monotonic_time() - start) / 1000.0;
+	g_mutex_unlock( &modelMutex );
+
+	//Uploaded files of the old model are deleted once it is closed, unless the new model kept them
+	memset( job->remove, 0, sizeof(job->remove) );
+	if( strcmp( old->modelFilePath, model->modelFilePath ) != 0 )
+		TFLITE_Swap_Uploaded( old->modelFilePath, "localdata/model-", job->remove[0] );
+	if( strcmp( old->labelsFilePath, model->labelsFilePath ) != 0 )
+		TFLITE_Swap_Uploaded( old->labelsFilePath, "localdata/labels-", job->remove[1] );
+	job->close = old;
+
+	FILE_Write( "localdata/model.json", TFLITE_Settings);
+	LOG("%s: %s loaded in %.0f ms, warm-up %.0f ms, downtime %.3f ms\n",__func__,model->name,job->loadTime,job->warmupTime,downtime);
+	STATUS_SetString( "swap", "state", "OK" );
+	STATUS_SetString( "swap", "status", "Model swapped" );
+	STATUS_SetNumber( "swap", "loadTime", job->loadTime );
+	STATUS_SetNumber( "swap", "warmupTime", job->warmupTime );
+	STATUS_SetNumber( "swap", "downtime", downtime );
+	STATUS_SetString( "model", "architecture", models[0]->architecture );
+	TFLITE_Swap_Finish( job );
+	return FALSE;
+}
+
+static gpointer
+TFLITE_Swap_Load( gpointer data ) {
+	TFLITE_Swap_Job* job = data;
+	MODEL_Instance* model = MODEL_Open( ACAP_PACKAGE, job->old->name, job->settings, job->defaults, &job->status );
+	//The old version is still running
+	if( model )
+		model->pruneCache = false;
+	if( model && !MODEL_Load( model, ACAP_PACKAGE, job->old->chip, &job->status ) ) {
+		MODEL_Close( model );
+		model = 0;
+	}
+	if( model ) {
+		MODEL_Stream( model, streamWidth, streamHeight );
+		if( !MODEL_Tensors( model, 0, &job->status ) ) {
+			MODEL_Close( model );
+			model = 0;
+		} else {
+			TFLITE_Preprocess_Open( model );
+		}
+	}
+	job->loadTime = (g_get_monotonic_time() - job->started) / 1000.0;
+	gint64 start = g_get_monotonic_time();
+	if( model && !MODEL_Warmup( model, job->warmup ) ) {
+		job->status = "Warm-up inference failed";
+		MODEL_Close( model );
+		model = 0;
+	}
+	job->warmupTime = (g_get_monotonic_time() - start) / 1000.0;
+	job->model = model;
+	job->idle = g_idle_add( TFLITE_Swap, job );
+	return NULL;
+}
+
+//A file name under localdata/ or model/ of the package. Nothing outside the package is loaded
+static bool
+TFLITE_Swap_Path( const char* path ) {
+	const char* name = 0;
+	if( strncmp( path, "localdata/", 10 ) == 0 )
+		name = path + 10;
+	else if( strncmp( path, "model/", 6 ) == 0 )
+		name = path + 6;
+	return name && name[0] && !strchr( name, '/' ) && !strstr( name, ".." ) && strlen( path ) < sizeof(((TFLITE_Swap_Job*)0)->remove[0]);
+}
+
+//Renames upload to localdata/<prefix>-<n><suffix> with the first n not in use
+static bool
+TFLITE_Swap_Rename( const char* upload, const char* prefix, const char* suffix, char* path ) {
+	unsigned int n;
+	if( !FILE_Exists( upload ) )
+		return false;
+	for( n = 1; n < 1000; n++ ) {
+		snprintf( path, sizeof(((TFLITE_Swap_Job*)0)->remove[0]), "localdata/%s-%u%s", prefix, n, suffix );
+		if( !FILE_Exists( path ) )
+			break;
+	}
+	if( n == 1000 || rename( upload, path ) != 0 ) {
+		LOG_WARN("%s: Unable to rename %s\n",__func__,upload);
+		path[0] = 0;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * upload=model|labels&offset=N&data=BASE64  Writes a chunk of a new model or labels file
+ * activate=1[&model=name][&file=path][&labels=path]  Loads and swaps in the model.
+ * Default is the uploaded files. Paths are file names under localdata/ or model/.
+ * Without parameters the state of the last swap is returned.
+ */
+static void
+TFLITE_HTTP_Swap(const HTTP_Response response,const HTTP_Request request) {
+	const char* upload = HTTP_Request_Param( request, "upload");
+	const char* activate = HTTP_Request_Param( request, "activate");
+
+	if( upload ) {
+		const char* data = HTTP_Request_Param( request, "data");
+		const char* offset = HTTP_Request_Param( request, "offset");
+		long position = offset ? atol( offset ) : 0;
+		if( !data ) {
+			HTTP_Respond_Error( response, 400, "Missing data");
+			return;
+		}
+		const char* path = strcmp( upload, "labels" ) == 0 ? "localdata/upload.txt" : "localdata/upload.tflite";
+		FILE* file = FILE_Open( path, position ? "r+b" : "wb" );
+		if( !file || fseek( file, position, SEEK_SET ) != 0 ) {
+			if( file )
+				fclose( file );
+			HTTP_Respond_Error( response, 500, "Unable to write upload");
+			return;
+		}
+		gsize length = 0;
+		guchar* bytes = g_base64_decode( data, &length );
+		size_t written = bytes ? fwrite( bytes, 1, length, file ) : 0;
+		fclose( file );
+		g_free( bytes );
+		if( written != length ) {
+			HTTP_Respond_Error( response, 500, "Unable to write upload");
+			return;
+		}
+		HTTP_Respond_String( response, "Content-Type: text/plain; charset=utf-8; Cache-Control: no-cache\r\n\r\n%ld", position + (long)written );
+		return;
+	}
+
+	if( !activate ) {
+		HTTP_Respond_JSON( response, STATUS_Group( "swap" ) );
+		return;
+	}
+
+	if( swapJob ) {
+		HTTP_Respond_Error( response, 400, "Swap in progress");
+		return;
+	}
+	const char* file = HTTP_Request_Param( request, "file");
+	const char* labels = HTTP_Request_Param( request, "labels");
+	if( (file && !TFLITE_Swap_Path( file )) || (labels && !TFLITE_Swap_Path( labels )) ) {
+		HTTP_Respond_Error( response, 400, "Files must be under localdata/ or model/");
+		return;
+	}
+	MODEL_Instance* old = numModels ? models[0] : 0;
+	const char* name = HTTP_Request_Param( request, "model");
+	if( name )
+		old = TFLITE_Model( name );
+	if( !old ) {
+		HTTP_Respond_Error( response, 400, "Unknown model");
+		return;
+	}
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		if( models[i] != old && models[i]->inputOwner == old ) {
+			HTTP_Respond_Error( response, 400, "Model input is shared by another model");
+			return;
+		}
+	}
+
+	TFLITE_Swap_Job* job = calloc( 1, sizeof(TFLITE_Swap_Job) );
+	if( !job ) {
+		HTTP_Respond_Error( response, 500, "Memory allocation error");
+		return;
+	}
+	//Uploaded files are renamed to a name no file has, so the files of the running model
+	//are never overwritten. They are deleted after the model that used them is closed
+	if( !file ) {
+		if( !TFLITE_Swap_Rename( "localdata/upload.tflite", "model", ".tflite", job->remove[0] ) ) {
+			free( job );
+			HTTP_Respond_Error( response, 400, "No model uploaded");
+			return;
+		}
+		file = job->remove[0];
+		if( !labels && TFLITE_Swap_Rename( "localdata/upload.txt", "labels", ".txt", job->remove[1] ) )
+			labels = job->remove[1];
+	}
+	job->old = old;
+	job->settings = cJSON_Duplicate( old->settings, 1 );
+	job->defaults = old->defaults ? cJSON_Duplicate( old->defaults, 1 ) : 0;
+	job->status = "Failed loading model";
+	job->warmup = cJSON_GetObjectItem(TFLITE_Settings,"warmup") ? cJSON_GetObjectItem(TFLITE_Settings,"warmup")->valueint : 1;
+	job->started = g_get_monotonic_time();
+	cJSON_DeleteItemFromObject( job->settings, "models" );
+	cJSON_DeleteItemFromObject( job->settings, "file" );
+	cJSON_AddStringToObject( job->settings, "file", file );
+	if( labels ) {
+		cJSON_DeleteItemFromObject( job->settings, "labelsFile" );
+		cJSON_AddStringToObject( job->settings, "labelsFile", labels );
+		//Labels are read from the new file
+		cJSON_DeleteItemFromObject( job->settings, "labels" );
+	}
+
+	swapJob = job;
+	swapThread = g_thread_new( "swap", TFLITE_Swap_Load, job );
+	if( !swapThread ) {
+		cJSON_Delete( job->settings );
+		TFLITE_Swap_Finish( job );
+		HTTP_Respond_Error( response, 500, "Unable to start model load");
+		return;
+	}
+	STATUS_SetString( "swap", "state", "Loading" );
+	STATUS_SetString( "swap", "status", file );
+	HTTP_Respond_Text( response, "OK" );
+}
+
+void
 TFLITE_Close() {
-	
+
+	//A swap still loading is waited for and dropped. The main loop no longer runs it
+	if( swapThread ) {
+		g_thread_join( swapThread );
+		swapThread = NULL;
+		g_source_remove( swapJob->idle );
+		cJSON_Delete( swapJob->settings );
+		swapJob->close = swapJob->model;
+		TFLITE_Swap_Finish( swapJob );
+	}
+	if( closeThread ) {
+		g_thread_join( closeThread );
+		closeThread = NULL;
+	}
+
+	if( inferenceThread ) {
+		g_mutex_lock( &queueMutex );
+		inferenceStop = true;
+		g_cond_broadcast( &queueCond );
+		g_mutex_unlock( &queueMutex );
+		g_thread_join( inferenceThread );
+		inferenceThread = NULL;
+		//Nobody gets these results after the main loop has stopped
+		int c;
+		for( c = 0; c < TFLITE_CLASSES; c++ ) {
+			TFLITE_Ticket* ticket;
+			while( (ticket = g_queue_pop_head( &pendingRequests[c] )) )
+				free( ticket );
+			requestClasses[c].pending = 0;
+		}
+		inferenceStop = false;
+		inferenceTid = 0;
+		cJSON_Delete( statusSnapshot );
+		statusSnapshot = 0;
+	}
+
     if (provider) {
 		stopFrameFetch(provider);
         destroyImgProvider(provider);
+		provider = NULL;
 	}
-    
-	if( model )
-		larodDestroyModel(&model);
 
-    if (conn)
-        larodDisconnect(&conn, NULL);
-    
-    if (larodModelFd >= 0)
-        close(larodModelFd);
+	if( tilePool ) {
+		g_thread_pool_free( tilePool, FALSE, TRUE );
+		tilePool = NULL;
+	}
 
-    if (larodInputAddr != MAP_FAILED)
-        munmap(larodInputAddr, modelWidth * modelHeigth * CHANNELS);
+	//Models sharing an input buffer are closed before the owner
+	while( numModels > 0 ) {
+		numModels--;
+		MODEL_Close( models[numModels] );
+		models[numModels] = 0;
+	}
+	PREPROCESS_Cache_Close();
+	if( usePyramid )
+		PYRAMID_Close( &pyramid );
+	usePyramid = false;
+	frame.pyramid = 0;
+	cJSON_Delete( lastResult );
+	lastResult = 0;
+	cJSON_Delete( sweepTable );
+	sweepTable = 0;
+	sweepThreads = 0;
+	cJSON_Delete( calibration );
+	calibration = 0;
+
+	TFLITE_State( 0, "Not avaialble" );
+	STATUS_SetString( "model", "acrhitecture", "Undefined" );
 
-    if (larodInputFd >= 0)
-        close(larodInputFd);
+}
 
-    if (larodOutput1Addr != MAP_FAILED)
-        munmap(larodOutput1Addr, numberOfLabels );
+static cJSON*
+TFLITE_Fail( const char* status ) {
+	TFLITE_Close();
+	TFLITE_State( 0, status );
+	return 0;
+}
 
-    if (larodOutput1Fd >= 0)
-        close(larodOutput1Fd);
+/*
+ * Calibration. With "calibrate": true a model is timed on every chip on the first start and
+ * loaded on the fastest by "calibrationMetric" (p50, p99 or throughput). The table is saved
+ * in localdata/calibration.json under the model content hash so a new model file is timed again.
+ */
 
-    larodDestroyInferenceRequest(&infReq);
-    larodDestroyTensors(&inputTensors, numInputs);
-    larodDestroyTensors(&outputTensors, numOutputs);
-    larodClearError(&error);
-    
-	STATUS_SetString( "model", "status", "Not avaialble" );
-	STATUS_SetBool( "model", "state", 0 );	
-	STATUS_SetString( "model", "acrhitecture", "Undefined" );	
+static int
+TFLITE_Calibration( MODEL_Instance* model ) {
+	cJSON* setting = MODEL_Setting( model, "calibrate" );
+	if( !setting || setting->type != cJSON_True || !calibration || !MODEL_Hash( model ) )
+		return 0;
+	cJSON* entry = cJSON_GetObjectItem( calibration, model->hash );
+	if( !entry ) {
+		setting = MODEL_Setting( model, "calibrationRuns" );
+		entry = cJSON_CreateObject();
+		cJSON_AddStringToObject( entry, "model", model->name );
+		cJSON_AddStringToObject( entry, "file", model->modelFilePath );
+		cJSON_AddItemToObject( entry, "table", MODEL_Calibrate( model, ACAP_PACKAGE, setting && setting->type == cJSON_Number ? setting->valueint : 20 ) );
+		cJSON_AddItemToObject( calibration, model->hash, entry );
+		calibrationChanged = true;
+	}
+	setting = MODEL_Setting( model, "calibrationMetric" );
+	const char* metric = setting && setting->type == cJSON_String ? setting->valuestring : "p50";
+	int chip = MODEL_Fastest( cJSON_GetObjectItem( entry, "table" ), metric );
+	cJSON* previous = cJSON_GetObjectItem( entry, "metric" );
+	cJSON* chosen = cJSON_GetObjectItem( entry, "chip" );
+	if( !previous || !chosen || strcmp( previous->valuestring, metric ) != 0 || chosen->valueint != chip ) {
+		cJSON_DeleteItemFromObject( entry, "metric" );
+		cJSON_DeleteItemFromObject( entry, "chip" );
+		cJSON_AddStringToObject( entry, "metric", metric );
+		cJSON_AddNumberToObject( entry, "chip", chip );
+		calibrationChanged = true;
+	}
+	LOG( "%s: %s selected chip %d by %s\n", __func__, model->name, chip, metric );
+	return chip;
+}
 
+/*
+ * Responds with the calibration tables per model hash.
+ * reset=1 removes them so the models are timed again on next start.
+ */
+static void
+TFLITE_HTTP_Calibration(const HTTP_Response response,const HTTP_Request request) {
+	if( !calibration ) {
+		HTTP_Respond_Error( response, 400, "Calibration not available");
+		return;
+	}
+	const char* reset = HTTP_Request_Param( request, "reset");
+	if( reset && strcmp( reset, "1" ) == 0 ) {
+		cJSON_Delete( calibration );
+		calibration = cJSON_CreateObject();
+		FILE_Write( "localdata/calibration.json", calibration );
+		HTTP_Respond_Text( response, "Calibration is made on next restart" );
+		return;
+	}
+	HTTP_Respond_JSON( response, calibration );
+}
+
+/*
+ * Startup. Settings and labels are read first since they give the stream resolution.
+ * The models are then loaded on larod in a second thread while the main thread sets up
+ * the video stream. The chip that worked is saved in localdata/chip.json and tried first
+ * on the next start.
+ */
+typedef struct TFLITE_Load_Job {
+	int			chip;		//Chip from the last start, 0 if unknown
+	bool		ok;
+	const char*	status;
+	gint64		start;
+	gint64		end;
+} TFLITE_Load_Job;
+
+gint64 startupTime = 0;
+
+static gpointer
+TFLITE_Load( gpointer data ) {
+	TFLITE_Load_Job* job = data;
+	job->start = g_get_monotonic_time();
+	job->ok = true;
+	size_t i;
+	for( i = 0; i < numModels && job->ok; i++ ) {
+		int chip = TFLITE_Calibration( models[i] );
+		job->ok = MODEL_Load( models[i], ACAP_PACKAGE, chip ? chip : job->chip, &job->status );
+	}
+	job->end = g_get_monotonic_time();
+	return NULL;
+}
+
+/*
+ * Model cache statistics. localdata/cache.json keeps the load time of each model hash per
+ * architecture from the start it was loaded without the cache, so a hit reports the time saved.
+ * The status group "startup" gets "cache" with the load time breakdown per model.
+ */
+static void
+TFLITE_Cache() {
+	cJSON* saved = FILE_Read( "localdata/cache.json" );
+	if( !saved )
+		saved = cJSON_CreateObject();
+	bool changed = false;
+	cJSON* list = cJSON_CreateArray();
+	size_t i;
+	for( i = 0; i < numModels; i++ ) {
+		MODEL_Instance* model = models[i];
+		cJSON* item = cJSON_CreateObject();
+		cJSON_AddStringToObject( item, "model", model->name );
+		cJSON_AddStringToObject( item, "architecture", model->architecture );
+		cJSON_AddStringToObject( item, "cache", model->cache ? model->cache : "off" );
+		cJSON_AddNumberToObject( item, "hash", model->hashTime );
+		cJSON_AddNumberToObject( item, "connect", model->connectTime );
+		cJSON_AddNumberToObject( item, "compile", model->compileTime );
+		cJSON_AddNumberToObject( item, "total", model->loadTime );
+		cJSON_AddItemToArray( list, item );
+		if( !model->hash[0] || !model->cache || strcmp( model->cache, "off" ) == 0 )
+			continue;
+		cJSON* entry = cJSON_GetObjectItem( saved, model->hash );
+		if( !entry ) {
+			entry = cJSON_CreateObject();
+			cJSON_AddItemToObject( saved, model->hash, entry );
+		}
+		cJSON* cold = cJSON_GetObjectItem( entry, model->architecture );
+		if( strcmp( model->cache, "miss" ) == 0 ) {
+			if( cold )
+				cJSON_DeleteItemFromObject( entry, model->architecture );
+			cJSON_AddNumberToObject( entry, model->architecture, model->compileTime );
+			changed = true;
+		} else if( cold ) {
+			cJSON_AddNumberToObject( item, "saved", cold->valueint - (int)model->compileTime );
+		}
+	}
+	if( changed ) {
+		//Only the hashes of the current models are kept
+		cJSON* entry = saved->child;
+		while( entry ) {
+			cJSON* next = entry->next;
+			for( i = 0; i < numModels && strcmp( models[i]->hash, entry->string ) != 0; i++ );
+			if( i == numModels )
+				cJSON_DeleteItemFromObject( saved, entry->string );
+			entry = next;
+		}
+		FILE_Write( "localdata/cache.json", saved );
+	}
+	cJSON_Delete( saved );
+	STATUS_SetObject( "startup", "cache", list );
+}
+
+//Adds a startup phase in ms relative to the start of TFLITE()
+static void
+TFLITE_Phase( cJSON* timeline, const char* phase, gint64 start, gint64 end ) {
+	cJSON* item = cJSON_CreateObject();
+	cJSON_AddStringToObject( item, "phase", phase );
+	cJSON_AddNumberToObject( item, "start", (start - startupTime) / 1000 );
+	cJSON_AddNumberToObject( item, "duration", (end - start) / 1000 );
+	cJSON_AddItemToArray( timeline, item );
 }
 
 cJSON*
 TFLITE( const char* package ) {
 	LOG_TRACE("%s: \n",__func__);
+	startupTime = g_get_monotonic_time();
 	ACAP_PACKAGE = package;
-	STATUS_SetString( "model", "status", "Initializing" );
-	STATUS_SetBool( "model", "state", 0 );	
-	STATUS_SetString( "model", "architecture", "Undefined" );	
-
-	sprintf(modelFilePath,"/usr/local/packages/%s/model/model.tflite", package);
-	sprintf(labelsFilePath,"/usr/local/packages/%s/model/labels.txt", package);
+	TFLITE_State( 0, "Initializing" );
+	STATUS_SetString( "model", "architecture", "Undefined" );
+	cJSON* timeline = cJSON_CreateArray();
+	STATUS_SetObject( "startup", "timeline", timeline );
 
 	TFLITE_Settings = FILE_Read( "html/config/model.json" );
 	if(!TFLITE_Settings)
@@ -463,137 +1622,214 @@ TFLITE( const char* package ) {
 		cJSON_Delete(savedSettings);
 	}
 
-	confidenceLevel = cJSON_GetObjectItem(TFLITE_Settings,"confidence")?cJSON_GetObjectItem(TFLITE_Settings,"confidence")->valuedouble:60.0;
-	modelWidth = cJSON_GetObjectItem(TFLITE_Settings,"modelWidth")?cJSON_GetObjectItem(TFLITE_Settings,"modelWidth")->valueint:224;
-	modelHeigth = cJSON_GetObjectItem(TFLITE_Settings,"modelHeigth")?cJSON_GetObjectItem(TFLITE_Settings,"modelHeigth")->valueint:224;
-	
-	if( !cJSON_GetObjectItem(TFLITE_Settings,"labels") )
-		cJSON_AddItemToObject(TFLITE_Settings,"labels",parseLabels(labelsFilePath));
-	if( cJSON_GetObjectItem(TFLITE_Settings,"labels")->type == cJSON_NULL )
-		cJSON_ReplaceItemInObject(TFLITE_Settings,"labels",parseLabels(labelsFilePath));
-	labels = cJSON_GetObjectItem(TFLITE_Settings,"labels");
-	numberOfLabels = labels?cJSON_GetArraySize(labels):0;
-
-	if( numberOfLabels == 0 ){
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","No labels for this model");
-        TFLITE_Close();
-		return 0;
-	}
-
-    if (!chooseStreamResolution(modelWidth, modelHeigth, &streamWidth,&streamHeight)) {
-        LOG_WARN( "%s: Failed choosing stream resolution\n", __func__);
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","No valid stream resolutions");
-        TFLITE_Close();
-		return 0;
-    }
-
-    provider = createImgProvider(streamWidth, streamHeight, 2, VDO_FORMAT_YUV);
-    if (!provider) {
-		LOG_WARN( "%s: Failed to create ImgProvider\n", __func__);
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed to create image provider");
-        TFLITE_Close();
-		return 0;
-    }
-
-    larodModelFd = open(modelFilePath, O_RDONLY);
-    if (larodModelFd < 0) {
-        LOG_WARN( "%s: Unable to open model file %s: %s\n", __func__,modelFilePath,  strerror(errno));
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Model file does not exist");
-		return 0;
-    }
-    if (!setupLarod(larodModelFd, &conn, &model)) {
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed setting up architecture");
-		return 0;
-    }
-
-    // Allocate space for input tensor
-    if (!createAndMapTmpFile(CONV_INP_FILE_PATTERN, modelWidth * modelHeigth * CHANNELS, &larodInputAddr, &larodInputFd)) {
-		STATUS_SetString( "model", "status", "Allocation failed" );
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Input data allocation failed");
-		return 0;
-    }
-    // Allocate space for output tensor 1 (Locations)
-    if (!createAndMapTmpFile(CONV_OUT1_FILE_PATTERN, numberOfLabels,  &larodOutput1Addr, &larodOutput1Fd)) {
-		STATUS_SetString( "model", "status", "Allocation failed" );
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Output data allocation failed");
-		return 0;
-    }
-    inputTensors = larodCreateModelInputs(model, &numInputs, &error);
-    if (!inputTensors) {
-		STATUS_SetString( "model", "status", "Failed retrieving input tensors" );
-        LOG_WARN( "Failed retrieving input tensors: %s\n", error->msg);
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed initializing input tensor");
-		return 0;
-    }
-    if (!larodSetTensorFd(inputTensors[0], larodInputFd, &error)) {
-		STATUS_SetString( "model", "status", "Failed setting input tensor" );
-        LOG_WARN( "%s: Failed setting input tensor fd: %s\n", __func__,error->msg);
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed initializing input tensor");
-		return 0;
-    }
-    outputTensors = larodCreateModelOutputs(model, &numOutputs, &error);
-    if (!outputTensors) {
-		STATUS_SetString( "model", "status", "Failed retrieving output tensors" );
-        LOG_WARN( "%s: Failed retrieving output tensors: %s\n", __func__, error->msg);
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed initializing output tensor");
-		return 0;
-    }
-
-    if (!larodSetTensorFd(outputTensors[0], larodOutput1Fd, &error)) {
-		STATUS_SetString( "model", "status", "Failed setting output tensor" );
-        LOG_WARN( "%s: Failed setting output tensor fd: %s\n", __func__, error->msg);
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed initializing output tensor");
-		return 0;
-    }
+	//Threads created later inherit this. The pool and the fetcher are placed on their own
+	cpu_set_t cores;
+	if( TFLITE_Affinity( "inference", &cores ) )
+		sched_setaffinity( 0, sizeof(cores), &cores );
 
-    infReq = larodCreateInferenceRequest(model, inputTensors, numInputs, outputTensors,numOutputs, &error);
-    if (!infReq) {
-		STATUS_SetString( "model", "status", "Failed creating inference request" );
-        LOG_WARN( "%s: Failed creating inference request: %s\n", __func__, error->msg);
-        TFLITE_Close();
-		STATUS_SetBool("model","state",0);
-		STATUS_SetString("model","status","Failed creating inference request");
-		return 0;
-    }
+	cJSON* scheduling = cJSON_GetObjectItem(TFLITE_Settings,"scheduling");
+	roundRobin = scheduling && scheduling->type == cJSON_String && strcmp(scheduling->valuestring,"round-robin") == 0;
+	TFLITE_Limits();
 
-	if( !TFLITE_Settings )
-		LOG_WARN("%s: CCC TFLITE_Settings is NULL\n",__func__ );
+	cJSON* list = cJSON_GetObjectItem(TFLITE_Settings,"models");
+	size_t count = (list && list->type == cJSON_Array) ? cJSON_GetArraySize(list) : 0;
+	if( count > MAX_MODELS ) {
+		LOG_WARN( "%s: %u models configured. Max is %d\n", __func__, (unsigned)count, MAX_MODELS);
+		count = MAX_MODELS;
+	}
+	if( count == 0 )
+		count = 1;
+
+	unsigned int maxWidth = 0, maxHeight = 0;
+	size_t i;
+	for( i = 0; i < count; i++ ) {
+		cJSON* settings = TFLITE_ModelSettings(i);
+		char name[64];
+		cJSON* setting = cJSON_GetObjectItem(settings,"name");
+		if( setting && setting->type == cJSON_String )
+			snprintf( name, sizeof(name), "%s", setting->valuestring );
+		else if( settings == TFLITE_Settings )
+			snprintf( name, sizeof(name), "model" );
+		else
+			snprintf( name, sizeof(name), "model%u", (unsigned)i );
+
+		const char* status = "Failed loading model";
+		models[i] = MODEL_Open( package, name, settings, settings == TFLITE_Settings ? 0 : TFLITE_Settings, &status );
+		if( !models[i] )
+			return TFLITE_Fail( status );
+		numModels++;
+		if( models[i]->width > maxWidth )
+			maxWidth = models[i]->width;
+		if( models[i]->height > maxHeight )
+			maxHeight = models[i]->height;
+	}
+	//Tiling needs a higher resolution than the models. "streamWidth" and "streamHeight" set the minimum
+	cJSON* setting = cJSON_GetObjectItem(TFLITE_Settings,"streamWidth");
+	if( setting && setting->type == cJSON_Number && setting->valueint > (int)maxWidth )
+		maxWidth = setting->valueint;
+	setting = cJSON_GetObjectItem(TFLITE_Settings,"streamHeight");
+	if( setting && setting->type == cJSON_Number && setting->valueint > (int)maxHeight )
+		maxHeight = setting->valueint;
+	TFLITE_Phase( timeline, "settings", startupTime, g_get_monotonic_time() );
+
+	//"gate": "name" makes a model run only when the named model reports something
+	for( i = 0; i < numModels; i++ ) {
+		cJSON* gate = cJSON_GetObjectItem( models[i]->settings, "gate" );
+		if( !gate || gate->type != cJSON_String )
+			continue;
+		models[i]->gate = TFLITE_Model( gate->valuestring );
+		MODEL_Instance* link = models[i]->gate;
+		while( link && link != models[i] )
+			link = link->gate;
+		if( !models[i]->gate || link ) {
+			LOG_WARN( "%s: Invalid gate %s for %s\n", __func__, gate->valuestring, models[i]->name);
+			models[i]->gate = 0;
+		}
+	}
 
+	//Load the models on larod while the stream is set up
+	TFLITE_Load_Job load = { 0, false, "Failed loading model", 0, 0 };
+	cJSON* chip = FILE_Read( "localdata/chip.json" );
+	if( chip && cJSON_GetObjectItem( chip, "chip" ) )
+		load.chip = cJSON_GetObjectItem( chip, "chip" )->valueint;
+	cJSON_Delete( chip );
+	calibration = FILE_Read( "localdata/calibration.json" );
+	if( !calibration )
+		calibration = cJSON_CreateObject();
+	GThread* loader = g_thread_new( "load", TFLITE_Load, &load );
+	if( !loader )
+		TFLITE_Load( &load );
+
+	//One stream that fits the largest model
+	gint64 start = g_get_monotonic_time();
+	const char* streamStatus = 0;
+    if (!chooseStreamResolution(maxWidth, maxHeight, &streamWidth,&streamHeight)) {
+        LOG_WARN( "%s: Failed choosing stream resolution\n", __func__);
+		streamStatus = "No valid stream resolutions";
+    } else {
+		//Frames kept for triggers with a timestamp in the past
+		cJSON* keep = cJSON_GetObjectItem(TFLITE_Settings,"keepFrames");
+		unsigned int frames = keep && keep->type == cJSON_Number ? keep->valueint : 2;
+		if( frames < 2 || frames > NUM_VDO_BUFFERS - 2 )
+			frames = 2;
+		provider = createImgProvider(streamWidth, streamHeight, frames, VDO_FORMAT_YUV);
+		if (!provider) {
+			LOG_WARN( "%s: Failed to create ImgProvider\n", __func__);
+			streamStatus = "Failed to create image provider";
+		}
+	}
+	TFLITE_Phase( timeline, "stream", start, g_get_monotonic_time() );
+
+	if( loader )
+		g_thread_join( loader );
+	TFLITE_Phase( timeline, "models", load.start, load.end );
+	if( calibrationChanged )
+		FILE_Write( "localdata/calibration.json", calibration );
+	if( streamStatus )
+		return TFLITE_Fail( streamStatus );
+	if( !load.ok )
+		return TFLITE_Fail( load.status );
+	TFLITE_Cache();
+	STATUS_SetString( "model", "architecture", models[0]->architecture );
+	if( models[0]->chip != load.chip ) {
+		chip = cJSON_CreateObject();
+		cJSON_AddNumberToObject( chip, "chip", models[0]->chip );
+		cJSON_AddStringToObject( chip, "architecture", models[0]->architecture );
+		FILE_Write( "localdata/chip.json", chip );
+		cJSON_Delete( chip );
+	}
 
-	STATUS_SetNumber( "model", "labels", numberOfLabels );
-	STATUS_SetNumber( "model", "inputs", numInputs );
-	STATUS_SetNumber( "model", "outputs", numOutputs );
+	setting = cJSON_GetObjectItem(TFLITE_Settings,"preprocessThreads");
+	poolThreads = g_get_num_processors();
+	if( setting && setting->type == cJSON_Number && setting->valueint > 0 && setting->valueint < (int)poolThreads )
+		poolThreads = setting->valueint;
+	setting = cJSON_GetObjectItem(TFLITE_Settings,"threadSweep");
+	if( setting && setting->type == cJSON_True ) {
+		setting = cJSON_GetObjectItem(TFLITE_Settings,"sweepRuns");
+		if( setting && setting->type == cJSON_Number && setting->valueint > 0 )
+			sweepRuns = setting->valueint;
+		sweepThreads = poolThreads = 1;
+		sweepTable = cJSON_CreateArray();
+	}
 
+	start = g_get_monotonic_time();
+	setting = cJSON_GetObjectItem(TFLITE_Settings,"pyramid");
+	usePyramid = (!setting || setting->type != cJSON_False) && PYRAMID_Open( &pyramid, streamWidth, streamHeight );
+	for( i = 0; i < numModels; i++ ) {
+		//Models with the same input geometry share the preprocessed input. Crop models convert their own
+		MODEL_Instance* share = 0;
+		size_t j;
+		for( j = 0; j < i && !share && !models[i]->crops && !models[i]->numTiles; j++ )
+			if( !models[j]->crops && !models[j]->numTiles && models[j]->batch == 1 && models[j]->clip == 1 && models[j]->width == models[i]->width && models[j]->height == models[i]->height )
+				share = models[j];
+		const char* status = "Failed initializing tensors";
+		MODEL_Stream( models[i], streamWidth, streamHeight );
+		if( !MODEL_Tensors( models[i], share, &status ) )
+			return TFLITE_Fail( status );
+		TFLITE_Preprocess_Open( models[i] );
+		if( models[i]->numTiles && !tilePool )
+			tilePool = g_thread_pool_new( TFLITE_TileJob, "preprocess", poolThreads, TRUE, NULL );
+	}
+	//"tensorCache": recent input tensors kept for consumers asking for the same frame again
+	setting = cJSON_GetObjectItem(TFLITE_Settings,"tensorCache");
+	size_t cacheBytes = 0;
+	for( i = 0; i < numModels; i++ )
+		if( models[i]->itemSize / models[i]->clip > cacheBytes )
+			cacheBytes = models[i]->itemSize / models[i]->clip;
+	PREPROCESS_Cache_Open( setting && setting->type == cJSON_Number ? setting->valueint : 4, cacheBytes );
+	TFLITE_Phase( timeline, "tensors", start, g_get_monotonic_time() );
+
+	//The first inferences pay one-time runtime costs. Run them before reporting OK
+	start = g_get_monotonic_time();
+	unsigned int warmup = cJSON_GetObjectItem(TFLITE_Settings,"warmup") ? cJSON_GetObjectItem(TFLITE_Settings,"warmup")->valueint : 1;
+	for( i = 0; i < numModels; i++ )
+		if( !MODEL_Warmup( models[i], warmup ) )
+			return TFLITE_Fail( "Warm-up inference failed" );
+	TFLITE_Phase( timeline, "warmup", start, g_get_monotonic_time() );
+
+	STATUS_SetNumber( "model", "labels", models[0]->numberOfLabels );
+	STATUS_SetNumber( "model", "inputs", models[0]->numInputs );
+	STATUS_SetNumber( "model", "outputs", models[0]->numOutputs );
+	TFLITE_Publish( TFLITE_Snapshot() );
+
+	start = g_get_monotonic_time();
     if (!startFrameFetch(provider)) {
         LOG_WARN( "%s: Unable to start image provider\n",__func__);
-        TFLITE_Close();
-		STATUS_SetString("model","state","Unable to start image provider");
-		return 0;
+		return TFLITE_Fail( "Unable to start image provider" );
     }
-
-	STATUS_SetString( "model", "status", "OK" );
-	STATUS_SetBool( "model", "state", 1 );	
+	if( TFLITE_Affinity( "fetcher", &cores ) )
+		pthread_setaffinity_np( provider->fetcherThread, sizeof(cores), &cores );
+	//The sweep only applies to the tile pool
+	if( !tilePool && sweepTable ) {
+		sweepThreads = 0;
+		cJSON_Delete( sweepTable );
+		sweepTable = 0;
+	}
+	sweepState = sweepThreads ? "Sweeping" : "Fixed";
+	TFLITE_Publish( TFLITE_Snapshot() );
+	gint64 end = g_get_monotonic_time();
+	TFLITE_Phase( timeline, "start", start, end );
+	STATUS_SetNumber( "startup", "total", (end - startupTime) / 1000 );
+	LOG("%s: Started in %u ms\n", __func__, (unsigned)((end - startupTime) / 1000));
+
+	//Requests are served on their own thread. It inherits the "inference" cores
+	inferenceThread = g_thread_new( "inference", TFLITE_Worker, NULL );
+	if( !inferenceThread )
+		return TFLITE_Fail( "Unable to start inference thread" );
+	g_mutex_lock( &queueMutex );
+	while( !inferenceTid )
+		g_cond_wait( &queueCond, &queueMutex );
+	g_mutex_unlock( &queueMutex );
+
+	TFLITE_State( 1, "OK" );
+	STATUS_SetString( "swap", "state", "Idle" );
+	TFLITE_Queue();
+	g_timeout_add_seconds( 1, TFLITE_Status, NULL );
 
 	HTTP_Node("model",TFLITE_HTTP_Settings);
+	HTTP_Node("mask",TFLITE_HTTP_Mask);
+	HTTP_Node("swap",TFLITE_HTTP_Swap);
+	HTTP_Node("calibration",TFLITE_HTTP_Calibration);
 
     return TFLITE_Settings;
 }
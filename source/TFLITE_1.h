@@ -5,6 +5,8 @@
 #ifndef _TFLITE_H_
 #define _TFLITE_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef  __cplusplus
 extern "C" {
@@ -13,6 +15,20 @@ extern "C" {
 cJSON*  TFLITE( const char *package );  //Returns settings
 void 	TFLITE_Close();
 cJSON*	TFLITE_Inference();  //Note that response needs to be deleted with cHSON_Detete
+//Request classes, highest priority first
+#define TFLITE_EVENT		0	//External trigger. A new inference on the first frame at or after ready
+#define TFLITE_INTERACTIVE	1	//HTTP clients. May get a recent result
+#define TFLITE_BACKGROUND	2	//Timer. Runs when nothing else is pending
+//Result of a submitted request, called on the main loop. latency is the ms from frame to result,
+//without the wait for the frame. 0 for a copy of the last result. result is 0 if the inference failed, otherwise owned by the callback
+typedef void (*TFLITE_Callback)( cJSON* result, double latency, void* data );
+//Queues an inference for a request class. ready is the monotonic us the request was due, 0 for now.
+//False if the queue of the class is full
+bool	TFLITE_Submit( int priority, int64_t ready, TFLITE_Callback callback, void* data );
+//Kernel tid of the inference thread
+int		TFLITE_ThreadId();
+//Monotonic us of the last frame arrival, and the smoothed frame interval. 0 if unknown
+int64_t	TFLITE_FrameArrival( int64_t* interval );
 
 #ifdef  __cplusplus
 }
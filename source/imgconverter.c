@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <libyuv.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 
@@ -179,80 +180,123 @@ void ARGBtoRAW(const uint8_t* srcARGB, uint8_t* dstRGB, unsigned int w,
     }
 }
 
+void getCropRegion(unsigned int srcWidth, unsigned int srcHeight,
+                   unsigned int dstWidth, unsigned int dstHeight,
+                   unsigned int* clipX, unsigned int* clipY,
+                   unsigned int* clipW, unsigned int* clipH) {
+    // 1. The crop area shall fill the input image either horizontally or
+    //    vertically.
+    // 2. The crop area shall have the same aspect ratio as the output image.
+    float destWHratio = (float) srcWidth / (float) srcHeight;
+
+    float w = (float) srcWidth;
+    float h = w / destWHratio;
+    if (h > (float) srcHeight) {
+        h = (float) srcHeight;
+        w = h * destWHratio;
+    }
+
+    *clipW = (unsigned int) w;
+    *clipH = (unsigned int) h;
+    *clipX = (srcWidth - *clipW) / 2;
+    *clipY = (srcHeight - *clipH) / 2;
+}
+
 bool convertCropScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
                                 unsigned int srcHeight, uint8_t* rgbData,
                                 unsigned int dstWidth, unsigned int dstHeight) {
-    bool ret = false;
-    uint8_t* tempARGBbig = NULL;
-    uint8_t* tempARGBsmall = NULL;
-
-    tempARGBbig = malloc((size_t)(srcWidth * srcHeight * ARGB_BYTES_PER_PIXEL));
-    if (!tempARGBbig) {
-        syslog(LOG_ERR, "%s: Failed allocating big tempARGB buffer: %s", __func__,
-                 strerror(errno));
-        goto end;
-    }
+    unsigned int clipX, clipY, clipW, clipH;
+    getCropRegion(srcWidth, srcHeight, dstWidth, dstHeight, &clipX, &clipY,
+                  &clipW, &clipH);
+
+    ArgbScratch_t scratch = {0};
+    bool ret = convertRegionScaleU8yuvToRGB(nv12Data, srcWidth, srcHeight,
+                                            clipX, clipY, clipW, clipH, rgbData,
+                                            dstWidth, dstHeight, &scratch);
+    freeArgbScratch(&scratch);
+    return ret;
+}
 
-    tempARGBsmall =
-        malloc((size_t)(dstWidth * dstHeight * ARGB_BYTES_PER_PIXEL));
-    if (!tempARGBsmall) {
-        syslog(LOG_ERR, "%s: Failed allocating small tempARGB buffer: %s", __func__,
-                 strerror(errno));
-        goto end;
+static bool growArgbBuffer(uint8_t** buffer, size_t* size, size_t pixels) {
+    size_t bytes = pixels * ARGB_BYTES_PER_PIXEL;
+    if (bytes <= *size) {
+        return true;
     }
-
-    const uint8_t* uvPlane = nv12Data + (srcWidth * srcHeight);
-    unsigned int bigARGBstride = ARGB_BYTES_PER_PIXEL * srcWidth;
-    unsigned int smallARGBstride = ARGB_BYTES_PER_PIXEL * dstWidth;
-    int result = NV12ToARGB(nv12Data, (int) srcWidth, uvPlane, (int) srcWidth,
-                            tempARGBbig, (int) bigARGBstride, (int) srcWidth,
-                            (int) srcHeight);
-    if (result != 0) {
-        syslog(LOG_ERR, "%s: Failed NV12ToARGB() with result=%d", __func__, result);
-        goto end;
+    uint8_t* grown = realloc(*buffer, bytes);
+    if (!grown) {
+        syslog(LOG_ERR, "%s: Failed allocating tempARGB buffer: %s", __func__,
+               strerror(errno));
+        return false;
     }
+    *buffer = grown;
+    *size = bytes;
+    return true;
+}
 
-    // 1. The crop area shall fill the input image either horizontally or
-    //    vertically.
-    // 2. The crop area shall have the same aspect ratio as the output image.
-    float destWHratio = (float) srcWidth / (float) srcHeight;
+bool reserveArgbScratch(ArgbScratch_t* scratch, size_t bigPixels,
+                        size_t smallPixels) {
+    return growArgbBuffer(&scratch->big, &scratch->bigSize, bigPixels) &&
+           growArgbBuffer(&scratch->small, &scratch->smallSize, smallPixels);
+}
 
-    float clipW = (float) srcWidth;
-    float clipH = clipW / destWHratio;
-    if (clipH > (float) srcHeight) {
-        clipH = (float) srcHeight;
-        clipW = clipH * destWHratio;
+void freeArgbScratch(ArgbScratch_t* scratch) {
+    free(scratch->big);
+    free(scratch->small);
+    scratch->big = NULL;
+    scratch->small = NULL;
+    scratch->bigSize = 0;
+    scratch->smallSize = 0;
+}
+
+bool convertRegionScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
+                                  unsigned int srcHeight, unsigned int clipX,
+                                  unsigned int clipY, unsigned int clipW,
+                                  unsigned int clipH, uint8_t* rgbData,
+                                  unsigned int dstWidth, unsigned int dstHeight,
+                                  ArgbScratch_t* scratch) {
+
+    // NV12 chroma is subsampled 2x2. Start the region on an even pixel.
+    clipW += clipX & 1;
+    clipH += clipY & 1;
+    clipX &= ~1u;
+    clipY &= ~1u;
+    if (clipW == 0 || clipH == 0 || clipX + clipW > srcWidth ||
+        clipY + clipH > srcHeight) {
+        syslog(LOG_ERR, "%s: Region %ux%u at %u,%u is outside the image", __func__,
+                 clipW, clipH, clipX, clipY);
+        return false;
     }
 
-    unsigned int clipX = (srcWidth - (unsigned int) clipW) / 2;
-    unsigned int clipY = (srcHeight - (unsigned int) clipH) / 2;
+    // Only the region is converted to ARGB
+    if (!reserveArgbScratch(scratch, (size_t) clipW * clipH,
+                            (size_t) dstWidth * dstHeight)) {
+        return false;
+    }
+    uint8_t* tempARGBbig = scratch->big;
+    uint8_t* tempARGBsmall = scratch->small;
 
-    uint8_t* bigARGBcrop =
-        tempARGBbig + (bigARGBstride * clipY) + (ARGB_BYTES_PER_PIXEL * clipX);
+    const uint8_t* yCrop = nv12Data + (srcWidth * clipY) + clipX;
+    const uint8_t* uvCrop =
+        nv12Data + (srcWidth * srcHeight) + (srcWidth * (clipY / 2)) + clipX;
+    unsigned int bigARGBstride = ARGB_BYTES_PER_PIXEL * clipW;
+    unsigned int smallARGBstride = ARGB_BYTES_PER_PIXEL * dstWidth;
+    int result = NV12ToARGB(yCrop, (int) srcWidth, uvCrop, (int) srcWidth,
+                            tempARGBbig, (int) bigARGBstride, (int) clipW,
+                            (int) clipH);
+    if (result != 0) {
+        syslog(LOG_ERR, "%s: Failed NV12ToARGB() with result=%d", __func__, result);
+        return false;
+    }
 
-    // We use pointer offset (bigARGBcrop), clipW and clipH to realize the
-    // cropping of source image.
-    result = ARGBScale(bigARGBcrop, (int) bigARGBstride, (int) clipW,
+    result = ARGBScale(tempARGBbig, (int) bigARGBstride, (int) clipW,
                        (int) clipH, tempARGBsmall, (int) smallARGBstride,
                        (int) dstWidth, (int) dstHeight, kFilterBilinear);
     if (result != 0) {
         syslog(LOG_ERR, "%s: Failed ARGBScale() with result=%d", __func__, result);
-        goto end;
+        return false;
     }
 
     ARGBtoRAW(tempARGBsmall, rgbData, dstWidth, dstHeight);
 
-    ret = true;
-
-end:
-    if (tempARGBbig) {
-        free(tempARGBbig);
-        tempARGBbig = NULL;
-    }
-    if (tempARGBsmall) {
-        free(tempARGBsmall);
-        tempARGBsmall = NULL;
-    }
-
-    return ret;
+    return true;
 }
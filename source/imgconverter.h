@@ -24,6 +24,31 @@
 #include <stdbool.h>
 
 #include "stdint.h"
+#include <stddef.h>
+
+/**
+ * brief ARGB work buffers of convertRegionScaleU8yuvToRGB().
+ *
+ * The buffers grow to the largest region and output converted and are
+ * then reused, so a conversion does not allocate. Zero initialize, size
+ * with reserveArgbScratch() up front and release with freeArgbScratch().
+ * Not thread safe. Use one per thread or job.
+ */
+typedef struct {
+    uint8_t* big;
+    size_t bigSize;
+    uint8_t* small;
+    size_t smallSize;
+} ArgbScratch_t;
+
+/**
+ * brief Make room for a region of bigPixels and an output of smallPixels.
+ *
+ * param False if an allocation failed.
+ */
+bool reserveArgbScratch(ArgbScratch_t* scratch, size_t bigPixels,
+                        size_t smallPixels);
+void freeArgbScratch(ArgbScratch_t* scratch);
 
 /**
  * brief Converts an input NV12 image to float interleaved RGB.
@@ -58,6 +83,22 @@ void convertU8yuvToRGBlibYuv(unsigned int width, unsigned int height,
 void convertU8yuvToRGBnaive(unsigned int width, unsigned int height,
                             uint8_t* yuvIn, uint8_t* rgbOut);
 
+/**
+ * brief Get the source region that convertCropScaleU8yuvToRGB() scales.
+ *
+ * Use it to map coordinates in the model input back to the source image.
+ *
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
+ * param clipX, clipY, clipW, clipH Region of the source image in pixels.
+ */
+void getCropRegion(unsigned int srcWidth, unsigned int srcHeight,
+                   unsigned int dstWidth, unsigned int dstHeight,
+                   unsigned int* clipX, unsigned int* clipY,
+                   unsigned int* clipW, unsigned int* clipH);
+
 /**
  * brief Convert, crop and scale image.
  *
@@ -80,3 +121,27 @@ void convertU8yuvToRGBnaive(unsigned int width, unsigned int height,
 bool convertCropScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
                                 unsigned int srcHeight, uint8_t* rgbData,
                                 unsigned int dstWidth, unsigned int dstHeight);
+
+/**
+ * brief Convert and scale a region of the image.
+ *
+ * Same as convertCropScaleU8yuvToRGB() but the caller selects the region.
+ * The region is moved to start on an even pixel to follow the NV12 chroma
+ * samples. Only the region is converted.
+ *
+ * param nv12Data Pointer to start of NV12 data.
+ * param srcWidth Source image width in pixels.
+ * param srcHeight Source image height in pixels.
+ * param clipX, clipY, clipW, clipH Region of the source image in pixels.
+ * param rgbData Start of output scaled RGB image.
+ * param dstWidth Destination image width in pixels.
+ * param dstHeight Destination image height in pixels.
+ * param scratch Work buffers, grown if too small.
+ * param False if any errors occur, otherwise true.
+ */
+bool convertRegionScaleU8yuvToRGB(const uint8_t* nv12Data, unsigned int srcWidth,
+                                  unsigned int srcHeight, unsigned int clipX,
+                                  unsigned int clipY, unsigned int clipW,
+                                  unsigned int clipH, uint8_t* rgbData,
+                                  unsigned int dstWidth, unsigned int dstHeight,
+                                  ArgbScratch_t* scratch);
@@ -24,8 +24,10 @@
 #include <errno.h>
 #include <gmodule.h>
 #include <syslog.h>
+#include <time.h>
 #include <vdo-channel.h>
 
+#include "vdo-frame.h"
 #include "vdo-map.h"
 
 #define VDO_CHANNEL (1)
@@ -68,24 +70,26 @@ static void releaseVdoBuffers(ImgProvider_t* provider);
  * Responsible for fetching buffers/frames from VDO and re-enqueue buffers back
  * to VDO when they are not needed by the application. The ImgProvider always
  * keeps one or several of the most recent frames available in the application.
- * There are two queues involved: deliveredFrames and processedFrames.
- * - deliveredFrames are frames delivered from VDO and
- *   not processed by the client.
+ * There are three queues involved: deliveredFrames, heldFrames and
+ * processedFrames.
+ * - deliveredFrames are the most recent frames delivered from VDO. A frame
+ *   handed out stays here, so several consumers can get the same frame.
+ * - heldFrames are the frames handed out, once per consumer, until returned.
  * - processedFrames are frames that the client has consumed and handed
- *   back to the ImgProvider.
+ *   back to the ImgProvider, and that are no longer delivered.
  * The thread works roughly like this:
  * 1. The thread blocks on vdo_stream_get_buffer() until VDO deliver a new
  * frame.
  * 2. The fresh frame is put at the end of the deliveredFrame queue. If the
  *    client want to fetch a frame the item at the end of deliveredFrame
  *    list is returned.
- * 3. If there are any frames in the processedFrames list one of these are
- *    enqueued back to VDO to keep the flow of buffers.
- * 4. If the processedFrames list is empty we instead check if there are
- *    frames available in the deliveredFrames list. We want to make sure
- *    there is at least numAppFrames buffers available to the client to
- *    fetch. If there are more than numAppFrames in deliveredFrames we
- *    pick the first buffer (oldest) in the list and enqueue it to VDO.
+ * 3. We want to make sure there is at least numAppFrames buffers available
+ *    to the client to fetch. If there are more than numAppFrames in
+ *    deliveredFrames the first buffer (oldest) in the list is moved to
+ *    processedFrames, unless a client holds it. It is then moved there
+ *    when returned.
+ * 4. The frames in the processedFrames list are enqueued back to VDO to
+ *    keep the flow of buffers.
 
  * param data Pointer to ImgProvider owning thread.
  * return Pointer to unused return data.
@@ -133,6 +137,12 @@ ImgProvider_t* createImgProvider(unsigned int w, unsigned int h,
         goto errorExit;
     }
 
+    provider->heldFrames = g_queue_new();
+    if (!provider->heldFrames) {
+        syslog(LOG_ERR, "%s: Unable to create heldFrames queue!", __func__);
+        goto errorExit;
+    }
+
     if (!createStream(provider, w, h)) {
         syslog(LOG_ERR, "%s: Could not create VDO stream!", __func__);
         goto errorExit;
@@ -153,6 +163,9 @@ errorExit:
     if (provider->processedFrames) {
         g_queue_free(provider->processedFrames);
     }
+    if (provider->heldFrames) {
+        g_queue_free(provider->heldFrames);
+    }
 
     free(provider);
 
@@ -172,6 +185,7 @@ void destroyImgProvider(ImgProvider_t* provider) {
 
     g_queue_free(provider->deliveredFrames);
     g_queue_free(provider->processedFrames);
+    g_queue_free(provider->heldFrames);
 
     free(provider);
 }
@@ -358,7 +372,7 @@ VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
     VdoBuffer* returnBuf = NULL;
     pthread_mutex_lock(&provider->frameMutex);
 
-    while (g_queue_get_length(provider->deliveredFrames) < 1) {
+    while (g_queue_is_empty(provider->deliveredFrames)) {
         if (pthread_cond_wait(&provider->frameDeliverCond,
                               &provider->frameMutex)) {
             syslog(LOG_ERR, "%s: Failed to wait on condition: %s", __func__,
@@ -367,7 +381,10 @@ VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
         }
     }
 
-    returnBuf = g_queue_pop_tail(provider->deliveredFrames);
+    // The frames before it in the queue are all older than this one.
+    returnBuf = g_queue_peek_tail(provider->deliveredFrames);
+    g_queue_push_tail(provider->heldFrames, returnBuf);
+    provider->newFrames = 0;
 
 errorExit:
     pthread_mutex_unlock(&provider->frameMutex);
@@ -375,10 +392,65 @@ errorExit:
     return returnBuf;
 }
 
+VdoBuffer* getFrameAfterBlocking(ImgProvider_t* provider, uint64_t timestamp,
+                                 unsigned int timeoutMs) {
+    VdoBuffer* returnBuf = NULL;
+    struct timespec deadline;
+
+    // Condition variables wait on CLOCK_REALTIME by default.
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&provider->frameMutex);
+
+    while (!returnBuf) {
+        // Delivered frames are kept oldest first.
+        guint length = g_queue_get_length(provider->deliveredFrames);
+        for (guint i = 0; i < length; i++) {
+            VdoBuffer* buffer = g_queue_peek_nth(provider->deliveredFrames, i);
+            if (vdo_frame_get_timestamp(vdo_buffer_get_frame(buffer)) >= timestamp) {
+                returnBuf = buffer;
+                g_queue_push_tail(provider->heldFrames, returnBuf);
+                // Only the frames after it are newer than a frame handed out.
+                if (provider->newFrames > length - 1 - i) {
+                    provider->newFrames = length - 1 - i;
+                }
+                break;
+            }
+        }
+        if (returnBuf) {
+            break;
+        }
+        int error = pthread_cond_timedwait(&provider->frameDeliverCond,
+                                           &provider->frameMutex, &deadline);
+        if (error) {
+            if (error != ETIMEDOUT) {
+                syslog(LOG_ERR, "%s: Failed to wait on condition: %s", __func__,
+                         strerror(error));
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&provider->frameMutex);
+
+    return returnBuf;
+}
+
 void returnFrame(ImgProvider_t* provider, VdoBuffer* buffer) {
     pthread_mutex_lock(&provider->frameMutex);
 
-    g_queue_push_tail(provider->processedFrames, buffer);
+    // Still kept or held by another consumer. The last one out hands it back.
+    g_queue_remove(provider->heldFrames, buffer);
+    if (!g_queue_find(provider->heldFrames, buffer) &&
+        !g_queue_find(provider->deliveredFrames, buffer)) {
+        g_queue_push_tail(provider->processedFrames, buffer);
+    }
 
     pthread_mutex_unlock(&provider->frameMutex);
 }
@@ -399,27 +471,43 @@ static void* threadEntry(void* data) {
             g_clear_error(&error);
             continue;
         }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long arrival = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+
         pthread_mutex_lock(&provider->frameMutex);
 
         g_queue_push_tail(provider->deliveredFrames, newBuffer);
-
-        VdoBuffer* oldBuffer = NULL;
-
-        // First check if there are any frames returned from app
-        // processing
-        if (g_queue_get_length(provider->processedFrames) > 0) {
-            oldBuffer = g_queue_pop_head(provider->processedFrames);
-        } else {
-            // Client specifies the number-of-recent-frames it needs to collect
-            // in one chunk (numAppFrames). Thus only enqueue buffers back to
-            // VDO if we have collected more buffers than numAppFrames.
-            if (g_queue_get_length(provider->deliveredFrames) >
-                provider->numAppFrames) {
-                oldBuffer = g_queue_pop_head(provider->deliveredFrames);
+        provider->newFrames++;
+
+        // Smooth the interval over about 8 frames.
+        if (provider->frameCount > 0) {
+            long long interval = arrival - provider->frameArrival;
+            long long smoothed = provider->frameInterval;
+            provider->frameInterval =
+                smoothed ? smoothed + (interval - smoothed) / 8 : interval;
+        }
+        provider->frameArrival = arrival;
+        provider->frameCount++;
+
+        // Client specifies the number-of-recent-frames it needs to collect
+        // in one chunk (numAppFrames). Older frames go back to VDO, unless a
+        // client still holds one. That one goes back when it is returned.
+        if (g_queue_get_length(provider->deliveredFrames) >
+            provider->numAppFrames) {
+            VdoBuffer* oldest = g_queue_pop_head(provider->deliveredFrames);
+            if (!g_queue_find(provider->heldFrames, oldest)) {
+                g_queue_push_tail(provider->processedFrames, oldest);
+            }
+            if (provider->newFrames >
+                g_queue_get_length(provider->deliveredFrames)) {
+                provider->newFrames =
+                    g_queue_get_length(provider->deliveredFrames);
             }
         }
 
-        if (oldBuffer) {
+        VdoBuffer* oldBuffer = NULL;
+        while ((oldBuffer = g_queue_pop_head(provider->processedFrames))) {
             if (!vdo_stream_buffer_enqueue(provider->vdoStream, oldBuffer,
                                            &error)) {
                 // Fail but we continue anyway hoping for the best.
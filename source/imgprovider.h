@@ -23,6 +23,7 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "vdo-stream.h"
 #include "vdo-types.h"
@@ -47,14 +48,25 @@ typedef struct ImgProvider {
     /// Keeping track of frames' statuses.
     GQueue* deliveredFrames;
     GQueue* processedFrames;
+    /// Frames handed out and not yet returned, once per consumer holding it.
+    GQueue* heldFrames;
     /// Number of frames to keep in the deliveredFrames queue.
     unsigned int numAppFrames;
+    /// Frames at the tail of deliveredFrames not handed out yet.
+    unsigned int newFrames;
 
     /// To support fetching frames asynchonously with VDO.
     pthread_mutex_t frameMutex;
     pthread_cond_t frameDeliverCond;
     pthread_t fetcherThread;
     atomic_bool shutDown;
+
+    /// Frame arrival, CLOCK_MONOTONIC microseconds, to align inference with frames.
+    atomic_llong frameArrival;
+    /// Smoothed time between frame arrivals in microseconds. 0 until two frames arrived.
+    atomic_llong frameInterval;
+    /// Number of frames delivered.
+    atomic_ullong frameCount;
 } ImgProvider_t;
 
 /**
@@ -116,14 +128,35 @@ bool stopFrameFetch(ImgProvider_t* provider);
 /**
  * brief Get the most recent frame the thread has fetched from VDO.
  *
+ * The frame stays delivered, so consumers asking before the next frame
+ * arrives get the same buffer and can tell by its sequence number. A frame
+ * is never older than an earlier one. Waits only until the first frame.
+ *
  * param provider Pointer to an ImgProvider fetching frames.
  * return Pointer to an image buffer on success, otherwise NULL.
  */
 VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider);
 
+/**
+ * brief Get the oldest kept frame captured at or after a point in time.
+ *
+ * Waits for a new frame if all kept frames are older. Like
+ * getLastFrameBlocking() the frame stays available to other consumers.
+ *
+ * param provider Pointer to an ImgProvider fetching frames.
+ * param timestamp Capture time in microseconds, the clock of vdo_frame_get_timestamp().
+ * param timeoutMs Max time to wait for a frame.
+ * return Pointer to an image buffer on success, otherwise NULL.
+ */
+VdoBuffer* getFrameAfterBlocking(ImgProvider_t* provider, uint64_t timestamp,
+                                 unsigned int timeoutMs);
+
 /**
  * brief Release reference to an image buffer.
  *
+ * The buffer goes back to VDO once no consumer holds it and it is no
+ * longer among the kept frames.
+ *
  * param provider Pointer to an ImgProvider fetching frames.
  * param buffer Pointer to the image buffer to be released.
  */
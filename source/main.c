@@ -21,13 +21,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <glib/gi18n.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "APP.h"
 #include "HTTP.h"
 #include "STATUS.h"
+#include "RATE.h"
+#include "SCHEDULE.h"
 #include "TFLITE_1.h"
 
 #define LOG(fmt, args...)    { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args);}
@@ -38,7 +42,53 @@
 #define APP_PACKAGE	"tflite"
 
 volatile sig_atomic_t stopRunning = 0;
+RATE_Controller rate;
+SCHEDULE_Clock schedule;
+unsigned int scheduleInterval = 0;	//rate.interval the fixed schedule was armed with
+bool scheduleAligned = false;
 
+#define SCHEDULE_MARGIN	1000	//us after the frame arrival a tick is placed
+
+
+/*
+ * HTTP requests are answered from the request callback on the main loop, so the main loop
+ * keeps accepting requests, e.g. a trigger, while an inference runs
+ */
+static void
+Inference_Respond( cJSON* inference, double latency, void* data ) {
+	HTTP_Response response = data;
+	if(!inference) {
+		HTTP_Respond_Error( response, 500, "Inference failed" );
+		HTTP_Respond_Done( response );
+		return;
+	}
+	//Tells clients how often to poll when the rate is adaptive
+	if( rate.mode != RATE_FIXED )
+		cJSON_AddNumberToObject( inference, "interval", rate.interval );
+	HTTP_Respond_JSON( response, inference );
+	HTTP_Respond_Done( response );
+	cJSON_Delete(inference);
+}
+
+static void
+Trigger_Respond( cJSON* inference, double latency, void* data ) {
+	HTTP_Response response = data;
+	if(!inference)
+		HTTP_Respond_Error( response, 500, "No frame after trigger" );
+	else
+		HTTP_Respond_JSON( response, inference );
+	HTTP_Respond_Done( response );
+	cJSON_Delete(inference);
+}
+
+static void
+Inference_Submit( HTTP_Response response, int priority, int64_t ready, TFLITE_Callback callback ) {
+	HTTP_Respond_Defer( response );
+	if( !TFLITE_Submit( priority, ready, callback, response ) ) {
+		HTTP_Respond_Error( response, 503, "Too many pending requests" );
+		HTTP_Respond_Done( response );
+	}
+}
 
 static void
 Inference_HTTP(const HTTP_Response response,const HTTP_Request request) {
@@ -47,35 +97,58 @@ Inference_HTTP(const HTTP_Response response,const HTTP_Request request) {
 		HTTP_Respond_Error( response, 500, STATUS_String( "model", "status" ) );
 		return;
 	}
+	Inference_Submit( response, TFLITE_INTERACTIVE, 0, Inference_Respond );
+}
 
-	cJSON* inference = TFLITE_Inference();
-	if(!inference) {
-		HTTP_Respond_Error( response, 500, "Inference failed" );
+/*
+ * Inference on the first frame captured at or after the trigger.
+ * timestamp=EPOCH ms sets the trigger time. Default is when the request is received
+ */
+static void
+Trigger_HTTP(const HTTP_Response response,const HTTP_Request request) {
+	struct timespec real, mono;
+	clock_gettime( CLOCK_REALTIME, &real );
+	clock_gettime( CLOCK_MONOTONIC, &mono );
+	int64_t trigger = mono.tv_sec * 1000000LL + mono.tv_nsec / 1000;
+
+	const char* timestamp = HTTP_Request_Param( request, "timestamp");
+	if( timestamp ) {
+		int64_t now = real.tv_sec * 1000000LL + real.tv_nsec / 1000;
+		trigger -= now - (int64_t)(atof( timestamp ) * 1000);
+	}
+
+	if( !STATUS("model","state") ) {
+		HTTP_Respond_Error( response, 500, STATUS_String( "model", "status" ) );
 		return;
 	}
-	
-	HTTP_Respond_JSON( response, inference );
-	cJSON_Delete(inference);
+	Inference_Submit( response, TFLITE_EVENT, trigger, Trigger_Respond );
 }
 
-static gboolean
-Inference_Timer() {
-
-	cJSON* inference = TFLITE_Inference();
+static void
+Inference_Rate() {
+	STATUS_SetString( "rate", "mode", RATE_Mode( &rate ) );
+	STATUS_SetString( "rate", "state", rate.state );
+	STATUS_SetNumber( "rate", "target", rate.target );
+	STATUS_SetNumber( "rate", "interval", rate.interval );
+	STATUS_SetNumber( "rate", "fps", 1000.0 / rate.interval );
+	STATUS_SetNumber( "rate", "cpu", (int)(rate.cpu * 10) / 10.0 );
+	STATUS_SetNumber( "rate", "waiting", (int)(rate.waiting * 10) / 10.0 );
+	STATUS_SetNumber( "rate", "p95", (int)(rate.p95 * 10) / 10.0 );
+}
 
-	if(!inference)
-		return TRUE;
+static void
+Inference_Detections( cJSON* inference ) {
 
 	cJSON* list = cJSON_GetObjectItem(inference,"list");
 	if(!list) {
 		cJSON_Delete(inference);
-		return TRUE;
+		return;
 	}
 	
 	int numberOfDetections = cJSON_GetArraySize( list );
 	if( numberOfDetections == 0 ) {
 		cJSON_Delete(inference);
-		return TRUE;
+		return;
 	}
 
 	LOG("%d detections\n", numberOfDetections);
@@ -88,9 +161,104 @@ Inference_Timer() {
 		LOG("%s %d\n", label, score );
 		detection = detection->next;
 	}
+	cJSON_Delete(inference);
+}
+
+/*
+ * Background inferences are submitted to the request queue without waiting, so the main loop
+ * serves HTTP requests while they run. The timer re-arms itself when its request is done,
+ * with the interval from the rate controller
+ */
+int64_t timerDue = 0;
+int64_t tickArrival = 0;	//Frame arrival when the last tick was submitted
+bool timerPending = false;	//A background request is queued or running
+
+static gboolean Inference_Timer();
+
+static void
+Inference_Rearm( unsigned int interval ) {
+	timerDue = SCHEDULE_Now() + interval * 1000LL;
+	g_timeout_add_full( G_PRIORITY_LOW, interval, Inference_Timer, NULL, NULL );
+}
+
+//Continuous schedule. The next frame, or at once if one arrived since the tick
+static void
+Inference_Next() {
+	int64_t frameInterval = 0;
+	int64_t latest = TFLITE_FrameArrival( &frameInterval );
+	if( latest > tickArrival )
+		SCHEDULE_At( &schedule, SCHEDULE_Now() );
+	else
+		SCHEDULE_At( &schedule, frameInterval ? latest + frameInterval + SCHEDULE_MARGIN : SCHEDULE_Now() + 10000 );
+}
+
+static void
+Inference_Done( cJSON* inference, double latency, void* data ) {
+	timerPending = false;
+	//A copy of a recent result says nothing about the inference time
+	unsigned int interval = RATE_Update( &rate, inference && !cJSON_GetObjectItem( inference, "cached" ) ? latency : -1 );
+	if( inference )
+		Inference_Detections( inference );
+	if( schedule.mode == SCHEDULE_TIMER )
+		Inference_Rearm( interval );
+	else if( schedule.mode == SCHEDULE_CONTINUOUS )
+		Inference_Next();
+}
+
+static gboolean
+Inference_Timer() {
+	timerPending = TFLITE_Submit( TFLITE_BACKGROUND, timerDue, Inference_Done, NULL );
+	if( !timerPending )
+		Inference_Rearm( rate.interval );
+	return FALSE;
+}
+
+/*
+ * Fixed rate ticks are placed just after a frame arrives, with the period rounded to
+ * whole frames, so the frame used is as new as possible
+ */
+static void
+Inference_Align() {
+	int64_t frameInterval = 0;
+	int64_t arrival = TFLITE_FrameArrival( &frameInterval );
+	int64_t period = rate.interval * 1000LL;
+	if( frameInterval > 0 ) {
+		int64_t frames = (period + frameInterval / 2) / frameInterval;
+		period = (frames > 0 ? frames : 1) * frameInterval;
+	}
+	SCHEDULE_Periodic( &schedule, arrival ? arrival + SCHEDULE_MARGIN : SCHEDULE_Now(), period );
+	scheduleInterval = rate.interval;
+	scheduleAligned = frameInterval > 0;
+}
+
+static gboolean
+Inference_Tick( gint fd, GIOCondition condition, gpointer data ) {
+	if( !SCHEDULE_Tick( &schedule ) )
+		return TRUE;
+	int64_t frameInterval = 0;
+	tickArrival = TFLITE_FrameArrival( &frameInterval );
+	//A tick while the last request is still queued or running is skipped
+	if( !timerPending && TFLITE_Submit( TFLITE_BACKGROUND, schedule.deadline, Inference_Done, NULL ) ) {
+		timerPending = true;
+	} else {
+		schedule.skipped++;
+		if( schedule.mode == SCHEDULE_CONTINUOUS )
+			Inference_Next();
+	}
+	if( schedule.mode == SCHEDULE_FIXED && (!scheduleAligned || scheduleInterval != rate.interval || schedule.ticks % 256 == 0) ) {
+		//Re-aligned now and then as the measured frame interval is not exact
+		Inference_Align();
+	}
 	return TRUE;
 }
 
+//Rate and schedule status is built from the counters once a second, not per inference
+static gboolean
+Inference_Status( gpointer data ) {
+	Inference_Rate();
+	STATUS_SetObject( "rate", "schedule", SCHEDULE_Status( &schedule ) );
+	return TRUE;
+}
 
 void sigintHandler(int sig) {
     if (stopRunning) {
@@ -110,13 +278,33 @@ main() {
 	GMainLoop *loop;
 
 	APP( APP_PACKAGE, NULL );
-	APP_Register("model",TFLITE(APP_PACKAGE));
+	cJSON* settings = TFLITE(APP_PACKAGE);
+	APP_Register("model",settings);
 	HTTP_Node("inference",Inference_HTTP);
+	HTTP_Node("trigger",Trigger_HTTP);
 
-	g_timeout_add_seconds( 5, Inference_Timer, NULL );
+	cJSON* rateSettings = settings ? cJSON_GetObjectItem( settings, "rate" ) : 0;
+	RATE_Init( &rate, rateSettings );
+	RATE_Thread( &rate, TFLITE_ThreadId() );
+	Inference_Rate();
+	cJSON* mode = rateSettings ? cJSON_GetObjectItem( rateSettings, "schedule" ) : 0;
+	if( !SCHEDULE_Open( &schedule, SCHEDULE_Mode( mode && mode->type == cJSON_String ? mode->valuestring : 0 ) ) )
+		SCHEDULE_Open( &schedule, SCHEDULE_TIMER );
+	STATUS_SetObject( "rate", "schedule", SCHEDULE_Status( &schedule ) );
+	if( schedule.mode == SCHEDULE_TIMER ) {
+		Inference_Rearm( rate.interval );
+	} else {
+		if( schedule.mode == SCHEDULE_FIXED )
+			Inference_Align();
+		else
+			SCHEDULE_At( &schedule, SCHEDULE_Now() + rate.interval * 1000LL );
+		g_unix_fd_add_full( G_PRIORITY_LOW, schedule.fd, G_IO_IN, Inference_Tick, NULL, NULL );
+	}
+	g_timeout_add_seconds( 1, Inference_Status, NULL );
 
 	loop = g_main_loop_new(NULL, FALSE);
 	g_main_loop_run(loop);
 
+	SCHEDULE_Close( &schedule );
 	TFLITE_Close();
 }